@@ -17,6 +17,11 @@
   See LICENSES/BLOSC.txt for details about copyright and rights to use.
 **********************************************************************/
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+  /* For sched_setaffinity() */
+  #define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -35,6 +40,7 @@
   #include <unistd.h>
   #if defined(__linux__)
     #include <time.h>
+    #include <sched.h>
   #else
     #include <sys/time.h>
   #endif
@@ -324,6 +330,303 @@ void do_bench(char *compressor, int nthreads, int size, int elsize,
 }
 
 
+/* Measure how compression and decompression scale with the number of
+   threads for small blocksizes, where the synchronization between
+   threads weighs the most. */
+void do_scaling_bench(char *compressor, int max_nthreads, int size, int elsize,
+                      int rshift, FILE * ofile) {
+  void *src, *dest, *dest2;
+  int blocksizes[] = {8*KB, 16*KB, 32*KB};
+  int nblocksizes = (int)(sizeof(blocksizes) / sizeof(blocksizes[0]));
+  int clevel = 5, doshuffle = 1;
+  int b, i, nthreads_, retcode;
+  int cbytes = 0, nbytes = 0;
+  int scaling_niter = niter * 10;
+  blosc_timestamp_t last, current;
+  double tcomp, tdecomp, tcomp1 = 0., tdecomp1 = 0.;
+
+  if (blosc_set_compressor(compressor) < 0) {
+    printf("Compiled w/o support for compressor: '%s', so sorry.\n",
+           compressor);
+    exit(1);
+  }
+
+  retcode = posix_memalign( (void **)(&src), 32, size);
+  retcode |= posix_memalign( (void **)(&dest), 32, size+BLOSC_MAX_OVERHEAD);
+  retcode |= posix_memalign( (void **)(&dest2), 32, size);
+  if (retcode != 0) {
+    printf("Error allocating memory!\n");
+    exit(1);
+  }
+  memset(src, 0, size);
+  init_buffer(src, size, rshift);
+
+  fprintf(ofile, "********************** Run info ******************************\n");
+  fprintf(ofile, "Blosc version: %s (%s)\n", BLOSC_VERSION_STRING, BLOSC_VERSION_DATE);
+  fprintf(ofile, "Using synthetic data with %d significant bits (out of 32)\n", rshift);
+  fprintf(ofile, "Dataset size: %d bytes\tType size: %d bytes\n", size, elsize);
+  fprintf(ofile, "Compression level: %d\n", clevel);
+  fprintf(ofile, "********************** Thread scaling *************************\n");
+  fprintf(ofile, "%9s %8s %14s %8s %14s %8s\n", "blocksize", "nthreads",
+          "comp MB/s", "speedup", "decomp MB/s", "speedup");
+
+  for (b = 0; b < nblocksizes; b++) {
+    blosc_set_blocksize(blocksizes[b]);
+    for (nthreads_ = 1; nthreads_ <= max_nthreads; nthreads_++) {
+      blosc_set_nthreads(nthreads_);
+
+      blosc_set_timestamp(&last);
+      for (i = 0; i < scaling_niter; i++) {
+        cbytes = blosc_compress(clevel, doshuffle, elsize, size, src,
+                                dest, size+BLOSC_MAX_OVERHEAD);
+      }
+      blosc_set_timestamp(&current);
+      tcomp = get_usec_chunk(last, current, scaling_niter, 1);
+
+      blosc_set_timestamp(&last);
+      for (i = 0; i < scaling_niter; i++) {
+        nbytes = blosc_decompress(dest, dest2, size);
+      }
+      blosc_set_timestamp(&current);
+      tdecomp = get_usec_chunk(last, current, scaling_niter, 1);
+
+      if (nthreads_ == 1) {
+        tcomp1 = tcomp;
+        tdecomp1 = tdecomp;
+      }
+      fprintf(ofile, "%9d %8d %14.1f %7.2fx %14.1f %7.2fx\n",
+              blocksizes[b], nthreads_,
+              (size * 1e6) / (tcomp*MB), tcomp1 / tcomp,
+              (size * 1e6) / (tdecomp*MB), tdecomp1 / tdecomp);
+
+      if (cbytes <= 0 || nbytes != size || memcmp(src, dest2, size) != 0) {
+        fprintf(ofile, "Error: roundtrip failed (cbytes: %d, nbytes: %d)\n",
+                cbytes, nbytes);
+        exit(1);
+      }
+    }
+  }
+  /* Back to automatic blocksizes */
+  blosc_set_blocksize(0);
+
+  totalsize += (double)size * scaling_niter * max_nthreads * nblocksizes;
+
+  aligned_free(src); aligned_free(dest); aligned_free(dest2);
+}
+
+
+/* Measure the effect of putting the scratch buffers of the threads in
+   huge pages for large blocksizes, where TLB misses weigh the most */
+void do_hugepages_bench(char *compressor, int nthreads, int size, int elsize,
+                        int rshift, FILE * ofile) {
+  void *src = NULL, *dest = NULL, *dest2 = NULL;
+  int blocksizes[] = {256*KB, 512*KB, 1*MB, 2*MB};
+  int nblocksizes = (int)(sizeof(blocksizes) / sizeof(blocksizes[0]));
+  int clevel = 5, doshuffle = 1;
+  int b, i, huge, retcode;
+  int cbytes = 0, nbytes = 0;
+  int huge_niter = niter * 10;
+  struct blosc_ctx *ctx;
+  blosc_timestamp_t last, current;
+  double tcomp[2], tdecomp[2];
+
+  if (!blosc_set_hugepages(0)) {
+    printf("Huge pages are not supported on this platform, so sorry.\n");
+    exit(1);
+  }
+
+  retcode = posix_memalign( (void **)(&src), 32, size);
+  retcode |= posix_memalign( (void **)(&dest), 32, size+BLOSC_MAX_OVERHEAD);
+  retcode |= posix_memalign( (void **)(&dest2), 32, size);
+  if (retcode != 0) {
+    printf("Error allocating memory!\n");
+    exit(1);
+  }
+  memset(src, 0, size);
+  init_buffer(src, size, rshift);
+  memset(dest, 0, size+BLOSC_MAX_OVERHEAD);
+  memset(dest2, 0, size);
+
+  fprintf(ofile, "********************** Run info ******************************\n");
+  fprintf(ofile, "Blosc version: %s (%s)\n", BLOSC_VERSION_STRING, BLOSC_VERSION_DATE);
+  fprintf(ofile, "Using synthetic data with %d significant bits (out of 32)\n", rshift);
+  fprintf(ofile, "Dataset size: %d bytes\tType size: %d bytes\n", size, elsize);
+  fprintf(ofile, "Compression level: %d\tThreads: %d\n", clevel, nthreads);
+  fprintf(ofile, "********************** Scratch in huge pages ******************\n");
+  fprintf(ofile, "%9s %14s %14s %14s %14s\n", "", "4 KB pages", "",
+          "huge pages", "");
+  fprintf(ofile, "%9s %14s %14s %14s %14s\n", "blocksize", "comp MB/s",
+          "decomp MB/s", "comp MB/s", "decomp MB/s");
+
+  for (b = 0; b < nblocksizes; b++) {
+    for (huge = 0; huge < 2; huge++) {
+      /* Contexts keep their scratch, so they get it in the pages wanted */
+      blosc_set_hugepages(huge);
+      ctx = blosc_create_ctx(compressor, clevel, doshuffle, elsize,
+                             blocksizes[b], nthreads);
+      if (ctx == NULL) {
+        printf("Compiled w/o support for compressor: '%s', so sorry.\n",
+               compressor);
+        exit(1);
+      }
+
+      blosc_set_timestamp(&last);
+      for (i = 0; i < huge_niter; i++) {
+        cbytes = blosc_compress_with_ctx(ctx, size, src, dest, size+BLOSC_MAX_OVERHEAD);
+      }
+      blosc_set_timestamp(&current);
+      tcomp[huge] = get_usec_chunk(last, current, huge_niter, 1);
+
+      blosc_set_timestamp(&last);
+      for (i = 0; i < huge_niter; i++) {
+        nbytes = blosc_decompress_with_ctx(ctx, dest, dest2, size);
+      }
+      blosc_set_timestamp(&current);
+      tdecomp[huge] = get_usec_chunk(last, current, huge_niter, 1);
+
+      blosc_free_ctx(ctx);
+      if (cbytes <= 0 || nbytes != size || memcmp(src, dest2, size) != 0) {
+        fprintf(ofile, "Error: roundtrip failed (cbytes: %d, nbytes: %d)\n",
+                cbytes, nbytes);
+        exit(1);
+      }
+    }
+    fprintf(ofile, "%9d %14.1f %14.1f %14.1f %14.1f\n", blocksizes[b],
+            (size * 1e6) / (tcomp[0]*MB), (size * 1e6) / (tdecomp[0]*MB),
+            (size * 1e6) / (tcomp[1]*MB), (size * 1e6) / (tdecomp[1]*MB));
+  }
+  blosc_set_hugepages(0);
+
+  totalsize += (double)size * huge_niter * 2 * nblocksizes;
+
+  aligned_free(src); aligned_free(dest); aligned_free(dest2);
+}
+
+
+#if defined(__linux__)
+/* Pin the calling thread to the CPUs of NUMA node `node`, so that the
+   memory it touches first is allocated in that node.  Returns 0 on
+   success. */
+int pin_to_node(int node) {
+  char path[64], list[4096];
+  char *p, *end;
+  long first, last, cpu;
+  size_t len;
+  cpu_set_t cpus;
+  FILE *f;
+
+  sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+  f = fopen(path, "r");
+  if (f == NULL) {
+    return -1;
+  }
+  len = fread(list, 1, sizeof(list) - 1, f);
+  fclose(f);
+  list[len] = '\0';
+
+  CPU_ZERO(&cpus);
+  for (p = list; *p >= '0' && *p <= '9'; p = (*end == ',') ? end + 1 : end) {
+    first = strtol(p, &end, 10);
+    last = (*end == '-') ? strtol(end + 1, &end, 10) : first;
+    for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+      CPU_SET(cpu, &cpus);
+    }
+  }
+  return sched_setaffinity(0, sizeof(cpus), &cpus);
+}
+
+
+/* Measure the bandwidth with the buffers living in each NUMA node, with
+   and without NUMA-aware scheduling */
+void do_numa_bench(char *compressor, int nthreads, int size, int elsize,
+                   int rshift, FILE * ofile) {
+  void *src, *dest, *dest2;
+  int clevel = 5, doshuffle = 1;
+  int node, numa, nnodes, i, retcode;
+  int cbytes = 0, nbytes = 0;
+  int numa_niter = niter * 10;
+  cpu_set_t all_cpus;
+  blosc_timestamp_t last, current;
+  double tcomp[2], tdecomp[2];
+
+  nnodes = blosc_set_numa(0);
+  if (nnodes < 1) {
+    printf("Unable to find out the NUMA nodes of this machine, so sorry.\n");
+    exit(1);
+  }
+  sched_getaffinity(0, sizeof(all_cpus), &all_cpus);
+
+  fprintf(ofile, "********************** Run info ******************************\n");
+  fprintf(ofile, "Blosc version: %s (%s)\n", BLOSC_VERSION_STRING, BLOSC_VERSION_DATE);
+  fprintf(ofile, "Using synthetic data with %d significant bits (out of 32)\n", rshift);
+  fprintf(ofile, "Dataset size: %d bytes\tType size: %d bytes\n", size, elsize);
+  fprintf(ofile, "Compression level: %d\tThreads: %d\tNUMA nodes: %d\n",
+          clevel, nthreads, nnodes);
+  fprintf(ofile, "********************** Bandwidth per node *********************\n");
+  fprintf(ofile, "%4s %14s %14s %14s %14s\n", "", "plain", "",
+          "NUMA-aware", "");
+  fprintf(ofile, "%4s %14s %14s %14s %14s\n", "node", "comp MB/s",
+          "decomp MB/s", "comp MB/s", "decomp MB/s");
+
+  for (node = 0; node < nnodes; node++) {
+    /* Place the buffers in the memory of `node` (first touch) */
+    if (pin_to_node(node) < 0) {
+      continue;
+    }
+    retcode = posix_memalign( (void **)(&src), 32, size);
+    retcode |= posix_memalign( (void **)(&dest), 32, size+BLOSC_MAX_OVERHEAD);
+    retcode |= posix_memalign( (void **)(&dest2), 32, size);
+    if (retcode != 0) {
+      printf("Error allocating memory!\n");
+      exit(1);
+    }
+    init_buffer(src, size, rshift);
+    memset(dest, 0, size+BLOSC_MAX_OVERHEAD);
+    memset(dest2, 0, size);
+    sched_setaffinity(0, sizeof(all_cpus), &all_cpus);
+
+    for (numa = 0; numa < 2; numa++) {
+      /* Pools are pinned when created, so get rid of the cached ones */
+      blosc_set_numa(numa);
+      blosc_free_resources();
+      blosc_set_nthreads(nthreads);
+      blosc_set_compressor(compressor);
+
+      blosc_set_timestamp(&last);
+      for (i = 0; i < numa_niter; i++) {
+        cbytes = blosc_compress(clevel, doshuffle, elsize, size, src,
+                                dest, size+BLOSC_MAX_OVERHEAD);
+      }
+      blosc_set_timestamp(&current);
+      tcomp[numa] = get_usec_chunk(last, current, numa_niter, 1);
+
+      blosc_set_timestamp(&last);
+      for (i = 0; i < numa_niter; i++) {
+        nbytes = blosc_decompress(dest, dest2, size);
+      }
+      blosc_set_timestamp(&current);
+      tdecomp[numa] = get_usec_chunk(last, current, numa_niter, 1);
+
+      if (cbytes <= 0 || nbytes != size || memcmp(src, dest2, size) != 0) {
+        fprintf(ofile, "Error: roundtrip failed (cbytes: %d, nbytes: %d)\n",
+                cbytes, nbytes);
+        exit(1);
+      }
+    }
+    fprintf(ofile, "%4d %14.1f %14.1f %14.1f %14.1f\n", node,
+            (size * 1e6) / (tcomp[0]*MB), (size * 1e6) / (tdecomp[0]*MB),
+            (size * 1e6) / (tcomp[1]*MB), (size * 1e6) / (tdecomp[1]*MB));
+
+    aligned_free(src); aligned_free(dest); aligned_free(dest2);
+  }
+  blosc_set_numa(0);
+  blosc_free_resources();
+
+  totalsize += (double)size * numa_niter * 2 * nnodes;
+}
+#endif  /* __linux__ */
+
+
 /* Compute a sensible value for nchunks */
 int get_nchunks(int size_, int ws) {
   int nchunks;
@@ -373,6 +676,9 @@ int main(int argc, char *argv[]) {
   int hard_suite = 0;
   int extreme_suite = 0;
   int debug_suite = 0;
+  int scaling_suite = 0;
+  int numa_suite = 0;
+  int hugepages_suite = 0;
   int nthreads = 4;                     /* The number of threads */
   int size = 2*MB;                      /* Buffer size */
   int elsize = 8;                       /* Datatype size */
@@ -387,7 +693,8 @@ int main(int argc, char *argv[]) {
   print_compress_info();
 
   strncpy(usage, "Usage: bench [blosclz | lz4 | lz4hc | snappy | zlib] "
-          "[[single | suite | hardsuite | extremesuite | debugsuite] "
+          "[[single | suite | hardsuite | extremesuite | debugsuite | scaling | numa | "
+          "hugepages] "
           "[nthreads [bufsize(bytes) [typesize [sbits ]]]]]", 255);
 
   if (argc < 2) {
@@ -436,6 +743,19 @@ int main(int argc, char *argv[]) {
     elsize = 32;
     rshift = 32;
   }
+  else if (strcmp(bsuite, "scaling") == 0) {
+    scaling_suite = 1;
+    /* Values here are ending points for loops */
+    nthreads = 16;
+  }
+  else if (strcmp(bsuite, "numa") == 0) {
+    numa_suite = 1;
+    size = 64*MB;
+  }
+  else if (strcmp(bsuite, "hugepages") == 0) {
+    hugepages_suite = 1;
+    size = 16*MB;
+  }
   else if (strcmp(bsuite, "debugsuite") == 0) {
     debug_suite = 1;
     workingset = 32*MB;
@@ -468,7 +788,8 @@ int main(int argc, char *argv[]) {
     rshift = atoi(argv[6]);
   }
 
-  if ((argc >= 8) || !(single || suite || hard_suite || extreme_suite)) {
+  if ((argc >= 8) || !(single || suite || hard_suite || extreme_suite ||
+                       scaling_suite || numa_suite || hugepages_suite)) {
     printf("%s\n", usage);
     exit(1);
   }
@@ -525,6 +846,19 @@ int main(int argc, char *argv[]) {
       }
     }
   }
+  else if (scaling_suite) {
+    do_scaling_bench(compressor, nthreads, size, elsize, rshift, output_file);
+  }
+  else if (numa_suite) {
+#if defined(__linux__)
+    do_numa_bench(compressor, nthreads, size, elsize, rshift, output_file);
+#else
+    printf("The numa suite is only supported on Linux, so sorry.\n");
+#endif
+  }
+  else if (hugepages_suite) {
+    do_hugepages_bench(compressor, nthreads, size, elsize, rshift, output_file);
+  }
   else if (debug_suite) {
     for (rshift_ = rshift; rshift_ <= 32; rshift_++) {
       for (elsize_ = elsize; elsize_ <= 32; elsize_++) {
@@ -7,9 +7,14 @@
   See LICENSES/BLOSC.txt for details about copyright and rights to use.
 **********************************************************************/
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+  /* For CPU affinity and sched_getcpu() */
+  #define _GNU_SOURCE
+#endif
 
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <assert.h>
@@ -18,6 +23,7 @@
 #endif /*  USING_CMAKE */
 #include "blosc.h"
 #include "shuffle.h"
+#include "crc32c.h"
 #include "blosclz.h"
 #if defined(HAVE_LZ4)
   #include "lz4.h"
@@ -56,6 +62,24 @@
   #include <pthread.h>
 #endif
 
+#if defined(__linux__)
+  #include <limits.h>
+  #include <linux/futex.h>
+  #include <sys/syscall.h>
+  #include <sched.h>
+  #include <sys/mman.h>
+  #define HAVE_FUTEX
+  #define HAVE_NUMA
+  #define HAVE_HUGEPAGES
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define CPU_RELAX() _mm_pause()
+#else
+  #define CPU_RELAX()
+#endif
+
 /* If C11 is supported, use it's built-in aligned allocation. */
 #if __STDC_VERSION__ >= 201112L
   #include <stdalign.h>
@@ -72,149 +96,542 @@
 /* The maximum number of splits in a block for compression */
 #define MAX_SPLITS 16            /* Cannot be larger than 128 */
 
+/* Bytes of the checksum of every block (a CRC32C) */
+#define CHECKSUM_SIZE 4
+
 /* The size of L1 cache.  32 KB is quite common nowadays. */
 #define L1 (32*KB)
 
-/* Have problems using posix barriers when symbol value is 200112L */
-/* This requires more investigation, but will work for the moment */
-#if defined(_POSIX_BARRIERS) && ( (_POSIX_BARRIERS - 20012L) >= 0 && _POSIX_BARRIERS != 200112L)
-#define _POSIX_BARRIERS_MINE
+/* The maximum number of idle thread pools kept around for reuse */
+#define POOL_CACHE_SIZE 16
+
+/* The size of a cache line (for padding data shared between threads) */
+#define CACHE_LINE_SIZE 64
+
+/* Default number of iterations that threads spin at a barrier before
+   going to sleep */
+#define SPIN_BUDGET 2000
+
+/* Minimum number of spinning iterations the adaptive barrier falls to */
+#define MIN_SPINS 16
+
+/* The maximum number of NUMA nodes supported */
+#define MAX_NUMA_NODES 64
+
+/* The size of a huge page, and the smallest scratch buffer worth
+   putting in huge pages (see blosc_set_hugepages()) */
+#define HUGE_PAGE_SIZE (2*MB)
+#define MIN_HUGE_SCRATCH (256*KB)
+
+/* Room in front of scratch buffers for telling how they were allocated
+   (keeps the alignment of the buffer) */
+#define SCRATCH_HEADER 64
+
+/* Atomic operations (only used for lock-free bookkeeping).
+   ATOMIC_ADD32 returns the value *before* the addition. */
+#if defined(_MSC_VER)
+  #define ATOMIC_CAS_PTR(ptr, oldval, newval) \
+    (InterlockedCompareExchangePointer((PVOID volatile *)(ptr), (newval), (oldval)) == (oldval))
+  #define ATOMIC_ADD32(ptr, val) \
+    InterlockedExchangeAdd((LONG volatile *)(ptr), (val))
+  #define ATOMIC_CAS32(ptr, oldval, newval) \
+    (InterlockedCompareExchange((LONG volatile *)(ptr), (newval), (oldval)) == (oldval))
+  #define ATOMIC_ADD64(ptr, val) \
+    InterlockedExchangeAdd64((LONGLONG volatile *)(ptr), (val))
+#else
+  #define ATOMIC_CAS_PTR(ptr, oldval, newval) \
+    __sync_bool_compare_and_swap((ptr), (oldval), (newval))
+  #define ATOMIC_ADD32(ptr, val) \
+    __sync_fetch_and_add((ptr), (val))
+  #define ATOMIC_CAS32(ptr, oldval, newval) \
+    __sync_bool_compare_and_swap((ptr), (oldval), (newval))
+  #define ATOMIC_ADD64(ptr, val) \
+    __sync_fetch_and_add((ptr), (val))
 #endif
+/* Read a value published by another thread (with a full barrier) */
+#define ATOMIC_READ32(ptr) ATOMIC_ADD32((ptr), 0)
+
+/* Kinds of jobs that a pool of threads can run */
+#define JOB_BLOCKS 0             /* (de-)compress (or copy) the blocks */
+#define JOB_COPY_STAGED 1        /* move staged blocks to their final place */
+#define JOB_SPLITS 2             /* (de-)compress the splits of the blocks */
+#define JOB_COPY_SPLITS 3        /* move staged splits to their final place */
+#define JOB_UNSHUFFLE 4          /* unshuffle the decompressed blocks */
+
 /* Synchronization variables */
 
+/* A reusable barrier.  Threads arriving early spin for a while, and
+   only go to sleep (on a futex when available) if the last thread is
+   late.  The spin is adapted to what happened on previous waits. */
+struct blosc_barrier {
+  int32_t nparticipants;
+  volatile int32_t count;         /* threads arrived in this phase */
+  volatile int32_t generation;    /* bumped when everybody has arrived */
+  volatile int32_t sleepers;      /* threads sleeping on `generation` */
+  volatile int32_t spins;         /* current (adaptive) spin limit */
+#if !defined(HAVE_FUTEX)
+  pthread_mutex_t mutex;
+  pthread_cond_t cv;
+#endif
+};
+
+struct thread_pool;
+struct thread_context;
+
+/* Functions for the memory of a context (see blosc_set_allocator()) */
+struct blosc_allocator {
+  blosc_alloc_fn alloc;           /* NULL for the default allocator */
+  blosc_free_fn free;
+  void* data;
+};
 
 struct blosc_context {
   int32_t compress;               /* 1 if we are doing compression 0 if decompress */
 
   const uint8_t* src;
+  int32_t untrusted;              /* 1 if `src` may be corrupted, so codecs
+                                     have to check their bounds */
   uint8_t* dest;                  /* The current pos in the destination buffer */
   uint8_t* header_flags;          /* Flags for header.  Currently booked:
                                     - 0: shuffled?
-                                    - 1: memcpy'ed? */
-  int32_t sourcesize;             /* Number of bytes in source buffer (or uncompressed bytes in compressed file) */
+                                    - 1: memcpy'ed?
+                                    - 2: checksums? */
+  int64_t sourcesize;             /* Number of bytes in source buffer (or uncompressed bytes in compressed file) */
   int32_t nblocks;                /* Number of total blocks in buffer */
   int32_t leftover;               /* Extra bytes at end of buffer */
   int32_t blocksize;              /* Length of the block in bytes */
   int32_t typesize;               /* Type size */
-  int32_t num_output_bytes;       /* Counter for the number of output bytes */
-  int32_t destsize;               /* Maximum size for destination buffer */
+  int64_t destsize;               /* Maximum size for destination buffer */
+  int32_t header64;               /* 1 for the header with 64-bit sizes and
+                                     block starts (BLOSC_VERSION_FORMAT64) */
   uint8_t* bstarts;               /* Start of the buffer past header info */
+  int32_t checksummed;            /* 1 if compressed blocks get checksums */
+  uint8_t* checksums;             /* Checksums of the blocks (past the block
+                                     starts), or NULL if there are none */
   int32_t compcode;               /* Compressor code to use */
   int clevel;                     /* Compression level (1-9) */
+  int32_t deterministic;          /* 1 if blocks are laid out in block order */
+  blosc_apply_fn apply;           /* if not NULL, decompressed blocks are
+                                     handed to it instead of `dest` */
+  void* apply_data;
+  int64_t range_start;            /* if range_nbytes >= 0, only the bytes */
+  int64_t range_nbytes;           /* from range_start on go to `dest` */
 
   /* Threading */
   int32_t numthreads;
-  int32_t threads_started;
+  int32_t job;                    /* kind of job for the threads (JOB_*) */
+  int32_t nsplits;                /* splits in a (non-leftover) block */
+  int32_t ntasks;                 /* number of tasks in split-level jobs */
+  int32_t numa;                   /* 1 if blocks are claimed by NUMA node */
+  /* Batch jobs run the blocks of several buffers (one context each)
+     together.  `batch` is NULL for jobs on a single buffer. */
+  struct blosc_context* batch;
+  int32_t batch_size;
+  int32_t* batch_blocks;          /* first block of every buffer in the job
+                                     (plus the total number of blocks) */
+  struct thread_pool* pool;       /* pool of threads borrowed for parallel jobs */
+  struct blosc_context* next;     /* next context of the global API */
+  /* Working space for the serial code, kept by long-lived contexts.
+     If NULL, the serial code allocates its own on every call. */
+  struct thread_context* scratch;
+  /* Where the working space of the context (scratch, pools, codec
+     state) is allocated */
+  struct blosc_allocator allocator;
+  volatile int32_t thread_giveup_code;      /* error code when give up */
+
+  /* Counters updated concurrently by threads with atomic operations.
+     Each one sits in its own cache line so that claiming blocks and
+     reserving output space do not bounce the same line around. */
+  uint8_t pad0[CACHE_LINE_SIZE];
+  volatile int32_t thread_nblock;           /* next block to be claimed */
+  uint8_t pad1[CACHE_LINE_SIZE];
+  volatile int64_t num_output_bytes;        /* Counter for the number of output bytes */
+  uint8_t pad2[CACHE_LINE_SIZE];
+  /* Blocks laid out in block order are put in place as soon as all the
+     blocks before them are (see place_ready_blocks()) */
+  volatile int32_t placed_blocks;           /* blocks already in place */
+  volatile int64_t placed_bytes;            /* where the next block goes */
+  uint8_t pad3[CACHE_LINE_SIZE];
+};
+
+/* A pool of worker threads.  Pools are not tied to any context: a
+   context borrows one for running parallel jobs and gives it back
+   afterwards, so that threads are not created on every call.
+
+   Pools with 0 threads have no threads of their own: their jobs are
+   run by the executor registered with blosc_set_executor(), and they
+   only keep the working space for its tasks. */
+struct thread_pool {
+  int32_t nthreads;
   int32_t end_threads;
+  struct blosc_allocator allocator;  /* for everything in the pool */
+  struct blosc_context* context;  /* context for the job being run */
   pthread_t threads[BLOSC_MAX_THREADS];
-  int32_t tids[BLOSC_MAX_THREADS];
-  pthread_mutex_t count_mutex;
-  #ifdef _POSIX_BARRIERS_MINE
-  pthread_barrier_t barr_init;
-  pthread_barrier_t barr_finish;
-  #else
-  int32_t count_threads;
-  pthread_mutex_t count_threads_mutex;
-  pthread_cond_t count_threads_cv;
-  #endif
+  struct thread_context* thread_contexts[BLOSC_MAX_THREADS];
+  volatile int32_t slot_busy[BLOSC_MAX_THREADS];  /* thread contexts in use
+                                                     by executor tasks */
+  /* Where each compressed block was staged, for deterministic output.
+     These are kept between jobs and only grown when needed. */
+  int32_t* block_cbytes;             /* compressed size of every block */
+  int32_t* block_owner;              /* thread that staged every block */
+  int64_t* block_offset;             /* offset in the staging of its owner */
+  int32_t block_slots;               /* number of entries in the above */
+  volatile int32_t placer;           /* 1 while a thread moves staged blocks
+                                        to their place (or grows its
+                                        staging area) */
+  /* Blocks grouped by the NUMA node of their memory, for NUMA-aware
+     jobs.  Threads claim the blocks of their own node first. */
+  int32_t numa;                      /* 1 if threads are pinned to nodes */
+  int32_t* node_blocks;              /* blocks of node 0, then node 1... */
+  void** node_pages;                 /* first page of every block */
+  int* node_status;                  /* node of every block */
+  int32_t node_slots;                /* number of entries in the above */
+  int32_t node_first[MAX_NUMA_NODES + 1];  /* first entry of every node */
+  struct {
+    volatile int32_t nblock;         /* next entry of the node to claim */
+    uint8_t pad[CACHE_LINE_SIZE - sizeof(int32_t)];
+  } node_next[MAX_NUMA_NODES];
+  /* Decompressed (still shuffled) blocks in split-level jobs */
+  uint8_t* split_scratch;
+  int64_t split_scratch_size;
+  struct blosc_barrier barr_init;
+  struct blosc_barrier barr_finish;
+  /* Thread driving asynchronous jobs (started on first use) */
+  int32_t leader_started;
+  pthread_t leader;
+  pthread_mutex_t async_mutex;
+  pthread_cond_t async_cv;
+  struct blosc_async* async_job;     /* job waiting for the leader */
+  int32_t async_running;             /* 1 while the leader runs a job */
   #if !defined(_WIN32)
   pthread_attr_t ct_attr;            /* creation time attrs for threads */
   #endif
-  int32_t thread_giveup_code;               /* error code when give up */
-  int32_t thread_nblock;                    /* block counter */
 };
 
 struct thread_context {
+  struct thread_pool* pool;
   struct blosc_context* parent_context;
   int32_t tid;
+  struct blosc_allocator allocator;  /* for the thread context itself
+                                        and its buffers */
   uint8_t* tmp;
   uint8_t* tmp2;
   int32_t tmpblocksize; /* Used to keep track of how big the temporary buffers are */
+  struct blosclz_htab* htab;  /* kept between calls to blosclz */
+  uint8_t* staging;     /* compressed blocks waiting to be put in place */
+  int64_t staging_size;
+  int64_t staging_used;
+  volatile int32_t staged_blocks;  /* blocks in `staging` not yet in place */
+};
+
+/* An asynchronous compression/decompression job */
+struct blosc_async {
+  struct blosc_context context;
+  const void* src;                /* only used for decompression */
+  void* dest;
+  size_t destsize;
+  blosc_async_callback callback;
+  void* user_data;
+  int result;
+  volatile int32_t done;
+  pthread_mutex_t mutex;
+  pthread_cond_t cv;
+};
+
+/* A reusable context (see blosc_create_ctx()) */
+struct blosc_ctx {
+  struct blosc_context context;   /* keeps its pool and scratch */
+  struct blosc_allocator allocator;  /* for the struct itself */
+  int32_t compcode;
+  int clevel;
+  int doshuffle;
+  size_t typesize;
+  size_t blocksize;
+  int numthreads;
+};
+
+/* A compression stream.  Data is gathered in `pending` until a group
+   of `group_blocks` blocks is full, which is then compressed as one
+   buffer into `out` and its blocks handed to `write`.  The header and
+   the block starts are written at the end, in front of the blocks. */
+struct blosc_stream {
+  struct blosc_ctx* ctx;          /* pool, scratch and parameters */
+  struct blosc_allocator allocator;
+  blosc_stream_write_fn write;
+  void* user_data;
+  uint8_t header[BLOSC_HEADER64_LENGTH];  /* template for the header */
+  int32_t header_len;
+  int32_t blocksize;
+  int32_t group_blocks;           /* blocks compressed at once */
+  int32_t memcpyed;               /* data goes out as is */
+  uint8_t* pending;               /* data of the group being gathered */
+  int32_t pending_size;
+  uint8_t* out;                   /* the compressed group */
+  int64_t out_size;
+  int64_t* bstarts;               /* start of every block in the frame */
+  uint8_t* checksums;             /* checksum of every block, or NULL */
+  int64_t max_blocks;             /* room in the frame for block starts */
+  int64_t nblocks;                /* blocks written so far */
+  int64_t nbytes;                 /* bytes pushed so far */
+  int64_t maxbytes;
+  int64_t data_start;             /* where the first block goes */
+  int64_t cbytes;                 /* bytes of blocks written so far */
+  int error;
+  int finished;
+};
+
+/* A decoder that walks the blocks of a compressed buffer.  Blocks are
+   decompressed `window_blocks` at a time into `window`. */
+struct blosc_decoder {
+  struct blosc_context context;   /* keeps its pool and scratch */
+  struct blosc_allocator allocator;  /* for the struct itself */
+  const uint8_t* src;
+  int numthreads;
+  int32_t header_len;
+  int32_t blocksize;
+  int32_t nblocks;
+  int32_t leftover;
+  int64_t nbytes;
+  int32_t window_blocks;
+  uint8_t* window;
+  int32_t window_first;           /* first block in the window */
+  int32_t window_count;           /* blocks in the window */
+  int32_t next_block;             /* next block to hand out */
+};
+
+/* A reader for the compressed buffers (chunks) of a region of memory,
+   usually a mapped file */
+struct blosc_reader {
+  struct blosc_context context;   /* keeps its pool and scratch */
+  struct blosc_allocator allocator;  /* for the struct and `offsets` */
+  const uint8_t* region;
+  size_t size;
+  int64_t* offsets;               /* where every chunk starts in `region` */
+  int64_t nchunks;
+  int numthreads;
+};
+
+/* Serialized super-chunks start with this (plus the format version) */
+#define SCHUNK_MAGIC "blschunk"
+#define SCHUNK_VERSION_FORMAT 1
+#define SCHUNK_HEADER_LENGTH 64
+#define SCHUNK_MIN_CAPACITY (64 * 1024)
+
+/* An append-only sequence of compressed chunks.  The chunks lie one
+   after the other in `data`, and `offsets` tells where each starts. */
+struct blosc_schunk {
+  struct blosc_ctx* ctx;          /* shared compression parameters */
+  struct blosc_allocator allocator;
+  uint8_t* data;
+  int64_t data_size;              /* bytes of chunks in `data` */
+  int64_t data_capacity;
+  int64_t* offsets;
+  int64_t offsets_capacity;
+  int64_t nchunks;
+  int64_t nbytes;                 /* uncompressed bytes of all chunks */
 };
 
-/* Global context for non-contextual API */
-static struct blosc_context* g_global_context;
-static pthread_mutex_t global_comp_mutex;
+/* Contexts for the non-contextual API, one per calling thread (created
+   on first use).  All of them share a single pool (g_global_pool). */
+static pthread_key_t g_context_key;
+static pthread_mutex_t g_contexts_mutex;
+static struct blosc_context* g_contexts = NULL;  /* all of them */
 static int32_t g_compressor = BLOSC_BLOSCLZ;  /* the compressor to use by default */
 static int32_t g_threads = 1;
 static int32_t g_force_blocksize = 0;
+static int32_t g_deterministic = 1;
+static int32_t g_checksums = 0;
+static volatile int32_t g_spin_budget = SPIN_BUDGET;
+static blosc_executor g_executor = NULL;
+static int32_t g_numa = 0;
+static int32_t g_hugepages = 0;
+static int32_t g_numa_nodes = 0;  /* nodes with CPUs (0 if unknown) */
+#if defined(HAVE_NUMA)
+static cpu_set_t g_node_cpus[MAX_NUMA_NODES];  /* CPUs of every node */
+static int32_t g_node_index[MAX_NUMA_NODES];   /* node number -> index
+                                                  in g_node_cpus (or -1) */
+#endif
+static void* g_executor_data = NULL;
+static struct blosc_allocator g_allocator = {NULL, NULL, NULL};
 static int32_t g_initlib = 0;
 
+/* Idle thread pools, ready to be borrowed by any context */
+static struct thread_pool* volatile g_pool_cache[POOL_CACHE_SIZE];
+
+/* The pool of the non-contextual API.  It is lent to one call at a
+   time (the one that sets g_global_pool_busy); calls that find it busy
+   run serially, so that no more threads are created however many
+   threads call the API. */
+static struct thread_pool* g_global_pool = NULL;
+static volatile int32_t g_global_pool_busy = 0;
+
 
 
 /* Wrapped function to adjust the number of threads used by blosc */
 int blosc_set_nthreads_(struct blosc_context*);
 
-/* Releases the global threadpool */
+/* Gives the thread pool of a context back to the pool cache */
 int blosc_release_threadpool(struct blosc_context* context);
 
+/* Does the share of the current job of a pool that falls to a thread */
+static void run_job(struct thread_context* context);
+
+/* Creates the working space of a thread of a pool */
+static struct thread_context* new_thread_context(struct thread_pool* pool, int32_t tid,
+                                                 const struct blosc_allocator* allocator);
+
+/* Releases the working space of a thread */
+static void free_thread_context(struct thread_context* context);
+
+/* Grows the temporaries of a working space */
+static int grow_temporaries(struct thread_context* thread, int32_t ebsize);
+
+/* Gets the blosclz hash table of a working space */
+static struct blosclz_htab* get_htab(struct thread_context* thread,
+                                     const struct blosc_context* context);
+
+/* Stops the threads of a pool and releases it */
+static int destroy_threads(struct thread_pool* pool);
+
+/* Gets a pool of threads, reusing an idle one if possible */
+static struct thread_pool* acquire_thread_pool(int32_t nthreads,
+                                               const struct blosc_allocator* allocator);
+
+/* Caches an idle pool of threads, or stops it if the cache is full */
+static void recycle_thread_pool(struct thread_pool* pool);
+
+/* Whether two allocators allocate memory in the same way */
+static int same_allocator(const struct blosc_allocator* a,
+                          const struct blosc_allocator* b);
+
+/* Lends the pool of the non-contextual API to a context */
+static int32_t borrow_global_pool(struct blosc_context* context);
+
+/* Gives the pool of a context of the non-contextual API back */
+static void return_global_pool(struct blosc_context* context);
+
 /* Macros for synchronization */
 
 /* Wait until all threads are initialized */
-#ifdef _POSIX_BARRIERS_MINE
-#define WAIT_INIT(RET_VAL, CONTEXT_PTR)  \
-  rc = pthread_barrier_wait(&CONTEXT_PTR->barr_init); \
-  if (rc != 0 && rc != PTHREAD_BARRIER_SERIAL_THREAD) { \
-    printf("Could not wait on barrier (init): %d\n", rc); \
-    return((RET_VAL));				  \
-  }
+#define WAIT_INIT(POOL_PTR)  barrier_wait(&(POOL_PTR)->barr_init)
+
+/* Wait for all threads to finish */
+#define WAIT_FINISH(POOL_PTR)  barrier_wait(&(POOL_PTR)->barr_finish)
+
+
+/* Prepare `barrier` for `nparticipants` threads */
+static void barrier_init(struct blosc_barrier* barrier, int32_t nparticipants)
+{
+  barrier->nparticipants = nparticipants;
+  barrier->count = 0;
+  barrier->generation = 0;
+  barrier->sleepers = 0;
+  barrier->spins = g_spin_budget;
+#if !defined(HAVE_FUTEX)
+  pthread_mutex_init(&barrier->mutex, NULL);
+  pthread_cond_init(&barrier->cv, NULL);
+#endif
+}
+
+static void barrier_destroy(struct blosc_barrier* barrier)
+{
+#if !defined(HAVE_FUTEX)
+  pthread_mutex_destroy(&barrier->mutex);
+  pthread_cond_destroy(&barrier->cv);
 #else
-#define WAIT_INIT(RET_VAL, CONTEXT_PTR)   \
-  pthread_mutex_lock(&CONTEXT_PTR->count_threads_mutex); \
-  if (CONTEXT_PTR->count_threads < CONTEXT_PTR->numthreads) { \
-    CONTEXT_PTR->count_threads++;  \
-    pthread_cond_wait(&CONTEXT_PTR->count_threads_cv, &CONTEXT_PTR->count_threads_mutex); \
-  } \
-  else { \
-    pthread_cond_broadcast(&CONTEXT_PTR->count_threads_cv); \
-  } \
-  pthread_mutex_unlock(&CONTEXT_PTR->count_threads_mutex);
+  (void)barrier;
 #endif
+}
 
-/* Wait for all threads to finish */
-#ifdef _POSIX_BARRIERS_MINE
-#define WAIT_FINISH(RET_VAL, CONTEXT_PTR)   \
-  rc = pthread_barrier_wait(&CONTEXT_PTR->barr_finish); \
-  if (rc != 0 && rc != PTHREAD_BARRIER_SERIAL_THREAD) { \
-    printf("Could not wait on barrier (finish)\n"); \
-    return((RET_VAL));				    \
+/* Wait until all the participants of `barrier` have arrived */
+static void barrier_wait(struct blosc_barrier* barrier)
+{
+  int32_t generation = barrier->generation;
+  int32_t budget = g_spin_budget;
+  int32_t spins = barrier->spins;
+  int32_t i;
+
+  if (ATOMIC_ADD32(&barrier->count, 1) == barrier->nparticipants - 1) {
+    /* Last one in: open the barrier for the next phase */
+    barrier->count = 0;
+    ATOMIC_ADD32(&barrier->generation, 1);
+#if defined(HAVE_FUTEX)
+    if (barrier->sleepers > 0) {
+      syscall(SYS_futex, &barrier->generation, FUTEX_WAKE_PRIVATE, INT_MAX,
+              NULL, NULL, 0);
+    }
+#else
+    pthread_mutex_lock(&barrier->mutex);
+    pthread_cond_broadcast(&barrier->cv);
+    pthread_mutex_unlock(&barrier->mutex);
+#endif
+    return;
+  }
+
+  /* Spin for a while, as the rest of threads are probably close */
+  if (spins > budget) {
+    spins = budget;
+  }
+  for (i = 0; i < spins; i++) {
+    if (barrier->generation != generation) {
+      /* Spinning paid off; allow a bit more of it next time */
+      if (spins < budget) {
+        barrier->spins = (2 * spins < budget) ? 2 * spins : budget;
+      }
+      return;
+    }
+    CPU_RELAX();
   }
+
+  /* Spinning did not pay off; spin less next time and go to sleep */
+  if (budget > 0) {
+    barrier->spins = (spins / 2 > MIN_SPINS) ? spins / 2 : MIN_SPINS;
+  }
+#if defined(HAVE_FUTEX)
+  ATOMIC_ADD32(&barrier->sleepers, 1);
+  while (barrier->generation == generation) {
+    syscall(SYS_futex, &barrier->generation, FUTEX_WAIT_PRIVATE, generation,
+            NULL, NULL, 0);
+  }
+  ATOMIC_ADD32(&barrier->sleepers, -1);
 #else
-#define WAIT_FINISH(RET_VAL, CONTEXT_PTR)			    \
-  pthread_mutex_lock(&CONTEXT_PTR->count_threads_mutex); \
-  if (CONTEXT_PTR->count_threads > 0) { \
-    CONTEXT_PTR->count_threads--; \
-    pthread_cond_wait(&CONTEXT_PTR->count_threads_cv, &CONTEXT_PTR->count_threads_mutex); \
-  } \
-  else { \
-    pthread_cond_broadcast(&CONTEXT_PTR->count_threads_cv); \
-  } \
-  pthread_mutex_unlock(&CONTEXT_PTR->count_threads_mutex);
+  pthread_mutex_lock(&barrier->mutex);
+  while (barrier->generation == generation) {
+    pthread_cond_wait(&barrier->cv, &barrier->mutex);
+  }
+  pthread_mutex_unlock(&barrier->mutex);
 #endif
+}
 
 
-/* A function for aligned malloc that is portable */
-static uint8_t *my_malloc(size_t size)
+/* A function for aligned malloc that is portable.  Memory comes from
+   `allocator` when it has functions of its own. */
+static uint8_t *my_malloc(const struct blosc_allocator* allocator, size_t size)
 {
   void *block = NULL;
   int res = 0;
 
-/* Do an alignment to 32 bytes because AVX2 is supported */
+  if (allocator->alloc != NULL) {
+    block = allocator->alloc(size, 32, allocator->data);
+  }
+  else {
+    /* Do an alignment to 32 bytes because AVX2 is supported */
 #if __STDC_VERSION__ >= 201112L
-  /* C11 aligned allocation. 'size' must be a multiple of the alignment. */
-  block = aligned_alloc(32, size);
+    /* C11 aligned allocation. 'size' must be a multiple of the alignment. */
+    block = aligned_alloc(32, size);
 #elif defined(_WIN32)
-  /* A (void *) cast needed for avoiding a warning with MINGW :-/ */
-  block = (void *)_aligned_malloc(size, 32);
+    /* A (void *) cast needed for avoiding a warning with MINGW :-/ */
+    block = (void *)_aligned_malloc(size, 32);
 #elif defined __APPLE__
-  /* Mac OS X guarantees 16-byte alignment in small allocs */
-  block = malloc(size);
+    /* Mac OS X guarantees 16-byte alignment in small allocs */
+    block = malloc(size);
 #elif _POSIX_C_SOURCE >= 200112L || _XOPEN_SOURCE >= 600
-  /* Platform does have an implementation of posix_memalign */
-  res = posix_memalign(&block, 32, size);
+    /* Platform does have an implementation of posix_memalign */
+    res = posix_memalign(&block, 32, size);
 #else
-  block = malloc(size);
+    block = malloc(size);
 #endif  /* _WIN32 */
+  }
 
   if (block == NULL || res != 0) {
     printf("Error allocating memory!");
@@ -225,9 +642,15 @@ static uint8_t *my_malloc(size_t size)
 }
 
 
-/* Release memory booked by my_malloc */
-static void my_free(void *block)
+/* Release memory booked by my_malloc with the same `allocator` */
+static void my_free(const struct blosc_allocator* allocator, void *block)
 {
+  if (allocator->free != NULL) {
+    if (block != NULL) {
+      allocator->free(block, allocator->data);
+    }
+    return;
+  }
 #if defined(_WIN32)
     _aligned_free(block);
 #else
@@ -236,6 +659,92 @@ static void my_free(void *block)
 }
 
 
+#if defined(HAVE_HUGEPAGES)
+/* Map `length` bytes (a multiple of HUGE_PAGE_SIZE) backed by huge
+   pages if possible.  Returns NULL on failure. */
+static uint8_t* map_huge_pages(size_t length)
+{
+  uint8_t* map;
+  size_t head;
+
+#if defined(MAP_HUGETLB)
+  /* Pages reserved by the administrator (hugetlbfs), if any */
+  map = (uint8_t*)mmap(NULL, length, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (map != MAP_FAILED) {
+    return map;
+  }
+#endif
+  /* Otherwise, transparent huge pages, which need a mapping aligned to
+     the huge page size: map a bit more and trim the ends */
+  map = (uint8_t*)mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+  head = (HUGE_PAGE_SIZE - (uintptr_t)map % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+  if (head > 0) {
+    munmap(map, head);
+  }
+  munmap(map + head + length, HUGE_PAGE_SIZE - head);
+  map += head;
+#if defined(MADV_HUGEPAGE)
+  madvise(map, length, MADV_HUGEPAGE);
+#endif
+  return map;
+}
+#endif  /* HAVE_HUGEPAGES */
+
+
+/* Allocate a scratch buffer (temporaries, staging areas), which comes
+   from huge pages when enabled and large enough.  Buffers from
+   allocators of the application are left to them. */
+static uint8_t *scratch_malloc(const struct blosc_allocator* allocator, size_t size)
+{
+  uint8_t* block;
+
+  if (allocator->alloc != NULL) {
+    return my_malloc(allocator, size);
+  }
+#if defined(HAVE_HUGEPAGES)
+  if (g_hugepages && size >= MIN_HUGE_SCRATCH) {
+    size_t length = (size + SCRATCH_HEADER + HUGE_PAGE_SIZE - 1) &
+                    ~((size_t)HUGE_PAGE_SIZE - 1);
+    block = map_huge_pages(length);
+    if (block != NULL) {
+      *(size_t*)block = length;
+      return block + SCRATCH_HEADER;
+    }
+    /* Fall back to regular pages */
+  }
+#endif
+  block = my_malloc(allocator, size + SCRATCH_HEADER);
+  if (block == NULL) {
+    return NULL;
+  }
+  *(size_t*)block = 0;          /* not a mapping */
+  return block + SCRATCH_HEADER;
+}
+
+
+/* Release a buffer booked by scratch_malloc with the same `allocator` */
+static void scratch_free(const struct blosc_allocator* allocator, uint8_t *block)
+{
+  if (allocator->alloc != NULL || block == NULL) {
+    my_free(allocator, block);
+    return;
+  }
+  block -= SCRATCH_HEADER;
+#if defined(HAVE_HUGEPAGES)
+  if (*(size_t*)block > 0) {
+    munmap(block, *(size_t*)block);
+    return;
+  }
+#endif
+  my_free(allocator, block);
+}
+
+
 /* Copy 4 bytes from `*pa` to int32_t, changing endianness if necessary. */
 static int32_t sw32_(const uint8_t *pa)
 {
@@ -286,6 +795,108 @@ static void _sw32(uint8_t* dest, int32_t a)
 }
 
 
+/* Copy 8 bytes from `*pa` to int64_t, changing endianness if necessary. */
+static int64_t sw64_(const uint8_t *pa)
+{
+  int64_t idest;
+  uint8_t *dest = (uint8_t *)&idest;
+  int i = 1;                    /* for big/little endian detection */
+  char *p = (char *)&i;
+  int j;
+
+  for (j = 0; j < 8; j++) {
+    dest[j] = (p[0] != 1) ? pa[7 - j] : pa[j];
+  }
+  return idest;
+}
+
+
+/* Copy 8 bytes from `*dest` to `*dest`, changing endianness if necessary. */
+static void _sw64(uint8_t* dest, int64_t a)
+{
+  uint8_t *pa = (uint8_t *)&a;
+  int i = 1;                    /* for big/little endian detection */
+  char *p = (char *)&i;
+  int j;
+
+  for (j = 0; j < 8; j++) {
+    dest[j] = (p[0] != 1) ? pa[7 - j] : pa[j];
+  }
+}
+
+
+/* Length of the header of the buffer of `context` */
+static int32_t header_length(const struct blosc_context* context)
+{
+  return context->header64 ? BLOSC_HEADER64_LENGTH : BLOSC_MIN_HEADER_LENGTH;
+}
+
+/* Size of every entry of the block starts of `context` */
+static int32_t bstart_size(const struct blosc_context* context)
+{
+  return context->header64 ? (int32_t)sizeof(int64_t) : (int32_t)sizeof(int32_t);
+}
+
+/* Get where block `nblock` starts in the compressed buffer */
+static int64_t get_bstart(const struct blosc_context* context, int32_t nblock)
+{
+  if (context->header64) {
+    return sw64_(context->bstarts + (int64_t)nblock * 8);
+  }
+  return sw32_(context->bstarts + (int64_t)nblock * 4);
+}
+
+/* Set where block `nblock` starts in the compressed buffer */
+static void set_bstart(const struct blosc_context* context, int32_t nblock,
+                       int64_t offset)
+{
+  if (context->header64) {
+    _sw64(context->bstarts + (int64_t)nblock * 8, offset);
+  }
+  else {
+    _sw32(context->bstarts + (int64_t)nblock * 4, (int32_t)offset);
+  }
+}
+
+/* Length of the block starts and checksums of `context` */
+static int64_t index_length(const struct blosc_context* context)
+{
+  int64_t entry = bstart_size(context);
+
+  if (context->checksums != NULL) {
+    entry += CHECKSUM_SIZE;
+  }
+  return entry * context->nblocks;
+}
+
+/* Where the checksum of block `nblock` goes, or NULL if the blocks of
+   `context` have none */
+static uint8_t* block_checksum(const struct blosc_context* context,
+                               int32_t nblock)
+{
+  if (context->checksums == NULL) {
+    return NULL;
+  }
+  return context->checksums + (int64_t)nblock * CHECKSUM_SIZE;
+}
+
+/* Turn the checksums of the compressed blocks of `context` on or off,
+   and make room for them */
+static void set_checksums(struct blosc_context* context, int enabled)
+{
+  if (enabled) {
+    *(context->header_flags) |= BLOSC_DOCHECKSUM;
+    context->checksums = context->bstarts +
+      (int64_t)context->nblocks * bstart_size(context);
+  }
+  else {
+    *(context->header_flags) &= ~BLOSC_DOCHECKSUM;
+    context->checksums = NULL;
+  }
+  context->num_output_bytes = header_length(context) + index_length(context);
+}
+
+
 /*
  * Conversion routines between compressor and compression libraries
  */
@@ -426,6 +1037,19 @@ static int lz4_wrap_decompress(const char* input, size_t compressed_length,
   return (int)maxout;
 }
 
+/* Like lz4_wrap_decompress(), but never reading past `compressed_length`
+   (for input that may be corrupted) */
+static int lz4_wrap_decompress_safe(const char* input, size_t compressed_length,
+                                    char* output, size_t maxout)
+{
+  int nbytes;
+  nbytes = LZ4_decompress_safe(input, output, (int)compressed_length, (int)maxout);
+  if (nbytes != (int)maxout) {
+    return 0;
+  }
+  return (int)maxout;
+}
+
 #endif /* HAVE_LZ4 */
 
 #if defined(HAVE_SNAPPY)
@@ -457,30 +1081,67 @@ static int snappy_wrap_decompress(const char* input, size_t compressed_length,
 #if defined(HAVE_ZLIB)
 /* zlib is not very respectful with sharing name space with others.
  Fortunately, its names do not collide with those already in blosc. */
+/* zlib allocates its state through the allocator of the context */
+static voidpf zlib_alloc(voidpf opaque, uInt items, uInt size)
+{
+  return my_malloc((const struct blosc_allocator*)opaque, (size_t)items * size);
+}
+
+static void zlib_free(voidpf opaque, voidpf address)
+{
+  my_free((const struct blosc_allocator*)opaque, address);
+}
+
+/* Same as compress2(), but with the allocator of the context */
 static int zlib_wrap_compress(const char* input, size_t input_length,
-                              char* output, size_t maxout, int clevel)
+                              char* output, size_t maxout, int clevel,
+                              const struct blosc_allocator* allocator)
 {
+  z_stream stream;
   int status;
-  uLongf cl = maxout;
-  status = compress2(
-	     (Bytef*)output, &cl, (Bytef*)input, (uLong)input_length, clevel);
-  if (status != Z_OK){
+
+  stream.next_in = (Bytef*)input;
+  stream.avail_in = (uInt)input_length;
+  stream.next_out = (Bytef*)output;
+  stream.avail_out = (uInt)maxout;
+  stream.zalloc = zlib_alloc;
+  stream.zfree = zlib_free;
+  stream.opaque = (voidpf)allocator;
+  if (deflateInit(&stream, clevel) != Z_OK) {
     return 0;
   }
-  return (int)cl;
+  status = deflate(&stream, Z_FINISH);
+  deflateEnd(&stream);
+  if (status != Z_STREAM_END) {
+    return 0;
+  }
+  return (int)stream.total_out;
 }
 
+/* Same as uncompress(), but with the allocator of the context */
 static int zlib_wrap_decompress(const char* input, size_t compressed_length,
-                                char* output, size_t maxout)
+                                char* output, size_t maxout,
+                                const struct blosc_allocator* allocator)
 {
+  z_stream stream;
   int status;
-  uLongf ul = maxout;
-  status = uncompress(
-             (Bytef*)output, &ul, (Bytef*)input, (uLong)compressed_length);
-  if (status != Z_OK){
+
+  stream.next_in = (Bytef*)input;
+  stream.avail_in = (uInt)compressed_length;
+  stream.next_out = (Bytef*)output;
+  stream.avail_out = (uInt)maxout;
+  stream.zalloc = zlib_alloc;
+  stream.zfree = zlib_free;
+  stream.opaque = (voidpf)allocator;
+  if (inflateInit(&stream) != Z_OK) {
     return 0;
   }
-  return (int)ul;
+  status = inflate(&stream, Z_FINISH);
+  inflateEnd(&stream);
+  if (status != Z_STREAM_END) {
+    return 0;
+  }
+  return (int)stream.total_out;
 }
 
 #endif /*  HAVE_ZLIB */
@@ -511,110 +1172,208 @@ static int get_accel(const struct blosc_context* context) {
   return 1;
 }
 
-/* Shuffle & compress a single block */
-static int blosc_c(const struct blosc_context* context, int32_t blocksize,
-                   int32_t leftoverblock, int32_t ntbytes, int32_t maxbytes,
-                   const uint8_t *src, uint8_t *dest, uint8_t *tmp)
+/* Maximum size of a compressed split of `neblock` bytes */
+static int32_t split_maxout(const struct blosc_context* context, int32_t neblock)
 {
-  int32_t j, neblock, nsplits;
-  int32_t cbytes;                   /* number of compressed bytes in split */
-  int32_t ctbytes = 0;              /* number of compressed bytes in block */
-  int32_t maxout;
-  int32_t typesize = context->typesize;
-  const uint8_t *_tmp;
+  #if defined(HAVE_SNAPPY)
+  if (context->compcode == BLOSC_SNAPPY) {
+    /* TODO perhaps refactor this to keep the value stashed somewhere */
+    return (int32_t)snappy_max_compressed_length(neblock);
+  }
+  #endif /*  HAVE_SNAPPY */
+  return neblock;
+}
+
+/* Compress the `neblock` bytes of a split in `src` into `dest`, which
+   has room for `maxout` bytes.  `htab` is the blosclz hash table of the
+   calling thread (NULL if it could not be allocated).  Returns the
+   compressed size (0 if the compressor gave up) or a negative value on
+   errors. */
+static int compress_split(const struct blosc_context* context,
+                          const uint8_t* src, int32_t neblock,
+                          uint8_t* dest, int32_t maxout, int accel,
+                          struct blosclz_htab* htab)
+{
+  int cbytes;
   char *compname;
-  int accel;
 
-  if ((*(context->header_flags) & BLOSC_DOSHUFFLE) && (typesize > 1)) {
-    /* Shuffle this block (this makes sense only if typesize > 1) */
-    shuffle(typesize, blocksize, src, tmp);
-    _tmp = tmp;
+  if (context->compcode == BLOSC_BLOSCLZ) {
+    if (htab == NULL) {
+      return -1;    /* out of memory */
+    }
+    cbytes = blosclz_compress_ht(context->clevel, src, neblock,
+                                 dest, maxout, accel, htab);
+  }
+  #if defined(HAVE_LZ4)
+  else if (context->compcode == BLOSC_LZ4) {
+    cbytes = lz4_wrap_compress((char *)src, (size_t)neblock,
+                               (char *)dest, (size_t)maxout, accel);
   }
+  else if (context->compcode == BLOSC_LZ4HC) {
+    cbytes = lz4hc_wrap_compress((char *)src, (size_t)neblock,
+                                 (char *)dest, (size_t)maxout, context->clevel);
+  }
+  #endif /*  HAVE_LZ4 */
+  #if defined(HAVE_SNAPPY)
+  else if (context->compcode == BLOSC_SNAPPY) {
+    cbytes = snappy_wrap_compress((char *)src, (size_t)neblock,
+                                  (char *)dest, (size_t)maxout);
+  }
+  #endif /*  HAVE_SNAPPY */
+  #if defined(HAVE_ZLIB)
+  else if (context->compcode == BLOSC_ZLIB) {
+    cbytes = zlib_wrap_compress((char *)src, (size_t)neblock,
+                                (char *)dest, (size_t)maxout, context->clevel,
+                                &context->allocator);
+  }
+  #endif /*  HAVE_ZLIB */
+
   else {
-    _tmp = src;
+    blosc_compcode_to_compname(context->compcode, &compname);
+    fprintf(stderr, "Blosc has not been compiled with '%s' ", compname);
+    fprintf(stderr, "compression support.  Please use one having it.");
+    return -5;    /* signals no compression support */
   }
 
-  /* Calculate acceleration for different compressors */
-  accel = get_accel(context);
+  if (cbytes > maxout) {
+    /* Buffer overrun caused by compression (should never happen) */
+    return -1;
+  }
+  else if (cbytes < 0) {
+    /* cbytes should never be negative */
+    return -2;
+  }
+  return cbytes;
+}
 
-  /* Compress for each shuffled slice split for this block. */
-  /* If typesize is too large, neblock is too small or we are in a
-     leftover block, do not split at all. */
-  if ((typesize <= MAX_SPLITS) && (blocksize/typesize) >= MIN_BUFFERSIZE &&
-      (!leftoverblock)) {
-    nsplits = typesize;
+/* Decompress the `cbytes` bytes of a split in `src` into the `neblock`
+   bytes of `dest`, allocating codec state (if any) from `allocator`.
+   If `untrusted`, the codec is kept from reading past the split.
+   Returns the decompressed size or a negative value on errors. */
+static int decompress_split(int32_t compcode, const uint8_t* src, int32_t cbytes,
+                            uint8_t* dest, int32_t neblock, int untrusted,
+                            const struct blosc_allocator* allocator)
+{
+  int32_t nbytes;
+  char *compname;
+
+  if (cbytes == neblock) {
+    memcpy(dest, src, neblock);
+    nbytes = neblock;
   }
   else {
-    nsplits = 1;
-  }
-  neblock = blocksize / nsplits;
-  for (j = 0; j < nsplits; j++) {
-    dest += sizeof(int32_t);
-    ntbytes += (int32_t)sizeof(int32_t);
-    ctbytes += (int32_t)sizeof(int32_t);
-    maxout = neblock;
-    #if defined(HAVE_SNAPPY)
-    if (context->compcode == BLOSC_SNAPPY) {
-      /* TODO perhaps refactor this to keep the value stashed somewhere */
-      maxout = snappy_max_compressed_length(neblock);
-    }
-    #endif /*  HAVE_SNAPPY */
-    if (ntbytes+maxout > maxbytes) {
-      maxout = maxbytes - ntbytes;   /* avoid buffer overrun */
-      if (maxout <= 0) {
-        return 0;                  /* non-compressible block */
-      }
-    }
-    if (context->compcode == BLOSC_BLOSCLZ) {
-      cbytes = blosclz_compress(context->clevel, _tmp+j*neblock, neblock,
-                                dest, maxout, accel);
+    if (compcode == BLOSC_BLOSCLZ_FORMAT) {
+      nbytes = blosclz_decompress(src, cbytes, dest, neblock);
     }
     #if defined(HAVE_LZ4)
-    else if (context->compcode == BLOSC_LZ4) {
-      cbytes = lz4_wrap_compress((char *)_tmp+j*neblock, (size_t)neblock,
-                                 (char *)dest, (size_t)maxout, accel);
+    else if (compcode == BLOSC_LZ4_FORMAT && untrusted) {
+      nbytes = lz4_wrap_decompress_safe((char *)src, (size_t)cbytes,
+                                        (char*)dest, (size_t)neblock);
     }
-    else if (context->compcode == BLOSC_LZ4HC) {
-      cbytes = lz4hc_wrap_compress((char *)_tmp+j*neblock, (size_t)neblock,
-                                   (char *)dest, (size_t)maxout, context->clevel);
+    else if (compcode == BLOSC_LZ4_FORMAT) {
+      nbytes = lz4_wrap_decompress((char *)src, (size_t)cbytes,
+                                   (char*)dest, (size_t)neblock);
     }
     #endif /*  HAVE_LZ4 */
     #if defined(HAVE_SNAPPY)
-    else if (context->compcode == BLOSC_SNAPPY) {
-      cbytes = snappy_wrap_compress((char *)_tmp+j*neblock, (size_t)neblock,
-                                    (char *)dest, (size_t)maxout);
+    else if (compcode == BLOSC_SNAPPY_FORMAT) {
+      nbytes = snappy_wrap_decompress((char *)src, (size_t)cbytes,
+                                      (char*)dest, (size_t)neblock);
     }
     #endif /*  HAVE_SNAPPY */
     #if defined(HAVE_ZLIB)
-    else if (context->compcode == BLOSC_ZLIB) {
-      cbytes = zlib_wrap_compress((char *)_tmp+j*neblock, (size_t)neblock,
-                                  (char *)dest, (size_t)maxout, context->clevel);
+    else if (compcode == BLOSC_ZLIB_FORMAT) {
+      nbytes = zlib_wrap_decompress((char *)src, (size_t)cbytes,
+                                    (char*)dest, (size_t)neblock, allocator);
     }
     #endif /*  HAVE_ZLIB */
-
     else {
-      blosc_compcode_to_compname(context->compcode, &compname);
-      fprintf(stderr, "Blosc has not been compiled with '%s' ", compname);
-      fprintf(stderr, "compression support.  Please use one having it.");
-      return -5;    /* signals no compression support */
+      blosc_compcode_to_compname(compcode, &compname);
+      fprintf(stderr,
+              "Blosc has not been compiled with decompression "
+              "support for '%s' format. ", compname);
+      fprintf(stderr, "Please recompile for adding this support.\n");
+      return -5;    /* signals no decompression support */
     }
 
-    if (cbytes > maxout) {
-      /* Buffer overrun caused by compression (should never happen) */
-      return -1;
-    }
-    else if (cbytes < 0) {
-      /* cbytes should never be negative */
-      return -2;
+    /* Check that decompressed bytes number is correct */
+    if (nbytes != neblock) {
+        return -2;
     }
-    else if (cbytes == 0 || cbytes == neblock) {
-      /* The compressor has been unable to compress data at all. */
-      /* Before doing the copy, check that we are not running into a
-         buffer overflow. */
-      if ((ntbytes+neblock) > maxbytes) {
-        return 0;    /* Non-compressible data */
-      }
-      memcpy(dest, _tmp+j*neblock, neblock);
+  }
+
+  return nbytes;
+}
+
+/* Number of splits in a block of `context` */
+static int32_t block_nsplits(const struct blosc_context* context,
+                             int32_t blocksize, int32_t leftoverblock)
+{
+  int32_t typesize = context->typesize;
+
+  /* If typesize is too large, neblock is too small or we are in a
+     leftover block, do not split at all. */
+  if ((typesize <= MAX_SPLITS) && (blocksize/typesize) >= MIN_BUFFERSIZE &&
+      (!leftoverblock)) {
+    return typesize;
+  }
+  return 1;
+}
+
+/* Shuffle & compress a single block.  If `checksum` is not NULL, the
+   checksum of the compressed block is put there. */
+static int blosc_c(const struct blosc_context* context, int32_t blocksize,
+                   int32_t leftoverblock, int64_t ntbytes, int64_t maxbytes,
+                   const uint8_t *src, uint8_t *dest, uint8_t *tmp,
+                   struct blosclz_htab* htab, uint8_t *checksum)
+{
+  uint8_t *block = dest;
+  int32_t j, neblock, nsplits;
+  int32_t cbytes;                   /* number of compressed bytes in split */
+  int32_t ctbytes = 0;              /* number of compressed bytes in block */
+  int32_t maxout;
+  int32_t typesize = context->typesize;
+  const uint8_t *_tmp;
+  int accel;
+
+  if ((*(context->header_flags) & BLOSC_DOSHUFFLE) && (typesize > 1)) {
+    /* Shuffle this block (this makes sense only if typesize > 1) */
+    shuffle(typesize, blocksize, src, tmp);
+    _tmp = tmp;
+  }
+  else {
+    _tmp = src;
+  }
+
+  /* Calculate acceleration for different compressors */
+  accel = get_accel(context);
+
+  /* Compress for each shuffled slice split for this block. */
+  nsplits = block_nsplits(context, blocksize, leftoverblock);
+  neblock = blocksize / nsplits;
+  for (j = 0; j < nsplits; j++) {
+    dest += sizeof(int32_t);
+    ntbytes += (int32_t)sizeof(int32_t);
+    ctbytes += (int32_t)sizeof(int32_t);
+    maxout = split_maxout(context, neblock);
+    if (ntbytes+maxout > maxbytes) {
+      maxout = (int32_t)(maxbytes - ntbytes);   /* avoid buffer overrun */
+      if (maxout <= 0) {
+        return 0;                  /* non-compressible block */
+      }
+    }
+    cbytes = compress_split(context, _tmp+j*neblock, neblock, dest, maxout, accel, htab);
+    if (cbytes < 0) {
+      return cbytes;
+    }
+    else if (cbytes == 0 || cbytes == neblock) {
+      /* The compressor has been unable to compress data at all. */
+      /* Before doing the copy, check that we are not running into a
+         buffer overflow. */
+      if ((ntbytes+neblock) > maxbytes) {
+        return 0;    /* Non-compressible data */
+      }
+      memcpy(dest, _tmp+j*neblock, neblock);
       cbytes = neblock;
     }
     _sw32(dest - 4, cbytes);
@@ -623,12 +1382,62 @@ static int blosc_c(const struct blosc_context* context, int32_t blocksize,
     ctbytes += cbytes;
   }  /* Closes j < nsplits */
 
+  if (checksum != NULL) {
+    _sw32(checksum, (int32_t)crc32c(0, block, ctbytes));
+  }
+
   return ctbytes;
 }
 
-/* Decompress & unshuffle a single block */
+/* Get where the `nsplits` splits of the block at `src` end in the
+   buffer of `context`, or -1 if they go past its compressed size */
+static int64_t block_end(const struct blosc_context* context, int32_t nsplits,
+                         const uint8_t* src)
+{
+  int64_t cbytes = context->header64 ? sw64_(context->src + 16) :
+                                       sw32_(context->src + 12);
+  int64_t end = src - context->src;
+  int32_t j, split;
+
+  if (end < header_length(context) || end >= cbytes) {
+    return -1;
+  }
+  /* The block ends where its last split does */
+  for (j = 0; j < nsplits; j++) {
+    if (cbytes - end < (int64_t)sizeof(int32_t)) {
+      return -1;
+    }
+    split = sw32_(context->src + end);
+    end += sizeof(int32_t);
+    if (split < 0 || cbytes - end < split) {
+      return -1;
+    }
+    end += split;
+  }
+  return end;
+}
+
+/* Check the `nsplits` splits of the block at `src` against `checksum`
+   before they are decompressed, so that codecs never see corrupted
+   blocks.  Returns 0 if they match, or -1 if not. */
+static int verify_block(const struct blosc_context* context, int32_t nsplits,
+                        const uint8_t* src, const uint8_t* checksum)
+{
+  int64_t end = block_end(context, nsplits, src);
+
+  if (end < 0 ||
+      crc32c(0, src, (size_t)(end - (src - context->src))) !=
+      (uint32_t)sw32_(checksum)) {
+    return -1;
+  }
+  return 0;
+}
+
+/* Decompress & unshuffle a single block.  If `checksum` is not NULL,
+   the block is checked against it first. */
 static int blosc_d(struct blosc_context* context, int32_t blocksize, int32_t leftoverblock,
-                   const uint8_t *src, uint8_t *dest, uint8_t *tmp, uint8_t *tmp2)
+                   const uint8_t *src, uint8_t *dest, uint8_t *tmp,
+                   const uint8_t *checksum)
 {
   int32_t j, neblock, nsplits;
   int32_t nbytes;                /* number of decompressed bytes in split */
@@ -638,7 +1447,6 @@ static int blosc_d(struct blosc_context* context, int32_t blocksize, int32_t lef
   uint8_t *_tmp;
   int32_t typesize = context->typesize;
   int32_t compcode;
-  char *compname;
 
   if ((*(context->header_flags) & BLOSC_DOSHUFFLE) && (typesize > 1)) {
     _tmp = tmp;
@@ -650,59 +1458,20 @@ static int blosc_d(struct blosc_context* context, int32_t blocksize, int32_t lef
   compcode = (*(context->header_flags) & 0xe0) >> 5;
 
   /* Compress for each shuffled slice split for this block. */
-  if ((typesize <= MAX_SPLITS) && (blocksize/typesize) >= MIN_BUFFERSIZE &&
-      (!leftoverblock)) {
-    nsplits = typesize;
-  }
-  else {
-    nsplits = 1;
-  }
+  nsplits = block_nsplits(context, blocksize, leftoverblock);
   neblock = blocksize / nsplits;
+  if (checksum != NULL && verify_block(context, nsplits, src, checksum) < 0) {
+    return -1;
+  }
   for (j = 0; j < nsplits; j++) {
     cbytes = sw32_(src);      /* amount of compressed bytes */
     src += sizeof(int32_t);
     ctbytes += (int32_t)sizeof(int32_t);
     /* Uncompress */
-    if (cbytes == neblock) {
-      memcpy(_tmp, src, neblock);
-      nbytes = neblock;
-    }
-    else {
-      if (compcode == BLOSC_BLOSCLZ_FORMAT) {
-        nbytes = blosclz_decompress(src, cbytes, _tmp, neblock);
-      }
-      #if defined(HAVE_LZ4)
-      else if (compcode == BLOSC_LZ4_FORMAT) {
-        nbytes = lz4_wrap_decompress((char *)src, (size_t)cbytes,
-                                     (char*)_tmp, (size_t)neblock);
-      }
-      #endif /*  HAVE_LZ4 */
-      #if defined(HAVE_SNAPPY)
-      else if (compcode == BLOSC_SNAPPY_FORMAT) {
-        nbytes = snappy_wrap_decompress((char *)src, (size_t)cbytes,
-                                        (char*)_tmp, (size_t)neblock);
-      }
-      #endif /*  HAVE_SNAPPY */
-      #if defined(HAVE_ZLIB)
-      else if (compcode == BLOSC_ZLIB_FORMAT) {
-        nbytes = zlib_wrap_decompress((char *)src, (size_t)cbytes,
-                                      (char*)_tmp, (size_t)neblock);
-      }
-      #endif /*  HAVE_ZLIB */
-      else {
-        blosc_compcode_to_compname(compcode, &compname);
-        fprintf(stderr,
-                "Blosc has not been compiled with decompression "
-                "support for '%s' format. ", compname);
-        fprintf(stderr, "Please recompile for adding this support.\n");
-        return -5;    /* signals no decompression support */
-      }
-
-      /* Check that decompressed bytes number is correct */
-      if (nbytes != neblock) {
-          return -2;
-      }
-
+    nbytes = decompress_split(compcode, src, cbytes, _tmp, neblock,
+                              context->untrusted, &context->allocator);
+    if (nbytes < 0) {
+      return nbytes;
     }
     src += cbytes;
     ctbytes += cbytes;
@@ -711,18 +1480,9 @@ static int blosc_d(struct blosc_context* context, int32_t blocksize, int32_t lef
   } /* Closes j < nsplits */
 
   if ((*(context->header_flags) & BLOSC_DOSHUFFLE) && (typesize > 1)) {
-    if ((uintptr_t)dest % 16 == 0) {
-      /* 16-bytes aligned dest.  SSE2 unshuffle will work. */
-      unshuffle(typesize, blocksize, tmp, dest);
-    }
-    else {
-      /* dest is not aligned.  Use tmp2, which is aligned, and copy. */
-      unshuffle(typesize, blocksize, tmp, tmp2);
-      if (tmp2 != dest) {
-        /* Copy only when dest is not tmp2 (e.g. not blosc_getitem())  */
-        memcpy(dest, tmp2, blocksize);
-      }
-    }
+    /* The unshuffle kernels store unaligned, so write straight to dest
+       whatever its alignment */
+    unshuffle(typesize, blocksize, tmp, dest);
   }
 
   /* Return the number of uncompressed bytes */
@@ -730,22 +1490,117 @@ static int blosc_d(struct blosc_context* context, int32_t blocksize, int32_t lef
 }
 
 
+/* Decompress block `nblock` of `context` into `out` (using `tmp` for
+   the unshuffle) and hand it to the apply function of `context` */
+static int apply_block(struct blosc_context* context, int32_t nblock,
+                       int32_t bsize, int32_t leftoverblock, uint8_t* out,
+                       uint8_t* tmp)
+{
+  const uint8_t* block = out;
+  int rc;
+
+  if (*(context->header_flags) & BLOSC_MEMCPYED) {
+    /* No need to copy it anywhere */
+    block = context->src + header_length(context) +
+      (int64_t)nblock * context->blocksize;
+  }
+  else {
+    rc = blosc_d(context, bsize, leftoverblock,
+                 context->src + get_bstart(context, nblock), out, tmp,
+                 block_checksum(context, nblock));
+    if (rc < 0) {
+      return rc;
+    }
+  }
+  rc = context->apply(nblock, block, bsize, context->apply_data);
+  return (rc < 0) ? rc : bsize;
+}
+
+/* Decompress block `nblock` of `context` into the part of the range of
+   `dest` it covers.  Blocks only partly in the range go through `out`
+   (`tmp` is for the unshuffle). */
+static int range_block(struct blosc_context* context, int32_t nblock,
+                       int32_t bsize, int32_t leftoverblock, uint8_t* out,
+                       uint8_t* tmp)
+{
+  int64_t boffset = (int64_t)nblock * context->blocksize;
+  int64_t first = context->range_start;
+  int64_t end = context->range_start + context->range_nbytes;
+  const uint8_t* src = context->src + get_bstart(context, nblock);
+  const uint8_t* checksum = block_checksum(context, nblock);
+  int rc;
+
+  if (first < boffset) {
+    first = boffset;
+  }
+  if (end > boffset + bsize) {
+    end = boffset + bsize;
+  }
+  if (first >= end) {
+    return 0;
+  }
+  /* Ranges are read out of regions that may be corrupted: keep the
+     codecs inside the chunk */
+  if (checksum == NULL &&
+      block_end(context, block_nsplits(context, bsize, leftoverblock), src) < 0) {
+    return -1;
+  }
+  if (first == boffset && end == boffset + bsize) {
+    /* The whole block is wanted */
+    return blosc_d(context, bsize, leftoverblock, src,
+                   context->dest + (boffset - context->range_start), tmp,
+                   checksum);
+  }
+  rc = blosc_d(context, bsize, leftoverblock, src, out, tmp, checksum);
+  if (rc < 0) {
+    return rc;
+  }
+  memcpy(context->dest + (first - context->range_start), out + (first - boffset),
+         (size_t)(end - first));
+  return (int)(end - first);
+}
+
+
 /* Serial version for compression/decompression */
-static int serial_blosc(struct blosc_context* context)
+static int64_t serial_blosc(struct blosc_context* context)
 {
   int32_t j, bsize, leftoverblock;
   int32_t cbytes;
+  int32_t header_len = header_length(context);
+  int64_t boffset;
 
   int32_t ebsize = context->blocksize + context->typesize * (int32_t)sizeof(int32_t);
-  int32_t ntbytes = context->num_output_bytes;
+  int64_t ntbytes = context->num_output_bytes;
 
-  uint8_t *tmp = my_malloc(context->blocksize);
-  uint8_t *tmp2 = my_malloc(ebsize);
+  uint8_t *tmp, *tmp2;
+  struct blosclz_htab* htab = NULL;
+  struct thread_context* scratch = context->scratch;
+
+  if (scratch == NULL) {
+    /* Working space for this call only */
+    scratch = new_thread_context(NULL, 0, &context->allocator);
+    if (scratch == NULL) {
+      return -1;
+    }
+  }
+  if (context->compress && context->compcode == BLOSC_BLOSCLZ) {
+    htab = get_htab(scratch, context);
+  }
+  if (grow_temporaries(scratch, ebsize) < 0 ||
+      (context->compress && context->compcode == BLOSC_BLOSCLZ && htab == NULL)) {
+    if (context->scratch == NULL) {
+      free_thread_context(scratch);
+    }
+    return -1;
+  }
+  tmp = scratch->tmp;
+  tmp2 = scratch->tmp2;
 
   for (j = 0; j < context->nblocks; j++) {
     if (context->compress && !(*(context->header_flags) & BLOSC_MEMCPYED)) {
-      _sw32(context->bstarts + j * 4, ntbytes);
+      set_bstart(context, j, ntbytes);
     }
+    boffset = (int64_t)j * context->blocksize;
     bsize = context->blocksize;
     leftoverblock = 0;
     if ((j == context->nblocks - 1) && (context->leftover > 0)) {
@@ -755,35 +1610,43 @@ static int serial_blosc(struct blosc_context* context)
     if (context->compress) {
       if (*(context->header_flags) & BLOSC_MEMCPYED) {
         /* We want to memcpy only */
-        memcpy(context->dest+BLOSC_MAX_OVERHEAD+j*context->blocksize,
-                context->src+j*context->blocksize,
+        memcpy(context->dest+header_len+boffset,
+                context->src+boffset,
                 bsize);
         cbytes = bsize;
       }
       else {
         /* Regular compression */
         cbytes = blosc_c(context, bsize, leftoverblock, ntbytes,
-			 context->destsize, context->src+j*context->blocksize,
-			 context->dest+ntbytes, tmp);
+			 context->destsize, context->src+boffset,
+			 context->dest+ntbytes, tmp, htab,
+			 block_checksum(context, j));
         if (cbytes == 0) {
           ntbytes = 0;              /* uncompressible data */
           break;
         }
       }
     }
+    else if (context->apply != NULL) {
+      cbytes = apply_block(context, j, bsize, leftoverblock, tmp2, tmp);
+    }
+    else if (context->range_nbytes >= 0) {
+      cbytes = range_block(context, j, bsize, leftoverblock, tmp2, tmp);
+    }
     else {
       if (*(context->header_flags) & BLOSC_MEMCPYED) {
         /* We want to memcpy only */
-        memcpy(context->dest+j*context->blocksize,
-                context->src+BLOSC_MAX_OVERHEAD+j*context->blocksize,
+        memcpy(context->dest+boffset,
+                context->src+header_len+boffset,
                 bsize);
         cbytes = bsize;
       }
       else {
         /* Regular decompression */
         cbytes = blosc_d(context, bsize, leftoverblock,
-                          context->src + sw32_(context->bstarts + j * 4),
-                          context->dest+j*context->blocksize, tmp, tmp2);
+                          context->src + get_bstart(context, j),
+                          context->dest+boffset, tmp,
+                          block_checksum(context, j));
       }
     }
     if (cbytes < 0) {
@@ -794,112 +1657,478 @@ static int serial_blosc(struct blosc_context* context)
   }
 
   // Free temporaries
-  my_free(tmp);
-  my_free(tmp2);
+  if (context->scratch == NULL) {
+    free_thread_context(scratch);
+  }
 
   return ntbytes;
 }
 
 
-/* Threaded version for compression/decompression */
-static int parallel_blosc(struct blosc_context* context)
+/* Whether the compressed blocks of `context` go through the staging
+   areas of the threads */
+static int is_staged(const struct blosc_context* context)
 {
-  int rc;
+  return (context->compress && context->deterministic &&
+          !(*(context->header_flags) & BLOSC_MEMCPYED));
+}
 
-  /* Check whether we need to restart threads */
-  blosc_set_nthreads_(context);
+/* An executor task: do the share of the job of a pool without threads
+   that falls to it, with any working space of the pool that is free */
+static void run_task(void* job, int index)
+{
+  struct thread_pool* pool = ((struct blosc_context*)job)->pool;
+  int32_t slot = 0;
 
-  /* Set sentinels */
-  context->thread_giveup_code = 1;
-  context->thread_nblock = -1;
+  (void)index;                  /* blocks are claimed dynamically */
+
+  while (pool->slot_busy[slot] || !ATOMIC_CAS32(&pool->slot_busy[slot], 0, 1)) {
+    slot = (slot + 1) % BLOSC_MAX_THREADS;
+  }
+  if (pool->thread_contexts[slot] == NULL) {
+    pool->thread_contexts[slot] = new_thread_context(pool, slot, &pool->allocator);
+  }
+  if (pool->thread_contexts[slot] != NULL) {
+    run_job(pool->thread_contexts[slot]);
+  }
+  else {
+    pool->context->thread_giveup_code = -1;
+  }
+  ATOMIC_ADD32(&pool->slot_busy[slot], -1);
+}
+
+/* Run the job in `pool->context` with all the threads of `pool`, the
+   calling one included, or with the registered executor */
+static void run_pool_job(struct thread_pool* pool)
+{
+  if (pool->nthreads == 0) {
+    g_executor(run_task, pool->context, pool->context->numthreads,
+               g_executor_data);
+    return;
+  }
 
   /* Synchronization point for all threads (wait for initialization) */
-  WAIT_INIT(-1, context);
+  WAIT_INIT(pool);
+
+  /* Work as one more thread of the pool */
+  run_job(pool->thread_contexts[0]);
 
   /* Synchronization point for all threads (wait for finalization) */
-  WAIT_FINISH(-1, context);
+  WAIT_FINISH(pool);
+}
 
-  if (context->thread_giveup_code > 0) {
-    /* Return the total bytes (de-)compressed in threads */
-    return context->num_output_bytes;
+/* Write the block starts of `context`, whose blocks have been staged
+   in the slots of `pool` from `first_slot` on (except the ones already
+   in place) */
+static void layout_staged_blocks(struct thread_pool* pool,
+                                 struct blosc_context* context,
+                                 int32_t first_slot)
+{
+  int32_t j;
+  int64_t ntbytes = context->placed_bytes;
+
+  for (j = context->placed_blocks; j < context->nblocks; j++) {
+    set_bstart(context, j, ntbytes);
+    ntbytes += pool->block_cbytes[first_slot + j];
   }
-  else {
-    /* Compression/decompression gave up.  Return error code. */
-    return context->thread_giveup_code;
+}
+
+
+/* Borrow the pool (or working space, when an executor is registered)
+   that `context` needs for running a parallel job */
+static int borrow_pool(struct blosc_context* context)
+{
+  /* The registered executor runs every job, except the asynchronous
+     ones (which are driven by the leader thread of their own pool). */
+  if (g_executor != NULL &&
+      !(context->pool != NULL && context->pool->async_running)) {
+    /* Only working space is needed */
+    if (context->numthreads <= 0 || context->numthreads > BLOSC_MAX_THREADS) {
+      return blosc_set_nthreads_(context);
+    }
+    if (context->pool != NULL && context->pool->nthreads > 0) {
+      blosc_release_threadpool(context);
+    }
+    if (context->pool == NULL) {
+      context->pool = acquire_thread_pool(0, &context->allocator);
+      if (context->pool == NULL) {
+        return -1;
+      }
+    }
+    return 0;
   }
+
+  return blosc_set_nthreads_(context);
 }
 
+/* Make room in `pool` for the bookkeeping of `nslots` staged blocks */
+static int reserve_block_slots(struct thread_pool* pool, int32_t nslots)
+{
+  if (nslots <= pool->block_slots) {
+    return 0;
+  }
+  my_free(&pool->allocator, pool->block_cbytes);
+  my_free(&pool->allocator, pool->block_owner);
+  my_free(&pool->allocator, pool->block_offset);
+  pool->block_cbytes = (int32_t*)my_malloc(&pool->allocator, nslots * sizeof(int32_t));
+  pool->block_owner = (int32_t*)my_malloc(&pool->allocator, nslots * sizeof(int32_t));
+  pool->block_offset = (int64_t*)my_malloc(&pool->allocator, nslots * sizeof(int64_t));
+  if (pool->block_cbytes == NULL || pool->block_owner == NULL ||
+      pool->block_offset == NULL) {
+    pool->block_slots = 0;
+    return -1;
+  }
+  pool->block_slots = nslots;
+  return 0;
+}
 
-/* Do the compression or decompression of the buffer depending on the
-   global params. */
-static int do_job(struct blosc_context* context)
+/* Group the blocks of `context` by the NUMA node where their source
+   (compression) or destination (decompression) lives.  Pages not
+   touched yet are split evenly among the nodes, so that each node
+   first-touches its own share. */
+static int numa_layout(struct thread_pool* pool, struct blosc_context* context)
 {
-  int32_t ntbytes;
+#if defined(HAVE_NUMA)
+  const uint8_t* base = context->compress ? context->src : context->dest;
+  int32_t nblocks = context->nblocks;
+  uintptr_t pagemask = ~((uintptr_t)sysconf(_SC_PAGESIZE) - 1);
+  int32_t j, node;
+
+  if (nblocks > pool->node_slots) {
+    my_free(&pool->allocator, pool->node_blocks);
+    my_free(&pool->allocator, pool->node_pages);
+    my_free(&pool->allocator, pool->node_status);
+    pool->node_blocks = (int32_t*)my_malloc(&pool->allocator, nblocks * sizeof(int32_t));
+    pool->node_pages = (void**)my_malloc(&pool->allocator, nblocks * sizeof(void*));
+    pool->node_status = (int*)my_malloc(&pool->allocator, nblocks * sizeof(int));
+    if (pool->node_blocks == NULL || pool->node_pages == NULL ||
+        pool->node_status == NULL) {
+      pool->node_slots = 0;
+      return -1;
+    }
+    pool->node_slots = nblocks;
+  }
 
-  /* Run the serial version when nthreads is 1 or when the buffers are
-     not much larger than blocksize */
-  if (context->numthreads == 1 || (context->sourcesize / context->blocksize) <= 1) {
-    ntbytes = serial_blosc(context);
+  /* Ask the kernel where the first page of every block lives */
+  for (j = 0; j < nblocks; j++) {
+    pool->node_pages[j] = (void*)((uintptr_t)(base + (int64_t)j * context->blocksize) & pagemask);
   }
-  else {
-    ntbytes = parallel_blosc(context);
+  if (syscall(SYS_move_pages, 0, (unsigned long)nblocks, pool->node_pages,
+              NULL, pool->node_status, 0) < 0) {
+    for (j = 0; j < nblocks; j++) {
+      pool->node_status[j] = -1;
+    }
   }
 
-  return ntbytes;
+  memset(pool->node_first, 0, sizeof(pool->node_first));
+  for (j = 0; j < nblocks; j++) {
+    node = pool->node_status[j];
+    node = (node >= 0 && node < MAX_NUMA_NODES) ? g_node_index[node] : -1;
+    if (node < 0) {
+      node = (int32_t)((int64_t)j * g_numa_nodes / nblocks);
+    }
+    pool->node_status[j] = node;
+    pool->node_first[node + 1]++;
+  }
+  for (node = 0; node < g_numa_nodes; node++) {
+    pool->node_first[node + 1] += pool->node_first[node];
+    pool->node_next[node].nblock = 0;
+  }
+  /* Use node_next as a fill cursor, then reset it for the job */
+  for (j = 0; j < nblocks; j++) {
+    node = pool->node_status[j];
+    pool->node_blocks[pool->node_first[node] + pool->node_next[node].nblock++] = j;
+  }
+  for (node = 0; node < g_numa_nodes; node++) {
+    pool->node_next[node].nblock = 0;
+  }
+  return 0;
+#else
+  return -1;
+#endif  /* HAVE_NUMA */
 }
 
-
-static int32_t compute_blocksize(struct blosc_context* context, int32_t clevel, int32_t typesize, int32_t nbytes, int32_t forced_blocksize)
+/* Nothing of `context` is in place yet, and none of its blocks (whose
+   slots in `pool` start at `first_slot`) is staged */
+static void reset_placement(struct thread_pool* pool, struct blosc_context* context,
+                            int32_t first_slot)
 {
-  int32_t blocksize;
+  int32_t j;
 
-  /* Protection against very small buffers */
-  if (nbytes < (int32_t)typesize) {
-    return 1;
+  context->placed_blocks = 0;
+  context->placed_bytes = (context->bstarts - context->dest) +
+    index_length(context);
+  for (j = 0; j < context->nblocks; j++) {
+    pool->block_owner[first_slot + j] = -1;
   }
+}
 
-  blocksize = nbytes;           /* Start by a whole buffer as blocksize */
+/* Staging areas are filled from scratch on every job */
+static void reset_staging(struct thread_pool* pool)
+{
+  int32_t j;
 
-  if (forced_blocksize) {
-    blocksize = forced_blocksize;
-    /* Check that forced blocksize is not too small */
-    if (blocksize < MIN_BUFFERSIZE) {
-      blocksize = MIN_BUFFERSIZE;
+  for (j = 0; j < BLOSC_MAX_THREADS; j++) {
+    if (pool->thread_contexts[j] != NULL) {
+      pool->thread_contexts[j]->staging_used = 0;
+      pool->thread_contexts[j]->staged_blocks = 0;
     }
   }
-  else if (nbytes >= L1 * typesize) {
-    blocksize = L1 * typesize;
-
-    /* For Zlib, increase the block sizes in a factor of 8 because it
-       is meant for compression large blocks (it shows a big overhead
-       in compressing small ones). */
-    if (context->compcode == BLOSC_ZLIB) {
-      blocksize *= 8;
-    }
+}
 
-    /* For LZ4HC, increase the block sizes in a factor of 8 because it
-       is meant for compression large blocks (it shows a big overhead
-       in compressing small ones). */
-    if (context->compcode == BLOSC_LZ4HC) {
-      blocksize *= 8;
-    }
+/* Threaded version for buffers with fewer blocks than threads.  Each
+   split of every block is (de-)compressed as a separate task. */
+static int64_t parallel_splits(struct blosc_context* context)
+{
+  int32_t j;
+  int64_t ntbytes, start, end;
+  int32_t nfull = context->nblocks - (context->leftover > 0);
+  int shuffled = ((*(context->header_flags) & BLOSC_DOSHUFFLE) &&
+                  (context->typesize > 1));
+  struct thread_pool* pool;
+
+  if (borrow_pool(context) < 0) {
+    return -1;
+  }
+  pool = context->pool;
 
-    if (clevel == 0) {
-      blocksize /= 16;
+  context->nsplits = block_nsplits(context, context->blocksize, 0);
+  context->ntasks = nfull * context->nsplits + (context->leftover > 0);
+  if (context->compress) {
+    if (reserve_block_slots(pool, context->ntasks) < 0) {
+      return -1;
     }
-    else if (clevel <= 3) {
-      blocksize /= 8;
+  }
+  else if (shuffled &&
+           (int64_t)context->nblocks * context->blocksize > pool->split_scratch_size) {
+    scratch_free(&pool->allocator, pool->split_scratch);
+    pool->split_scratch = scratch_malloc(&pool->allocator,
+                                         (size_t)context->nblocks * context->blocksize);
+    if (pool->split_scratch == NULL) {
+      pool->split_scratch_size = 0;
+      return -1;
     }
-    else if (clevel <= 5) {
-      blocksize /= 4;
+    pool->split_scratch_size = (int64_t)context->nblocks * context->blocksize;
+  }
+  if (!context->compress && context->checksums != NULL) {
+    /* Check the blocks before their splits are spread over threads */
+    for (j = 0; j < context->nblocks; j++) {
+      if (verify_block(context, (j < nfull) ? context->nsplits : 1,
+                       context->src + get_bstart(context, j),
+                       block_checksum(context, j)) < 0) {
+        return -1;
+      }
     }
-    else if (clevel <= 6) {
-      blocksize /= 2;
+  }
+
+  /* (De-)compress all the splits */
+  context->thread_giveup_code = 1;
+  context->thread_nblock = 0;
+  context->job = JOB_SPLITS;
+  reset_staging(pool);
+  pool->context = context;
+  run_pool_job(pool);
+
+  if (context->thread_giveup_code > 0 && context->compress) {
+    /* Lay the blocks out in order and move the splits into place */
+    ntbytes = (context->bstarts - context->dest) + index_length(context);
+    for (j = 0; j < context->ntasks; j++) {
+      if (j == 0 || j >= nfull * context->nsplits || j % context->nsplits == 0) {
+        set_bstart(context, (j < nfull * context->nsplits ?
+                             j / context->nsplits : nfull), ntbytes);
+      }
+      ntbytes += (int32_t)sizeof(int32_t) + pool->block_cbytes[j];
     }
-    else if (clevel < 9) {
-      blocksize *= 1;
+    context->thread_nblock = 0;
+    context->job = JOB_COPY_SPLITS;
+    run_pool_job(pool);
+    /* Blocks are whole only now */
+    for (j = 0; j < context->nblocks && context->checksums != NULL; j++) {
+      start = get_bstart(context, j);
+      end = (j + 1 < context->nblocks) ? get_bstart(context, j + 1) : ntbytes;
+      _sw32(block_checksum(context, j),
+            (int32_t)crc32c(0, context->dest + start, (size_t)(end - start)));
     }
-    else {
+  }
+  else if (context->thread_giveup_code > 0 && shuffled) {
+    /* Unshuffle the blocks, now that all their splits are there */
+    context->thread_nblock = 0;
+    context->ntasks = context->nblocks;
+    context->job = JOB_UNSHUFFLE;
+    run_pool_job(pool);
+  }
+
+  if (context->thread_giveup_code > 0) {
+    return context->num_output_bytes;
+  }
+  return context->thread_giveup_code;
+}
+
+
+/* Threaded version for compression/decompression */
+static int64_t parallel_blosc(struct blosc_context* context)
+{
+  int32_t j;
+  int staged = 0;
+  struct thread_pool* pool;
+
+  /* Check whether we need to borrow a (new) pool of threads */
+  if (borrow_pool(context) < 0) {
+    return -1;
+  }
+  pool = context->pool;
+
+  /* Make room for the bookkeeping of staged blocks */
+  if (context->compress && context->deterministic &&
+      reserve_block_slots(pool, context->nblocks) < 0) {
+    return -1;
+  }
+
+  /* Let threads take the blocks living in their own NUMA node first */
+  context->numa = (pool->numa && context->batch == NULL &&
+                   numa_layout(pool, context) == 0);
+
+  /* Set sentinels */
+  context->thread_giveup_code = 1;
+  context->thread_nblock = 0;
+  context->job = JOB_BLOCKS;
+  reset_staging(pool);
+  if (context->batch == NULL) {
+    if (is_staged(context)) {
+      reset_placement(pool, context, 0);
+    }
+  }
+  else {
+    for (j = 0; j < context->batch_size; j++) {
+      if (context->batch[j].thread_giveup_code > 0 &&
+          is_staged(&context->batch[j])) {
+        reset_placement(pool, &context->batch[j], context->batch_blocks[j]);
+      }
+    }
+  }
+
+  /* Hand the job over to the pool */
+  pool->context = context;
+  run_pool_job(pool);
+
+  /* Threads have put in place the compressed blocks that they could,
+     and staged the rest.  Lay these out in block order too, so that the
+     output does not depend on the number of threads nor on their
+     timing. */
+  if (context->batch == NULL) {
+    if (is_staged(context) && context->thread_giveup_code > 0 &&
+        context->placed_blocks < context->nblocks) {
+      layout_staged_blocks(pool, context, 0);
+      staged = 1;
+    }
+  }
+  else {
+    for (j = 0; j < context->batch_size; j++) {
+      if (context->batch[j].thread_giveup_code > 0 &&
+          is_staged(&context->batch[j]) &&
+          context->batch[j].placed_blocks < context->batch[j].nblocks) {
+        layout_staged_blocks(pool, &context->batch[j], context->batch_blocks[j]);
+        staged = 1;
+      }
+    }
+  }
+
+  if (staged) {
+    /* And let the threads move the blocks into place */
+    context->thread_nblock = 0;
+    context->job = JOB_COPY_STAGED;
+    run_pool_job(pool);
+  }
+
+  if (context->thread_giveup_code > 0) {
+    /* Return the total bytes (de-)compressed in threads */
+    return context->num_output_bytes;
+  }
+  else {
+    /* Compression/decompression gave up.  Return error code. */
+    return context->thread_giveup_code;
+  }
+}
+
+/* Do the compression or decompression of the buffer depending on the
+   global params. */
+static int64_t do_job(struct blosc_context* context)
+{
+  int64_t ntbytes;
+
+  /* Use the splits of blocks as tasks when there are not enough blocks
+     for the threads.  Else, run the serial version when nthreads is 1
+     or when the buffers are not much larger than blocksize. */
+  if (context->numthreads > 1 && context->nblocks < context->numthreads &&
+      context->sourcesize <= BLOSC_MAX_BUFFERSIZE && context->apply == NULL &&
+      context->range_nbytes < 0 && !(*(context->header_flags) & BLOSC_MEMCPYED) &&
+      block_nsplits(context, context->blocksize, 0) > 1) {
+    ntbytes = parallel_splits(context);
+  }
+  else if (context->numthreads == 1 || (context->sourcesize / context->blocksize) <= 1) {
+    ntbytes = serial_blosc(context);
+  }
+  else {
+    ntbytes = parallel_blosc(context);
+  }
+
+  return ntbytes;
+}
+
+
+static int32_t compute_blocksize(struct blosc_context* context, int32_t clevel, int32_t typesize, int64_t nbytes, int32_t forced_blocksize)
+{
+  int32_t blocksize;
+
+  /* Protection against very small buffers */
+  if (nbytes < (int32_t)typesize) {
+    return 1;
+  }
+
+  /* Start by a whole buffer as blocksize (buffers past 2 GB always take
+     one of the branches below) */
+  blocksize = (int32_t)nbytes;
+
+  if (forced_blocksize) {
+    blocksize = forced_blocksize;
+    /* Check that forced blocksize is not too small */
+    if (blocksize < MIN_BUFFERSIZE) {
+      blocksize = MIN_BUFFERSIZE;
+    }
+  }
+  else if (nbytes >= L1 * typesize) {
+    blocksize = L1 * typesize;
+
+    /* For Zlib, increase the block sizes in a factor of 8 because it
+       is meant for compression large blocks (it shows a big overhead
+       in compressing small ones). */
+    if (context->compcode == BLOSC_ZLIB) {
+      blocksize *= 8;
+    }
+
+    /* For LZ4HC, increase the block sizes in a factor of 8 because it
+       is meant for compression large blocks (it shows a big overhead
+       in compressing small ones). */
+    if (context->compcode == BLOSC_LZ4HC) {
+      blocksize *= 8;
+    }
+
+    if (clevel == 0) {
+      blocksize /= 16;
+    }
+    else if (clevel <= 3) {
+      blocksize /= 8;
+    }
+    else if (clevel <= 5) {
+      blocksize /= 4;
+    }
+    else if (clevel <= 6) {
+      blocksize /= 2;
+    }
+    else if (clevel < 9) {
+      blocksize *= 1;
+    }
+    else {
       blocksize *= 2;
     }
   }
@@ -920,8 +2149,8 @@ static int32_t compute_blocksize(struct blosc_context* context, int32_t clevel,
   }
 
   /* Check that blocksize is not too large */
-  if (blocksize > (int32_t)nbytes) {
-    blocksize = nbytes;
+  if (blocksize > nbytes) {
+    blocksize = (int32_t)nbytes;
   }
 
   /* blocksize must be a multiple of the typesize */
@@ -942,28 +2171,49 @@ static int initialize_context_compression(struct blosc_context* context,
                           size_t destsize,
                           int32_t compressor,
                           int32_t blocksize,
-                          int32_t numthreads)
+                          int32_t numthreads,
+                          int header64)
 {
+  int64_t nblocks;
+
   /* Set parameters */
   context->compress = 1;
+  context->batch = NULL;
   context->src = (const uint8_t*)src;
   context->dest = (uint8_t *)(dest);
   context->num_output_bytes = 0;
-  context->destsize = (int32_t)destsize;
-  context->sourcesize = sourcesize;
+  context->header64 = header64;
+  context->apply = NULL;
+  context->range_nbytes = -1;
+  if (header64) {
+    /* Past INT64_MAX nothing fits anyway */
+    context->destsize = (destsize > INT64_MAX) ? INT64_MAX : (int64_t)destsize;
+  }
+  else {
+    /* Use no more than what the header can tell */
+    context->destsize = (destsize > INT32_MAX) ? INT32_MAX : (int64_t)destsize;
+  }
+  context->sourcesize = (int64_t)sourcesize;
   context->typesize = typesize;
   context->compcode = compressor;
   context->numthreads = numthreads;
-  context->end_threads = 0;
   context->clevel = clevel;
+  context->deterministic = g_deterministic;
+  context->checksummed = g_checksums;
+  context->checksums = NULL;
 
   /* Check buffer size limits */
-  if (sourcesize > BLOSC_MAX_BUFFERSIZE) {
+  if (!header64 && sourcesize > BLOSC_MAX_BUFFERSIZE) {
     /* If buffer is too large, give up. */
     fprintf(stderr, "Input buffer size cannot exceed %d bytes\n",
             BLOSC_MAX_BUFFERSIZE);
     return -1;
   }
+  if (header64 && sourcesize > (size_t)BLOSC_MAX_BUFFERSIZE64) {
+    fprintf(stderr, "Input buffer size cannot exceed %lld bytes\n",
+            (long long)BLOSC_MAX_BUFFERSIZE64);
+    return -1;
+  }
 
   /* Compression level */
   if (clevel < 0 || clevel > 9) {
@@ -988,9 +2238,14 @@ static int initialize_context_compression(struct blosc_context* context,
   context->blocksize = compute_blocksize(context, clevel, (int32_t)context->typesize, context->sourcesize, blocksize);
 
   /* Compute number of blocks in buffer */
-  context->nblocks = context->sourcesize / context->blocksize;
-  context->leftover = context->sourcesize % context->blocksize;
-  context->nblocks = (context->leftover > 0) ? (context->nblocks + 1) : context->nblocks;
+  nblocks = context->sourcesize / context->blocksize;
+  context->leftover = (int32_t)(context->sourcesize % context->blocksize);
+  nblocks = (context->leftover > 0) ? (nblocks + 1) : nblocks;
+  if (nblocks > INT32_MAX / (int32_t)sizeof(int64_t)) {
+    fprintf(stderr, "Too many blocks in buffer; use a larger blocksize\n");
+    return -1;
+  }
+  context->nblocks = (int32_t)nblocks;
 
   return 1;
 }
@@ -1000,7 +2255,12 @@ static int write_compression_header(struct blosc_context* context, int clevel, i
   int32_t compcode;
 
   /* Write version header for this block */
-  context->dest[0] = BLOSC_VERSION_FORMAT;              /* blosc format version */
+  if (context->header64) {
+    context->dest[0] = BLOSC_VERSION_FORMAT64;          /* 64-bit sizes */
+  }
+  else {
+    context->dest[0] = BLOSC_VERSION_FORMAT;            /* blosc format version */
+  }
 
   /* Write compressor format */
   compcode = -1;
@@ -1050,10 +2310,16 @@ static int write_compression_header(struct blosc_context* context, int clevel, i
   context->header_flags = context->dest+2;                       /* flags */
   context->dest[2] = 0;                                          /* zeroes flags */
   context->dest[3] = (uint8_t)context->typesize;                 /* type size */
-  _sw32(context->dest + 4, context->sourcesize);                 /* size of the buffer */
-  _sw32(context->dest + 8, context->blocksize);                  /* block size */
-  context->bstarts = context->dest + 16;                         /* starts for every block */
-  context->num_output_bytes = 16 + sizeof(int32_t)*context->nblocks;  /* space for header and pointers */
+  if (context->header64) {
+    _sw32(context->dest + 4, context->blocksize);                /* block size */
+    _sw64(context->dest + 8, context->sourcesize);               /* size of the buffer */
+    memset(context->dest + 16, 0, 16);                           /* cbytes & reserved */
+  }
+  else {
+    _sw32(context->dest + 4, (int32_t)context->sourcesize);      /* size of the buffer */
+    _sw32(context->dest + 8, context->blocksize);                /* block size */
+  }
+  context->bstarts = context->dest + header_length(context);     /* starts for every block */
 
   if (context->clevel == 0) {
     /* Compression level 0 means buffer to be memcpy'ed */
@@ -1072,12 +2338,28 @@ static int write_compression_header(struct blosc_context* context, int clevel, i
 
   *(context->header_flags) |= compcode << 5;              /* compressor format start at bit 5 */
 
+  /* Space for header, pointers and checksums (if any) */
+  set_checksums(context, context->checksummed &&
+                !(*(context->header_flags) & BLOSC_MEMCPYED));
+
   return 1;
 }
 
-int blosc_compress_context(struct blosc_context* context)
+/* Write the number of compressed bytes in the header of `context` */
+static void write_cbytes(struct blosc_context* context, int64_t ntbytes)
+{
+  if (context->header64) {
+    _sw64(context->dest + 16, ntbytes);
+  }
+  else {
+    _sw32(context->dest + 12, (int32_t)ntbytes);
+  }
+}
+
+int64_t blosc_compress_context(struct blosc_context* context)
 {
-  int32_t ntbytes = 0;
+  int64_t ntbytes = 0;
+  int32_t header_len = header_length(context);
 
   if (!(*(context->header_flags) & BLOSC_MEMCPYED)) {
     /* Do the actual compression */
@@ -1085,35 +2367,36 @@ int blosc_compress_context(struct blosc_context* context)
     if (ntbytes < 0) {
       return -1;
     }
-    if ((ntbytes == 0) && (context->sourcesize+BLOSC_MAX_OVERHEAD <= context->destsize)) {
+    if ((ntbytes == 0) && (context->sourcesize+header_len <= context->destsize)) {
       /* Last chance for fitting `src` buffer in `dest`.  Update flags
        and do a memcpy later on. */
       *(context->header_flags) |= BLOSC_MEMCPYED;
+      set_checksums(context, 0);
     }
   }
 
   if (*(context->header_flags) & BLOSC_MEMCPYED) {
-    if (context->sourcesize + BLOSC_MAX_OVERHEAD > context->destsize) {
+    if (context->sourcesize + header_len > context->destsize) {
       /* We are exceeding maximum output size */
       ntbytes = 0;
     }
     else if (((context->sourcesize % L1) == 0) || (context->numthreads > 1)) {
       /* More effective with large buffers that are multiples of the
        cache size or multi-cores */
-      context->num_output_bytes = BLOSC_MAX_OVERHEAD;
+      context->num_output_bytes = header_len;
       ntbytes = do_job(context);
       if (ntbytes < 0) {
         return -1;
       }
     }
     else {
-      memcpy(context->dest+BLOSC_MAX_OVERHEAD, context->src, context->sourcesize);
-      ntbytes = context->sourcesize + BLOSC_MAX_OVERHEAD;
+      memcpy(context->dest+header_len, context->src, context->sourcesize);
+      ntbytes = context->sourcesize + header_len;
     }
   }
 
   /* Set the number of compressed bytes in header */
-  _sw32(context->dest + 12, ntbytes);
+  write_cbytes(context, ntbytes);
 
   assert(ntbytes <= context->destsize);
   return ntbytes;
@@ -1128,66 +2411,130 @@ int blosc_compress_ctx(int clevel, int doshuffle, size_t typesize,
   int error, result;
 
   struct blosc_context context;
-  context.threads_started = 0;
+  context.pool = NULL;
+  context.scratch = NULL;
+  context.allocator = g_allocator;
   error = initialize_context_compression(&context, clevel, doshuffle, typesize, nbytes,
                                   src, dest, destsize, blosc_compname_to_compcode(compressor),
-                                  blocksize, numinternalthreads);
+                                  blocksize, numinternalthreads, 0);
   if (error < 0) { return error; }
 
   error = write_compression_header(&context, clevel, doshuffle);
   if (error < 0) { return error; }
 
-  result = blosc_compress_context(&context);
+  result = (int)blosc_compress_context(&context);
 
-  if (numinternalthreads > 1)
-  {
-    blosc_release_threadpool(&context);
-  }
+  /* Give the threads back to the cache so that next calls can reuse them */
+  blosc_release_threadpool(&context);
 
   return result;
 }
 
+/* Forget the context of a thread that is exiting */
+static void free_global_context(void* context);
+
+/* Get the context of the calling thread for the non-contextual API */
+static struct blosc_context* get_global_context(void)
+{
+  struct blosc_context* context;
+
+  context = (struct blosc_context*)pthread_getspecific(g_context_key);
+  if (context != NULL && !same_allocator(&context->allocator, &g_allocator)) {
+    /* blosc_set_allocator() was called since the context was made:
+       make it again from the new allocator */
+    free_global_context(context);
+    pthread_setspecific(g_context_key, NULL);
+    context = NULL;
+  }
+  if (context == NULL) {
+    context = (struct blosc_context*)my_malloc(&g_allocator,
+                                               sizeof(struct blosc_context));
+    if (context == NULL) {
+      return NULL;
+    }
+    context->pool = NULL;
+    context->allocator = g_allocator;
+    /* Keep the working space of the serial code between calls */
+    context->scratch = new_thread_context(NULL, 0, &context->allocator);
+    if (context->scratch == NULL) {
+      my_free(&context->allocator, context);
+      return NULL;
+    }
+    pthread_mutex_lock(&g_contexts_mutex);
+    context->next = g_contexts;
+    g_contexts = context;
+    pthread_mutex_unlock(&g_contexts_mutex);
+    pthread_setspecific(g_context_key, context);
+  }
+  return context;
+}
+
+/* Forget the context of a thread that is exiting */
+static void free_global_context(void* context)
+{
+  struct blosc_context** link;
+  struct blosc_allocator allocator = ((struct blosc_context*)context)->allocator;
+
+  pthread_mutex_lock(&g_contexts_mutex);
+  for (link = &g_contexts; *link != NULL; link = &(*link)->next) {
+    if (*link == context) {
+      *link = (*link)->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&g_contexts_mutex);
+  blosc_release_threadpool((struct blosc_context*)context);
+  free_thread_context(((struct blosc_context*)context)->scratch);
+  my_free(&allocator, context);
+}
+
 /* The public routine for compression.  See blosc.h for docstrings. */
 int blosc_compress(int clevel, int doshuffle, size_t typesize, size_t nbytes,
                    const void *src, void *dest, size_t destsize)
 {
   int error;
   int result;
+  struct blosc_context* context = get_global_context();
 
-  pthread_mutex_lock(&global_comp_mutex);
-
-  error = initialize_context_compression(g_global_context, clevel, doshuffle, typesize, nbytes,
-                                  src, dest, destsize, g_compressor, g_force_blocksize, g_threads);
-  if (error < 0) { return error; }
-
-  error = write_compression_header(g_global_context, clevel, doshuffle);
-  if (error < 0) { return error; }
+  if (context == NULL) {
+    return -1;
+  }
 
-  result = blosc_compress_context(g_global_context);
+  error = initialize_context_compression(context, clevel, doshuffle, typesize, nbytes,
+                                  src, dest, destsize, g_compressor, g_force_blocksize,
+                                  borrow_global_pool(context), 0);
+  if (error >= 0) {
+    error = write_compression_header(context, clevel, doshuffle);
+  }
+  result = (error < 0) ? error : (int)blosc_compress_context(context);
 
-  pthread_mutex_unlock(&global_comp_mutex);
+  /* Give the threads back, so that other calling threads can use them */
+  return_global_pool(context);
 
   return result;
 }
 
-int blosc_run_decompression_with_context(struct blosc_context* context,
-				    const void* src,
-				    void* dest,
-				    size_t destsize,
-				    int numinternalthreads)
+/* Set up `context` for decompressing the buffer at `src`, out of its
+   header.  There is no destination yet.  Returns a negative value if
+   the header makes no sense. */
+static int read_decompression_header(struct blosc_context* context,
+                                     const void* src,
+                                     int numinternalthreads)
 {
   uint8_t version;
   uint8_t versionlz;
-  uint32_t ctbytes;
-  int32_t ntbytes;
+  int64_t nblocks;
 
   context->compress = 0;
+  context->batch = NULL;
   context->src = (const uint8_t*)src;
-  context->dest = (uint8_t*)dest;
-  context->destsize = destsize;
+  context->untrusted = 0;
+  context->dest = NULL;
+  context->destsize = 0;
   context->num_output_bytes = 0;
   context->numthreads = numinternalthreads;
-  context->end_threads = 0;
+  context->apply = NULL;
+  context->range_nbytes = -1;
 
   /* Read the header block */
   version = context->src[0];                        /* blosc format version */
@@ -1195,24 +2542,77 @@ int blosc_run_decompression_with_context(struct blosc_context* context,
 
   context->header_flags = (uint8_t*)(context->src + 2);           /* flags */
   context->typesize = (int32_t)context->src[3];      /* typesize */
-  context->sourcesize = sw32_(context->src + 4);     /* buffer size */
-  context->blocksize = sw32_(context->src + 8);      /* block size */
-  ctbytes = sw32_(context->src + 12);               /* compressed buffer size */
+  context->header64 = (version == BLOSC_VERSION_FORMAT64);
+  if (context->header64) {
+    context->blocksize = sw32_(context->src + 4);    /* block size */
+    context->sourcesize = sw64_(context->src + 8);   /* buffer size */
+  }
+  else {
+    context->sourcesize = sw32_(context->src + 4);   /* buffer size */
+    context->blocksize = sw32_(context->src + 8);    /* block size */
+  }
 
   /* Unused values */
-  version += 0;                             /* shut up compiler warning */
   versionlz += 0;                           /* shut up compiler warning */
-  ctbytes += 0;                             /* shut up compiler warning */
 
-  context->bstarts = (uint8_t*)(context->src + 16);
+  /* Blocks (plus their split sizes) must fit in the temporaries */
+  if (context->blocksize <= 0 || context->sourcesize < 0 ||
+      context->blocksize > INT32_MAX - BLOSC_MAX_TYPESIZE * (int32_t)sizeof(int32_t)) {
+    return -1;
+  }
+
+  context->bstarts = (uint8_t*)(context->src + header_length(context));
   /* Compute some params */
   /* Total blocks */
-  context->nblocks = context->sourcesize / context->blocksize;
-  context->leftover = context->sourcesize % context->blocksize;
-  context->nblocks = (context->leftover>0)? context->nblocks+1: context->nblocks;
+  nblocks = context->sourcesize / context->blocksize;
+  context->leftover = (int32_t)(context->sourcesize % context->blocksize);
+  if (context->leftover > 0) {
+    nblocks++;
+  }
+  if (nblocks > INT32_MAX) {
+    return -1;
+  }
+  context->nblocks = (int32_t)nblocks;
+  context->checksums = NULL;
+  if ((*(context->header_flags) & BLOSC_DOCHECKSUM) &&
+      !(*(context->header_flags) & BLOSC_MEMCPYED)) {
+    context->checksums = context->bstarts +
+      (int64_t)context->nblocks * bstart_size(context);
+  }
+
+  return 0;
+}
+
+static int initialize_context_decompression(struct blosc_context* context,
+                                            const void* src,
+                                            void* dest,
+                                            size_t destsize,
+                                            int numinternalthreads)
+{
+  if (read_decompression_header(context, src, numinternalthreads) < 0) {
+    return -1;
+  }
+  context->dest = (uint8_t*)dest;
+  context->destsize = (destsize > INT64_MAX) ? INT64_MAX : (int64_t)destsize;
 
   /* Check that we have enough space to decompress */
-  if (context->sourcesize > (int32_t)destsize) {
+  if (context->sourcesize > context->destsize) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int64_t blosc_run_decompression_with_context(struct blosc_context* context,
+				    const void* src,
+				    void* dest,
+				    size_t destsize,
+				    int numinternalthreads)
+{
+  int64_t ntbytes;
+
+  if (initialize_context_decompression(context, src, dest, destsize,
+                                       numinternalthreads) < 0) {
     return -1;
   }
 
@@ -1227,7 +2627,7 @@ int blosc_run_decompression_with_context(struct blosc_context* context,
       }
     }
     else {
-      memcpy(dest, (uint8_t *)src+BLOSC_MAX_OVERHEAD, context->sourcesize);
+      memcpy(dest, (uint8_t *)src+header_length(context), context->sourcesize);
       ntbytes = context->sourcesize;
     }
   }
@@ -1239,401 +2639,2904 @@ int blosc_run_decompression_with_context(struct blosc_context* context,
     }
   }
 
-  assert(ntbytes <= (int32_t)destsize);
+  assert(ntbytes <= context->destsize);
   return ntbytes;
 }
 
+/* The largest `destsize` for the functions returning an int: buffers
+   with more bytes than an int can count are not decompressed by them */
+static size_t int_destsize(size_t destsize)
+{
+  return (destsize > INT_MAX) ? INT_MAX : destsize;
+}
+
 /* The public routine for decompression with context. */
 int blosc_decompress_ctx(const void *src, void *dest, size_t destsize,
 			 int numinternalthreads)
 {
   struct blosc_context context;
-  int result = blosc_run_decompression_with_context(&context, src, dest, destsize, numinternalthreads);
+  int result;
 
-  if (numinternalthreads > 1)
-  {
-    blosc_release_threadpool(&context);
-  }
+  context.pool = NULL;
+  context.scratch = NULL;
+  context.allocator = g_allocator;
+  result = (int)blosc_run_decompression_with_context(&context, src, dest,
+                                                     int_destsize(destsize),
+                                                     numinternalthreads);
+
+  /* Give the threads back to the cache so that next calls can reuse them */
+  blosc_release_threadpool(&context);
 
   return result;
 }
 
-
-/* The public routine for decompression.  See blosc.h for docstrings. */
-int blosc_decompress(const void *src, void *dest, size_t destsize)
+/* Create a reusable context.  See blosc.h for docstrings. */
+struct blosc_ctx* blosc_create_ctx(const char* compressor, int clevel,
+                                   int doshuffle, size_t typesize,
+                                   size_t blocksize, int numinternalthreads)
 {
-  return blosc_run_decompression_with_context(g_global_context, src, dest, destsize, g_threads);
-}
+  struct blosc_ctx* ctx;
+  int32_t compcode = blosc_compname_to_compcode(compressor);
 
+  if (compcode < 0) {
+    fprintf(stderr, "Compressor '%s' is not available\n", compressor);
+    return NULL;
+  }
+  if (clevel < 0 || clevel > 9) {
+    fprintf(stderr, "`clevel` parameter must be between 0 and 9!\n");
+    return NULL;
+  }
+  if (doshuffle != 0 && doshuffle != 1) {
+    fprintf(stderr, "`shuffle` parameter must be either 0 or 1!\n");
+    return NULL;
+  }
+  if (numinternalthreads <= 0 || numinternalthreads > BLOSC_MAX_THREADS) {
+    fprintf(stderr, "Error.  nthreads must be between 1 and %d\n",
+            BLOSC_MAX_THREADS);
+    return NULL;
+  }
 
-/* Specific routine optimized for decompression a small number of
-   items out of a compressed chunk.  This does not use threads because
-   it would affect negatively to performance. */
-int blosc_getitem(const void *src, int start, int nitems, void *dest)
-{
-  uint8_t *_src=NULL;               /* current pos for source buffer */
-  uint8_t version, versionlz;       /* versions for compressed header */
-  uint8_t flags;                    /* flags for header */
-  int32_t ntbytes = 0;              /* the number of uncompressed bytes */
-  int32_t nblocks;                  /* number of total blocks in buffer */
-  int32_t leftover;                 /* extra bytes at end of buffer */
-  uint8_t *bstarts;                 /* start pointers for each block */
-  int tmp_init = 0;
-  int32_t typesize, blocksize, nbytes, ctbytes;
-  int32_t j, bsize, bsize2, leftoverblock;
-  int32_t cbytes, startb, stopb;
-  int stop = start + nitems;
-  uint8_t *tmp;
-  uint8_t *tmp2;
-  int32_t ebsize;
+  ctx = (struct blosc_ctx*)my_malloc(&g_allocator, sizeof(struct blosc_ctx));
+  if (ctx == NULL) {
+    return NULL;
+  }
+  ctx->allocator = g_allocator;
+  ctx->context.pool = NULL;
+  ctx->context.allocator = g_allocator;
+  ctx->context.scratch = new_thread_context(NULL, 0, &ctx->context.allocator);
+  if (ctx->context.scratch == NULL) {
+    my_free(&ctx->allocator, ctx);
+    return NULL;
+  }
+  ctx->compcode = compcode;
+  ctx->clevel = clevel;
+  ctx->doshuffle = doshuffle;
+  ctx->typesize = typesize;
+  ctx->blocksize = blocksize;
+  ctx->numthreads = numinternalthreads;
+  return ctx;
+}
 
-  _src = (uint8_t *)(src);
+/* Compress with a reusable context.  See blosc.h for docstrings. */
+int blosc_compress_with_ctx(struct blosc_ctx* ctx, size_t nbytes,
+                            const void* src, void* dest, size_t destsize)
+{
+  int error;
 
-  /* Read the header block */
-  version = _src[0];                        /* blosc format version */
-  versionlz = _src[1];                      /* blosclz format version */
-  flags = _src[2];                          /* flags */
-  typesize = (int32_t)_src[3];              /* typesize */
-  nbytes = sw32_(_src + 4);                 /* buffer size */
-  blocksize = sw32_(_src + 8);              /* block size */
-  ctbytes = sw32_(_src + 12);               /* compressed buffer size */
+  /* The pool of threads (if any) is kept for the next calls */
+  error = initialize_context_compression(&ctx->context, ctx->clevel, ctx->doshuffle,
+                                         ctx->typesize, nbytes, src, dest, destsize,
+                                         ctx->compcode, (int32_t)ctx->blocksize,
+                                         ctx->numthreads, 0);
+  if (error < 0) { return error; }
 
-  ebsize = blocksize + typesize * (int32_t)sizeof(int32_t);
-  tmp = my_malloc(blocksize);     /* tmp for thread 0 */
-  tmp2 = my_malloc(ebsize);                /* tmp2 for thread 0 */
+  error = write_compression_header(&ctx->context, ctx->clevel, ctx->doshuffle);
+  if (error < 0) { return error; }
 
-  version += 0;                             /* shut up compiler warning */
-  versionlz += 0;                           /* shut up compiler warning */
-  ctbytes += 0;                             /* shut up compiler warning */
+  return (int)blosc_compress_context(&ctx->context);
+}
+
+/* Decompress with a reusable context.  See blosc.h for docstrings. */
+int blosc_decompress_with_ctx(struct blosc_ctx* ctx, const void* src,
+                              void* dest, size_t destsize)
+{
+  return (int)blosc_run_decompression_with_context(&ctx->context, src, dest,
+                                                   int_destsize(destsize),
+                                                   ctx->numthreads);
+}
+
+/* Change the allocator of a reusable context.  See blosc.h for
+   docstrings. */
+int blosc_ctx_set_allocator(struct blosc_ctx* ctx, blosc_alloc_fn alloc_fn,
+                            blosc_free_fn free_fn, void* allocator_data)
+{
+  struct blosc_allocator allocator;
+  struct thread_context* scratch;
+
+  if ((alloc_fn == NULL) != (free_fn == NULL)) {
+    fprintf(stderr, "Error.  Both alloc and free functions must be given\n");
+    return -1;
+  }
+  allocator.alloc = alloc_fn;
+  allocator.free = free_fn;
+  allocator.data = allocator_data;
+  scratch = new_thread_context(NULL, 0, &allocator);
+  if (scratch == NULL) {
+    return -1;
+  }
+
+  /* The working space from the previous allocator goes away */
+  blosc_release_threadpool(&ctx->context);
+  free_thread_context(ctx->context.scratch);
+  ctx->context.scratch = scratch;
+  ctx->context.allocator = allocator;
+  return 0;
+}
+
+/* Release a reusable context.  See blosc.h for docstrings. */
+void blosc_free_ctx(struct blosc_ctx* ctx)
+{
+  struct blosc_allocator allocator;
+
+  if (ctx == NULL) {
+    return;
+  }
+  blosc_release_threadpool(&ctx->context);
+  free_thread_context(ctx->context.scratch);
+  allocator = ctx->allocator;
+  my_free(&allocator, ctx);
+}
+
+
+/* Grow the chunk storage of `schunk` to at least `size` bytes */
+static int schunk_grow_data(struct blosc_schunk* schunk, int64_t size)
+{
+  int64_t capacity = schunk->data_capacity;
+  uint8_t* data;
+
+  if (size <= capacity) {
+    return 0;
+  }
+  if (capacity < SCHUNK_MIN_CAPACITY) {
+    capacity = SCHUNK_MIN_CAPACITY;
+  }
+  while (capacity < size) {
+    capacity *= 2;
+  }
+  data = my_malloc(&schunk->allocator, (size_t)capacity);
+  if (data == NULL) {
+    return -1;
+  }
+  if (schunk->data_size > 0) {
+    memcpy(data, schunk->data, (size_t)schunk->data_size);
+  }
+  my_free(&schunk->allocator, schunk->data);
+  schunk->data = data;
+  schunk->data_capacity = capacity;
+  return 0;
+}
+
+/* Make room in the offset index of `schunk` for one more chunk */
+static int schunk_grow_index(struct blosc_schunk* schunk)
+{
+  int64_t capacity = schunk->offsets_capacity;
+  int64_t* offsets;
+
+  if (schunk->nchunks < capacity) {
+    return 0;
+  }
+  capacity = (capacity == 0) ? 256 : capacity * 2;
+  offsets = (int64_t*)my_malloc(&schunk->allocator,
+                                (size_t)capacity * sizeof(int64_t));
+  if (offsets == NULL) {
+    return -1;
+  }
+  if (schunk->nchunks > 0) {
+    memcpy(offsets, schunk->offsets, (size_t)schunk->nchunks * sizeof(int64_t));
+  }
+  my_free(&schunk->allocator, schunk->offsets);
+  schunk->offsets = offsets;
+  schunk->offsets_capacity = capacity;
+  return 0;
+}
+
+/* Create a super-chunk.  See blosc.h for docstrings. */
+struct blosc_schunk* blosc_schunk_new(const char* compressor, int clevel,
+                                      int doshuffle, size_t typesize,
+                                      size_t blocksize, int numinternalthreads)
+{
+  struct blosc_schunk* schunk;
+
+  schunk = (struct blosc_schunk*)my_malloc(&g_allocator,
+                                           sizeof(struct blosc_schunk));
+  if (schunk == NULL) {
+    return NULL;
+  }
+  schunk->allocator = g_allocator;
+  schunk->ctx = blosc_create_ctx(compressor, clevel, doshuffle, typesize,
+                                 blocksize, numinternalthreads);
+  if (schunk->ctx == NULL) {
+    my_free(&schunk->allocator, schunk);
+    return NULL;
+  }
+  schunk->data = NULL;
+  schunk->data_size = 0;
+  schunk->data_capacity = 0;
+  schunk->offsets = NULL;
+  schunk->offsets_capacity = 0;
+  schunk->nchunks = 0;
+  schunk->nbytes = 0;
+  return schunk;
+}
+
+/* Release a super-chunk.  See blosc.h for docstrings. */
+void blosc_schunk_free(struct blosc_schunk* schunk)
+{
+  struct blosc_allocator allocator;
+
+  if (schunk == NULL) {
+    return;
+  }
+  blosc_free_ctx(schunk->ctx);
+  allocator = schunk->allocator;
+  my_free(&allocator, schunk->data);
+  my_free(&allocator, schunk->offsets);
+  my_free(&allocator, schunk);
+}
+
+/* Compress a chunk at the end of a super-chunk.  See blosc.h for
+   docstrings. */
+int64_t blosc_schunk_append(struct blosc_schunk* schunk, const void* src,
+                            size_t nbytes)
+{
+  int cbytes;
+
+  if (nbytes > BLOSC_MAX_BUFFERSIZE) {
+    fprintf(stderr, "Chunks cannot exceed %d bytes\n", BLOSC_MAX_BUFFERSIZE);
+    return -1;
+  }
+  /* Compress right at the end of the storage */
+  if (schunk_grow_index(schunk) < 0 ||
+      schunk_grow_data(schunk, schunk->data_size + (int64_t)nbytes +
+                       BLOSC_MAX_OVERHEAD) < 0) {
+    return -1;
+  }
+  cbytes = blosc_compress_with_ctx(schunk->ctx, nbytes, src,
+                                   schunk->data + schunk->data_size,
+                                   nbytes + BLOSC_MAX_OVERHEAD);
+  if (cbytes <= 0) {
+    return -1;
+  }
+  schunk->offsets[schunk->nchunks] = schunk->data_size;
+  schunk->data_size += cbytes;
+  schunk->nbytes += nbytes;
+  return schunk->nchunks++;
+}
+
+/* Number of chunks in a super-chunk.  See blosc.h for docstrings. */
+int64_t blosc_schunk_nchunks(const struct blosc_schunk* schunk)
+{
+  return schunk->nchunks;
+}
+
+/* Sizes of a super-chunk.  See blosc.h for docstrings. */
+void blosc_schunk_sizes(const struct blosc_schunk* schunk, int64_t* nbytes,
+                        int64_t* cbytes)
+{
+  *nbytes = schunk->nbytes;
+  *cbytes = schunk->data_size;
+}
+
+/* Get a compressed chunk of a super-chunk.  See blosc.h for docstrings. */
+int blosc_schunk_get_chunk(const struct blosc_schunk* schunk, int64_t nchunk,
+                           const void** chunk, size_t* cbytes)
+{
+  int64_t next;
+
+  if (nchunk < 0 || nchunk >= schunk->nchunks) {
+    fprintf(stderr, "Chunk %lld out of bounds\n", (long long)nchunk);
+    return -1;
+  }
+  next = (nchunk + 1 < schunk->nchunks) ? schunk->offsets[nchunk + 1]
+                                        : schunk->data_size;
+  *chunk = schunk->data + schunk->offsets[nchunk];
+  *cbytes = (size_t)(next - schunk->offsets[nchunk]);
+  return 0;
+}
+
+/* Decompress a chunk of a super-chunk.  See blosc.h for docstrings. */
+int blosc_schunk_decompress_chunk(struct blosc_schunk* schunk, int64_t nchunk,
+                                  void* dest, size_t destsize)
+{
+  const void* chunk;
+  size_t cbytes;
+
+  if (blosc_schunk_get_chunk(schunk, nchunk, &chunk, &cbytes) < 0) {
+    return -1;
+  }
+  return blosc_decompress_with_ctx(schunk->ctx, chunk, dest, destsize);
+}
+
+/* Compress the offset index of `schunk` (as little-endian int64) into
+   a new block in `*index`.  Returns the size of the compressed index,
+   or a negative value on errors. */
+static int schunk_pack_index(struct blosc_schunk* schunk, uint8_t** index)
+{
+  size_t size = (size_t)schunk->nchunks * sizeof(int64_t);
+  uint8_t* offsets;
+  int64_t j;
+  int cbytes;
+
+  *index = NULL;
+  if (size > BLOSC_MAX_BUFFERSIZE) {
+    fprintf(stderr, "Too many chunks for the index\n");
+    return -1;
+  }
+  offsets = my_malloc(&schunk->allocator, size + 1);
+  *index = my_malloc(&schunk->allocator, size + BLOSC_MAX_OVERHEAD);
+  if (offsets == NULL || *index == NULL) {
+    my_free(&schunk->allocator, offsets);
+    my_free(&schunk->allocator, *index);
+    *index = NULL;
+    return -1;
+  }
+  for (j = 0; j < schunk->nchunks; j++) {
+    _sw64(offsets + j * 8, schunk->offsets[j]);
+  }
+  /* Offsets grow slowly, so shuffling them leaves long runs of zeros */
+  cbytes = blosc_compress_ctx(5, 1, sizeof(int64_t), size, offsets, *index,
+                              size + BLOSC_MAX_OVERHEAD, "blosclz", 0, 1);
+  my_free(&schunk->allocator, offsets);
+  if (cbytes <= 0) {
+    my_free(&schunk->allocator, *index);
+    *index = NULL;
+    return -1;
+  }
+  return cbytes;
+}
+
+/* Write the header of the serialized `schunk`, whose index takes
+   `index_size` bytes, into `header` */
+static void schunk_write_header(const struct blosc_schunk* schunk,
+                                uint8_t* header, int32_t index_size)
+{
+  struct blosc_ctx* ctx = schunk->ctx;
+
+  memset(header, 0, SCHUNK_HEADER_LENGTH);
+  memcpy(header, SCHUNK_MAGIC, 8);
+  header[8] = SCHUNK_VERSION_FORMAT;
+  header[9] = (uint8_t)ctx->compcode;
+  header[10] = (uint8_t)ctx->clevel;
+  header[11] = (uint8_t)ctx->doshuffle;
+  _sw32(header + 12, (int32_t)ctx->typesize);
+  _sw32(header + 16, (int32_t)ctx->blocksize);
+  _sw32(header + 20, index_size);
+  _sw64(header + 24, schunk->nchunks);
+  _sw64(header + 32, schunk->nbytes);
+  _sw64(header + 40, schunk->data_size);
+}
+
+/* Serialize a super-chunk into a buffer.  See blosc.h for docstrings. */
+int64_t blosc_schunk_serialize(struct blosc_schunk* schunk, void* dest,
+                               size_t destsize)
+{
+  uint8_t* _dest = (uint8_t*)dest;
+  uint8_t* index;
+  int64_t total;
+  int index_size;
+
+  if (dest == NULL) {
+    /* An upper bound */
+    return SCHUNK_HEADER_LENGTH + schunk->data_size +
+      schunk->nchunks * (int64_t)sizeof(int64_t) + BLOSC_MAX_OVERHEAD;
+  }
+  index_size = schunk_pack_index(schunk, &index);
+  if (index_size < 0) {
+    return -1;
+  }
+  total = SCHUNK_HEADER_LENGTH + schunk->data_size + index_size;
+  if ((uint64_t)total > (uint64_t)destsize) {
+    my_free(&schunk->allocator, index);
+    return 0;
+  }
+  schunk_write_header(schunk, _dest, index_size);
+  if (schunk->data_size > 0) {
+    memcpy(_dest + SCHUNK_HEADER_LENGTH, schunk->data, (size_t)schunk->data_size);
+  }
+  memcpy(_dest + SCHUNK_HEADER_LENGTH + schunk->data_size, index, index_size);
+  my_free(&schunk->allocator, index);
+  return total;
+}
+
+/* Rebuild a super-chunk out of a serialized one.  See blosc.h for
+   docstrings. */
+struct blosc_schunk* blosc_schunk_from_buffer(const void* buffer, size_t size,
+                                              int numinternalthreads)
+{
+  const uint8_t* _buffer = (const uint8_t*)buffer;
+  struct blosc_schunk* schunk;
+  char* compname;
+  int64_t nchunks, data_size, j;
+  int32_t index_size;
+  size_t index_nbytes, index_cbytes, index_blocksize;
+  size_t chunk_nbytes, chunk_cbytes, chunk_blocksize;
+  const uint8_t* index;
+  const uint8_t* chunk;
+  int64_t room;
+  uint8_t* offsets;
+
+  if (size < SCHUNK_HEADER_LENGTH || memcmp(_buffer, SCHUNK_MAGIC, 8) != 0 ||
+      _buffer[8] != SCHUNK_VERSION_FORMAT) {
+    fprintf(stderr, "Not a serialized super-chunk\n");
+    return NULL;
+  }
+  index_size = sw32_(_buffer + 20);
+  nchunks = sw64_(_buffer + 24);
+  data_size = sw64_(_buffer + 40);
+  if (nchunks < 0 || data_size < 0 || (uint64_t)data_size > (uint64_t)size ||
+      index_size < BLOSC_MIN_HEADER_LENGTH ||
+      nchunks > BLOSC_MAX_BUFFERSIZE / (int64_t)sizeof(int64_t) ||
+      (uint64_t)(SCHUNK_HEADER_LENGTH + data_size + index_size) > (uint64_t)size) {
+    fprintf(stderr, "Serialized super-chunk is truncated or damaged\n");
+    return NULL;
+  }
+  if (blosc_compcode_to_compname(_buffer[9], &compname) < 0) {
+    return NULL;
+  }
+  schunk = blosc_schunk_new(compname, _buffer[10], _buffer[11],
+                            (size_t)sw32_(_buffer + 12),
+                            (size_t)sw32_(_buffer + 16), numinternalthreads);
+  if (schunk == NULL) {
+    return NULL;
+  }
+
+  /* Take over the chunks and unpack the offset index */
+  offsets = my_malloc(&schunk->allocator,
+                      (size_t)nchunks * sizeof(int64_t) + 1);
+  if (offsets == NULL || schunk_grow_data(schunk, data_size) < 0) {
+    my_free(&schunk->allocator, offsets);
+    blosc_schunk_free(schunk);
+    return NULL;
+  }
+  memcpy(schunk->data, _buffer + SCHUNK_HEADER_LENGTH, (size_t)data_size);
+  schunk->data_size = data_size;
+  /* The header of the index is trusted by the decompressor, so it must
+     fit in the bytes left and describe exactly `nchunks` offsets.  The
+     index is always written with the 32-bit header. */
+  index = _buffer + SCHUNK_HEADER_LENGTH + data_size;
+  blosc_cbuffer_sizes(index, &index_nbytes, &index_cbytes, &index_blocksize);
+  if (index[0] == BLOSC_VERSION_FORMAT64 ||
+      index_cbytes < BLOSC_MIN_HEADER_LENGTH ||
+      index_cbytes > (size_t)index_size ||
+      index_nbytes != (size_t)nchunks * sizeof(int64_t) ||
+      blosc_decompress_ctx(index, offsets, (size_t)nchunks * sizeof(int64_t), 1) !=
+      (int)(nchunks * sizeof(int64_t))) {
+    fprintf(stderr, "Serialized super-chunk is truncated or damaged\n");
+    my_free(&schunk->allocator, offsets);
+    blosc_schunk_free(schunk);
+    return NULL;
+  }
+  for (j = 0; j < nchunks; j++) {
+    if (schunk_grow_index(schunk) < 0) {
+      my_free(&schunk->allocator, offsets);
+      blosc_schunk_free(schunk);
+      return NULL;
+    }
+    schunk->offsets[j] = sw64_(offsets + j * 8);
+    if (schunk->offsets[j] < (j > 0 ? schunk->offsets[j - 1] : 0) ||
+        schunk->offsets[j] + BLOSC_MIN_HEADER_LENGTH > data_size) {
+      fprintf(stderr, "Serialized super-chunk is truncated or damaged\n");
+      my_free(&schunk->allocator, offsets);
+      blosc_schunk_free(schunk);
+      return NULL;
+    }
+    schunk->nchunks++;
+  }
+  my_free(&schunk->allocator, offsets);
+
+  /* The decompressor trusts the header of every chunk too, so each one
+     must fit in the room up to the next chunk */
+  for (j = 0; j < nchunks; j++) {
+    chunk = schunk->data + schunk->offsets[j];
+    room = ((j + 1 < nchunks) ? schunk->offsets[j + 1] : data_size) -
+      schunk->offsets[j];
+    if (chunk[0] == BLOSC_VERSION_FORMAT64 && room < BLOSC_HEADER64_LENGTH) {
+      chunk_cbytes = 0;
+    }
+    else {
+      blosc_cbuffer_sizes(chunk, &chunk_nbytes, &chunk_cbytes, &chunk_blocksize);
+    }
+    if (chunk_cbytes < BLOSC_MIN_HEADER_LENGTH || chunk_cbytes > (size_t)room) {
+      fprintf(stderr, "Serialized super-chunk is truncated or damaged\n");
+      blosc_schunk_free(schunk);
+      return NULL;
+    }
+  }
+  schunk->nbytes = sw64_(_buffer + 32);
+  return schunk;
+}
+
+/* Write a super-chunk to a file.  See blosc.h for docstrings. */
+int blosc_schunk_save(struct blosc_schunk* schunk, const char* filename)
+{
+  uint8_t header[SCHUNK_HEADER_LENGTH];
+  uint8_t* index;
+  int index_size;
+  FILE* file;
+  int rc = 0;
+
+  index_size = schunk_pack_index(schunk, &index);
+  if (index_size < 0) {
+    return -1;
+  }
+  file = fopen(filename, "wb");
+  if (file == NULL) {
+    fprintf(stderr, "Cannot open '%s' for writing\n", filename);
+    my_free(&schunk->allocator, index);
+    return -1;
+  }
+  schunk_write_header(schunk, header, index_size);
+  if (fwrite(header, 1, SCHUNK_HEADER_LENGTH, file) != SCHUNK_HEADER_LENGTH ||
+      fwrite(schunk->data, 1, (size_t)schunk->data_size, file) !=
+      (size_t)schunk->data_size ||
+      fwrite(index, 1, index_size, file) != (size_t)index_size) {
+    fprintf(stderr, "Cannot write to '%s'\n", filename);
+    rc = -1;
+  }
+  if (fclose(file) != 0) {
+    rc = -1;
+  }
+  my_free(&schunk->allocator, index);
+  return rc;
+}
+
+/* Read a super-chunk from a file.  See blosc.h for docstrings. */
+struct blosc_schunk* blosc_schunk_load(const char* filename,
+                                       int numinternalthreads)
+{
+  struct blosc_schunk* schunk = NULL;
+  uint8_t* buffer;
+  long size;
+  FILE* file;
+
+  file = fopen(filename, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Cannot open '%s' for reading\n", filename);
+    return NULL;
+  }
+  if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 ||
+      fseek(file, 0, SEEK_SET) != 0) {
+    fclose(file);
+    return NULL;
+  }
+  buffer = my_malloc(&g_allocator, (size_t)size + 1);
+  if (buffer != NULL) {
+    if (fread(buffer, 1, (size_t)size, file) == (size_t)size) {
+      schunk = blosc_schunk_from_buffer(buffer, (size_t)size, numinternalthreads);
+    }
+    my_free(&g_allocator, buffer);
+  }
+  fclose(file);
+  return schunk;
+}
+
+
+/* Release a compression stream.  See blosc.h for docstrings. */
+void blosc_stream_free(struct blosc_stream* stream)
+{
+  struct blosc_allocator allocator;
+
+  if (stream == NULL) {
+    return;
+  }
+  blosc_free_ctx(stream->ctx);
+  allocator = stream->allocator;
+  my_free(&allocator, stream->pending);
+  my_free(&allocator, stream->out);
+  my_free(&allocator, stream->bstarts);
+  my_free(&allocator, stream->checksums);
+  my_free(&allocator, stream);
+}
+
+/* Create a compression stream.  See blosc.h for docstrings. */
+struct blosc_stream* blosc_stream_new(const char* compressor, int clevel,
+                                      int doshuffle, size_t typesize,
+                                      size_t blocksize, int numinternalthreads,
+                                      size_t maxbytes, blosc_stream_write_fn write,
+                                      void* user_data)
+{
+  struct blosc_stream* stream;
+  struct blosc_context* context;
+  int64_t ebsize;
+  int header64 = (maxbytes > BLOSC_MAX_BUFFERSIZE);
+
+  if (write == NULL) {
+    fprintf(stderr, "A write function is needed\n");
+    return NULL;
+  }
+  if (blocksize > BLOSC_MAX_BUFFERSIZE) {
+    fprintf(stderr, "Blocksize cannot exceed %d bytes\n", BLOSC_MAX_BUFFERSIZE);
+    return NULL;
+  }
+  stream = (struct blosc_stream*)my_malloc(&g_allocator,
+                                           sizeof(struct blosc_stream));
+  if (stream == NULL) {
+    return NULL;
+  }
+  memset(stream, 0, sizeof(struct blosc_stream));
+  stream->allocator = g_allocator;
+  stream->write = write;
+  stream->user_data = user_data;
+  stream->maxbytes = (int64_t)maxbytes;
+  stream->ctx = blosc_create_ctx(compressor, clevel, doshuffle, typesize,
+                                 blocksize, numinternalthreads);
+  if (stream->ctx == NULL) {
+    blosc_stream_free(stream);
+    return NULL;
+  }
+
+  /* Work out the blocksize and the header as if the whole stream was
+     one buffer of `maxbytes` */
+  context = &stream->ctx->context;
+  if (initialize_context_compression(context, clevel, doshuffle, typesize,
+                                     maxbytes, NULL, stream->header,
+                                     BLOSC_HEADER64_LENGTH, stream->ctx->compcode,
+                                     (int32_t)blocksize, numinternalthreads,
+                                     header64) < 0 ||
+      write_compression_header(context, clevel, doshuffle) < 0) {
+    blosc_stream_free(stream);
+    return NULL;
+  }
+  stream->memcpyed = (clevel == 0);
+  if (!stream->memcpyed) {
+    /* Whatever the size of the stream, blocks are compressed */
+    stream->header[2] &= ~BLOSC_MEMCPYED;
+    if (context->checksummed) {
+      stream->header[2] |= BLOSC_DOCHECKSUM;
+    }
+  }
+  stream->header_len = header_length(context);
+  stream->blocksize = context->blocksize;
+  stream->max_blocks = context->nblocks;
+  stream->data_start = stream->header_len +
+    stream->max_blocks * bstart_size(context);
+  if (stream->memcpyed) {
+    return stream;
+  }
+  if (stream->header[2] & BLOSC_DOCHECKSUM) {
+    stream->data_start += stream->max_blocks * CHECKSUM_SIZE;
+    stream->checksums = my_malloc(&stream->allocator,
+                                  (size_t)(stream->max_blocks + 1) * CHECKSUM_SIZE);
+    if (stream->checksums == NULL) {
+      blosc_stream_free(stream);
+      return NULL;
+    }
+  }
+
+  /* Room for a group of blocks, before and after compression.  Groups
+     are compressed as a single buffer, so they must fit in one. */
+  stream->group_blocks = numinternalthreads;
+  if ((int64_t)stream->group_blocks * stream->blocksize > BLOSC_MAX_BUFFERSIZE) {
+    stream->group_blocks = BLOSC_MAX_BUFFERSIZE / stream->blocksize;
+  }
+  ebsize = (int64_t)stream->blocksize + context->typesize * (int32_t)sizeof(int32_t);
+  stream->out_size = BLOSC_MAX_OVERHEAD +
+    (int64_t)stream->group_blocks * (sizeof(int32_t) + CHECKSUM_SIZE + ebsize);
+  stream->pending = my_malloc(&stream->allocator,
+                              (size_t)stream->group_blocks * stream->blocksize);
+  stream->out = my_malloc(&stream->allocator, (size_t)stream->out_size);
+  stream->bstarts = (int64_t*)my_malloc(&stream->allocator,
+                                        (size_t)(stream->max_blocks + 1) *
+                                        sizeof(int64_t));
+  if (stream->pending == NULL || stream->out == NULL || stream->bstarts == NULL) {
+    blosc_stream_free(stream);
+    return NULL;
+  }
+  return stream;
+}
+
+/* Compress the `nbytes` of `src` (whole blocks, except at the end of
+   the stream) as a group, and write their blocks out */
+static int stream_compress_group(struct blosc_stream* stream,
+                                 const uint8_t* src, int32_t nbytes)
+{
+  struct blosc_ctx* ctx = stream->ctx;
+  struct blosc_context* context = &ctx->context;
+  int64_t ntbytes, first;
+  int32_t j;
+
+  if (initialize_context_compression(context, ctx->clevel, ctx->doshuffle,
+                                     ctx->typesize, nbytes, src, stream->out,
+                                     (size_t)stream->out_size, ctx->compcode,
+                                     stream->blocksize, ctx->numthreads, 0) < 0) {
+    return -1;
+  }
+  /* Blocks must be cut as in the whole stream */
+  context->blocksize = stream->blocksize;
+  context->leftover = nbytes % stream->blocksize;
+  context->nblocks = nbytes / stream->blocksize + (context->leftover > 0);
+  if (write_compression_header(context, ctx->clevel, ctx->doshuffle) < 0) {
+    return -1;
+  }
+  *(context->header_flags) &= ~BLOSC_MEMCPYED;
+  set_checksums(context, stream->checksums != NULL);
+
+  ntbytes = do_job(context);
+  if (ntbytes <= 0) {
+    return -1;
+  }
+
+  /* The blocks lie together past the block starts, whatever their order */
+  first = header_length(context) + index_length(context);
+  for (j = 0; j < context->nblocks; j++) {
+    stream->bstarts[stream->nblocks + j] = stream->data_start + stream->cbytes +
+      get_bstart(context, j) - first;
+  }
+  if (stream->write(stream->out + first, (size_t)(ntbytes - first),
+                    stream->data_start + stream->cbytes, stream->user_data) < 0) {
+    return -1;
+  }
+  if (stream->checksums != NULL) {
+    memcpy(stream->checksums + stream->nblocks * CHECKSUM_SIZE,
+           context->checksums, (size_t)context->nblocks * CHECKSUM_SIZE);
+  }
+  stream->nblocks += context->nblocks;
+  stream->cbytes += ntbytes - first;
+  return 0;
+}
+
+/* Push bytes into a compression stream.  See blosc.h for docstrings. */
+int blosc_stream_write(struct blosc_stream* stream, const void* src,
+                       size_t nbytes)
+{
+  const uint8_t* _src = (const uint8_t*)src;
+  /* Fits, as groups are not larger than BLOSC_MAX_BUFFERSIZE */
+  int32_t group_size = stream->group_blocks * stream->blocksize;
+  int32_t chunk;
+
+  if (stream->error || stream->finished) {
+    return -1;
+  }
+  if ((uint64_t)nbytes > (uint64_t)(stream->maxbytes - stream->nbytes)) {
+    fprintf(stderr, "Stream cannot exceed %lld bytes\n",
+            (long long)stream->maxbytes);
+    stream->error = 1;
+    return -1;
+  }
+
+  if (stream->memcpyed) {
+    /* Data goes straight after the header */
+    if (nbytes > 0 &&
+        stream->write(src, nbytes, stream->header_len + stream->nbytes,
+                      stream->user_data) < 0) {
+      stream->error = 1;
+      return -1;
+    }
+    stream->nbytes += nbytes;
+    return 0;
+  }
+
+  stream->nbytes += nbytes;
+  while (nbytes > 0) {
+    if (stream->pending_size == 0 && nbytes >= (size_t)group_size) {
+      /* No need to gather whole groups */
+      chunk = group_size;
+      if (stream_compress_group(stream, _src, chunk) < 0) {
+        stream->error = 1;
+        return -1;
+      }
+    }
+    else {
+      chunk = group_size - stream->pending_size;
+      if ((size_t)chunk > nbytes) {
+        chunk = (int32_t)nbytes;
+      }
+      memcpy(stream->pending + stream->pending_size, _src, chunk);
+      stream->pending_size += chunk;
+      if (stream->pending_size == group_size) {
+        stream->pending_size = 0;
+        if (stream_compress_group(stream, stream->pending, group_size) < 0) {
+          stream->error = 1;
+          return -1;
+        }
+      }
+    }
+    _src += chunk;
+    nbytes -= chunk;
+  }
+  return 0;
+}
+
+/* Finish a compression stream.  See blosc.h for docstrings. */
+int64_t blosc_stream_finish(struct blosc_stream* stream)
+{
+  uint8_t* front;
+  int64_t front_size, j;
+  int header64 = (stream->header[0] == BLOSC_VERSION_FORMAT64);
+  int32_t bsize = header64 ? (int32_t)sizeof(int64_t) : (int32_t)sizeof(int32_t);
+  int64_t total;
+
+  if (stream->error || stream->finished) {
+    return -1;
+  }
+  stream->finished = 1;
+  if (stream->pending_size > 0 &&
+      stream_compress_group(stream, stream->pending, stream->pending_size) < 0) {
+    stream->error = 1;
+    return -1;
+  }
+
+  /* The header and the block starts (room for unused ones included) */
+  front_size = stream->memcpyed ? stream->header_len : stream->data_start;
+  total = stream->memcpyed ? stream->header_len + stream->nbytes
+                           : stream->data_start + stream->cbytes;
+  if (!header64 && total > INT32_MAX) {
+    fprintf(stderr, "Compressed stream does not fit in %lld bytes\n",
+            (long long)stream->maxbytes);
+    stream->error = 1;
+    return -1;
+  }
+  front = my_malloc(&stream->allocator, (size_t)front_size);
+  if (front == NULL) {
+    stream->error = 1;
+    return -1;
+  }
+  memset(front, 0, (size_t)front_size);
+  memcpy(front, stream->header, stream->header_len);
+  if (header64) {
+    _sw64(front + 8, stream->nbytes);
+    _sw64(front + 16, total);
+  }
+  else {
+    _sw32(front + 4, (int32_t)stream->nbytes);
+    _sw32(front + 12, (int32_t)total);
+  }
+  for (j = 0; !stream->memcpyed && j < stream->nblocks; j++) {
+    if (header64) {
+      _sw64(front + stream->header_len + j * bsize, stream->bstarts[j]);
+    }
+    else {
+      _sw32(front + stream->header_len + j * bsize, (int32_t)stream->bstarts[j]);
+    }
+  }
+  if (stream->checksums != NULL) {
+    /* Checksums go right past the block starts in use */
+    memcpy(front + stream->header_len + stream->nblocks * bsize,
+           stream->checksums, (size_t)stream->nblocks * CHECKSUM_SIZE);
+  }
+  if (stream->write(front, (size_t)front_size, 0, stream->user_data) < 0) {
+    stream->error = 1;
+    total = -1;
+  }
+  my_free(&stream->allocator, front);
+  return total;
+}
+
+
+/* Release a decoder.  See blosc.h for docstrings. */
+void blosc_decoder_free(struct blosc_decoder* decoder)
+{
+  struct blosc_allocator allocator;
+
+  if (decoder == NULL) {
+    return;
+  }
+  blosc_release_threadpool(&decoder->context);
+  free_thread_context(decoder->context.scratch);
+  allocator = decoder->allocator;
+  scratch_free(&allocator, decoder->window);
+  my_free(&allocator, decoder);
+}
+
+/* Create a decoder.  See blosc.h for docstrings. */
+struct blosc_decoder* blosc_decoder_new(const void* src, int numinternalthreads)
+{
+  struct blosc_decoder* decoder;
+  struct blosc_context* context;
+
+  if (numinternalthreads <= 0 || numinternalthreads > BLOSC_MAX_THREADS) {
+    fprintf(stderr, "Error.  nthreads must be between 1 and %d\n",
+            BLOSC_MAX_THREADS);
+    return NULL;
+  }
+  decoder = (struct blosc_decoder*)my_malloc(&g_allocator,
+                                             sizeof(struct blosc_decoder));
+  if (decoder == NULL) {
+    return NULL;
+  }
+  decoder->allocator = g_allocator;
+  decoder->window = NULL;
+  context = &decoder->context;
+  context->pool = NULL;
+  context->allocator = g_allocator;
+  context->scratch = new_thread_context(NULL, 0, &context->allocator);
+  if (context->scratch == NULL) {
+    my_free(&decoder->allocator, decoder);
+    return NULL;
+  }
+
+  /* Read the header (blocks go to the window, not to a destination) */
+  if (read_decompression_header(context, src, numinternalthreads) < 0) {
+    fprintf(stderr, "Error.  Wrong header of the compressed buffer\n");
+    blosc_decoder_free(decoder);
+    return NULL;
+  }
+  decoder->src = (const uint8_t*)src;
+  decoder->numthreads = numinternalthreads;
+  decoder->header_len = header_length(context);
+  decoder->blocksize = context->blocksize;
+  decoder->nblocks = context->nblocks;
+  decoder->leftover = context->leftover;
+  decoder->nbytes = context->sourcesize;
+  decoder->window_first = 0;
+  decoder->window_count = 0;
+  decoder->next_block = 0;
+
+  /* Blocks of memcpy'ed buffers are handed out right from `src` */
+  decoder->window_blocks = numinternalthreads;
+  if (decoder->window_blocks > decoder->nblocks) {
+    decoder->window_blocks = decoder->nblocks;
+  }
+  if (!(*(context->header_flags) & BLOSC_MEMCPYED) && decoder->nblocks > 0) {
+    decoder->window = scratch_malloc(&decoder->allocator,
+                                     (size_t)decoder->window_blocks *
+                                     decoder->blocksize);
+    if (decoder->window == NULL) {
+      blosc_decoder_free(decoder);
+      return NULL;
+    }
+  }
+  return decoder;
+}
+
+/* Decompress the blocks of `decoder` from `first` on into its window */
+static int decoder_fill_window(struct blosc_decoder* decoder, int32_t first)
+{
+  struct blosc_context* context = &decoder->context;
+  int32_t count = decoder->nblocks - first;
+  int64_t ntbytes;
+
+  if (count > decoder->window_blocks) {
+    count = decoder->window_blocks;
+  }
+  /* Make the blocks of the window look like a buffer of their own */
+  if (read_decompression_header(context, decoder->src, decoder->numthreads) < 0) {
+    return -1;
+  }
+  context->dest = decoder->window;
+  context->destsize = (int64_t)count * decoder->blocksize;
+  context->bstarts += (int64_t)first * bstart_size(context);
+  if (context->checksums != NULL) {
+    context->checksums += (int64_t)first * CHECKSUM_SIZE;
+  }
+  context->nblocks = count;
+  if (first + count == decoder->nblocks && decoder->leftover > 0) {
+    context->leftover = decoder->leftover;
+    context->sourcesize = (int64_t)(count - 1) * decoder->blocksize +
+      decoder->leftover;
+  }
+  else {
+    context->leftover = 0;
+    context->sourcesize = (int64_t)count * decoder->blocksize;
+  }
+
+  ntbytes = do_job(context);
+  if (ntbytes != context->sourcesize) {
+    return -1;
+  }
+  decoder->window_first = first;
+  decoder->window_count = count;
+  return 0;
+}
+
+/* Get the next block out of a decoder.  See blosc.h for docstrings. */
+int blosc_decoder_next(struct blosc_decoder* decoder, const void** block)
+{
+  int32_t nblock = decoder->next_block;
+  int32_t bsize;
+
+  if (nblock >= decoder->nblocks) {
+    return 0;
+  }
+  bsize = decoder->blocksize;
+  if (nblock == decoder->nblocks - 1 && decoder->leftover > 0) {
+    bsize = decoder->leftover;
+  }
+  if (decoder->window == NULL) {
+    /* memcpy'ed buffer */
+    *block = decoder->src + decoder->header_len + (int64_t)nblock * decoder->blocksize;
+  }
+  else {
+    if ((nblock < decoder->window_first ||
+         nblock >= decoder->window_first + decoder->window_count) &&
+        decoder_fill_window(decoder, nblock) < 0) {
+      return -1;
+    }
+    *block = decoder->window +
+      (int64_t)(nblock - decoder->window_first) * decoder->blocksize;
+  }
+  decoder->next_block++;
+  return bsize;
+}
+
+/* Rewind a decoder.  See blosc.h for docstrings. */
+void blosc_decoder_rewind(struct blosc_decoder* decoder)
+{
+  decoder->next_block = 0;
+}
+
+
+/* Release a reader.  See blosc.h for docstrings. */
+void blosc_reader_free(struct blosc_reader* reader)
+{
+  struct blosc_allocator allocator;
+
+  if (reader == NULL) {
+    return;
+  }
+  blosc_release_threadpool(&reader->context);
+  free_thread_context(reader->context.scratch);
+  allocator = reader->allocator;
+  my_free(&allocator, reader->offsets);
+  my_free(&allocator, reader);
+}
+
+/* Create a reader.  See blosc.h for docstrings. */
+struct blosc_reader* blosc_reader_new(const void* region, size_t size,
+                                      const int64_t* offsets, int64_t nchunks,
+                                      int numinternalthreads)
+{
+  struct blosc_reader* reader;
+  struct blosc_context* context;
+
+  if (numinternalthreads <= 0 || numinternalthreads > BLOSC_MAX_THREADS) {
+    fprintf(stderr, "Error.  nthreads must be between 1 and %d\n",
+            BLOSC_MAX_THREADS);
+    return NULL;
+  }
+  if (nchunks < 0 || (size_t)nchunks > SIZE_MAX / sizeof(int64_t)) {
+    fprintf(stderr, "Error.  Wrong number of chunks: %lld\n", (long long)nchunks);
+    return NULL;
+  }
+  reader = (struct blosc_reader*)my_malloc(&g_allocator,
+                                           sizeof(struct blosc_reader));
+  if (reader == NULL) {
+    return NULL;
+  }
+  reader->allocator = g_allocator;
+  reader->offsets = (int64_t*)my_malloc(&reader->allocator,
+                                        ((size_t)nchunks + 1) * sizeof(int64_t));
+  context = &reader->context;
+  context->pool = NULL;
+  context->allocator = g_allocator;
+  context->scratch = new_thread_context(NULL, 0, &context->allocator);
+  if (reader->offsets == NULL || context->scratch == NULL) {
+    free_thread_context(context->scratch);
+    my_free(&reader->allocator, reader->offsets);
+    my_free(&reader->allocator, reader);
+    return NULL;
+  }
+  if (nchunks > 0) {
+    memcpy(reader->offsets, offsets, (size_t)nchunks * sizeof(int64_t));
+  }
+  reader->region = (const uint8_t*)region;
+  reader->size = size;
+  reader->nchunks = nchunks;
+  reader->numthreads = numinternalthreads;
+  return reader;
+}
+
+/* Get chunk `nchunk` of `reader` after checking that its header and
+   compressed bytes lie in the region.  Only its header is read. */
+static const uint8_t* reader_chunk(const struct blosc_reader* reader,
+                                   int64_t nchunk)
+{
+  const uint8_t* chunk;
+  uint64_t avail, cbytes;
+
+  if (nchunk < 0 || nchunk >= reader->nchunks) {
+    fprintf(stderr, "Error.  Chunk %lld is out of the reader\n",
+            (long long)nchunk);
+    return NULL;
+  }
+  if (reader->offsets[nchunk] < 0 ||
+      (uint64_t)reader->offsets[nchunk] > (uint64_t)reader->size) {
+    return NULL;
+  }
+  chunk = reader->region + reader->offsets[nchunk];
+  avail = (uint64_t)reader->size - (uint64_t)reader->offsets[nchunk];
+  if (avail < BLOSC_MIN_HEADER_LENGTH) {
+    return NULL;
+  }
+  if (chunk[0] == BLOSC_VERSION_FORMAT64) {
+    if (avail < BLOSC_HEADER64_LENGTH) {
+      return NULL;
+    }
+    cbytes = (uint64_t)sw64_(chunk + 16);
+  }
+  else {
+    cbytes = (uint64_t)(uint32_t)sw32_(chunk + 12);
+  }
+  if (cbytes > avail) {
+    fprintf(stderr, "Error.  Chunk %lld goes past the end of the region\n",
+            (long long)nchunk);
+    return NULL;
+  }
+  return chunk;
+}
+
+/* Get the uncompressed size of a chunk of a reader.  See blosc.h for
+   docstrings. */
+int64_t blosc_reader_nbytes(struct blosc_reader* reader, int64_t nchunk)
+{
+  const uint8_t* chunk = reader_chunk(reader, nchunk);
+
+  if (chunk == NULL) {
+    return -1;
+  }
+  if (chunk[0] == BLOSC_VERSION_FORMAT64) {
+    return sw64_(chunk + 8);
+  }
+  return sw32_(chunk + 4);
+}
+
+/* Decompress a range of bytes of a chunk of a reader.  See blosc.h for
+   docstrings. */
+int64_t blosc_reader_read(struct blosc_reader* reader, int64_t nchunk,
+                          int64_t start, int64_t nbytes, void* dest)
+{
+  struct blosc_context* context = &reader->context;
+  const uint8_t* chunk = reader_chunk(reader, nchunk);
+  int32_t nblocks, first, last;
+  int64_t cbytes, ntbytes;
+
+  if (chunk == NULL) {
+    return -1;
+  }
+  if (read_decompression_header(context, chunk, reader->numthreads) < 0) {
+    fprintf(stderr, "Error.  Wrong header in chunk %lld\n", (long long)nchunk);
+    return -1;
+  }
+  /* Regions are not checked as a whole, so their chunks may be corrupted */
+  context->untrusted = 1;
+  context->dest = (uint8_t*)dest;
+  if (start < 0 || nbytes < 0 || start > context->sourcesize ||
+      nbytes > context->sourcesize - start) {
+    fprintf(stderr, "Error.  Range [%lld, %lld) is out of the chunk\n",
+            (long long)start, (long long)(start + nbytes));
+    return -1;
+  }
+  if (nbytes == 0) {
+    return 0;
+  }
+
+  /* The block starts (and checksums) must be inside the chunk, past
+   the header.  Memcpy'ed chunks have all their bytes there instead. */
+  cbytes = context->header64 ? sw64_(chunk + 16) : sw32_(chunk + 12);
+  if (*(context->header_flags) & BLOSC_MEMCPYED) {
+    if (context->sourcesize > cbytes - header_length(context)) {
+      fprintf(stderr, "Error.  Chunk %lld is too short\n", (long long)nchunk);
+      return -1;
+    }
+    memcpy(dest, chunk + header_length(context) + start, (size_t)nbytes);
+    return nbytes;
+  }
+  if (index_length(context) > cbytes - header_length(context)) {
+    fprintf(stderr, "Error.  Chunk %lld is too short\n", (long long)nchunk);
+    return -1;
+  }
+
+  /* Make the blocks with bytes in the range look like a buffer of
+     their own, so that the rest of the chunk is never touched */
+  nblocks = context->nblocks;
+  first = (int32_t)(start / context->blocksize);
+  last = (int32_t)((start + nbytes - 1) / context->blocksize);
+  context->bstarts += (int64_t)first * bstart_size(context);
+  if (context->checksums != NULL) {
+    context->checksums += (int64_t)first * CHECKSUM_SIZE;
+  }
+  context->nblocks = last - first + 1;
+  if (last == nblocks - 1 && context->leftover > 0) {
+    context->sourcesize = (int64_t)(context->nblocks - 1) * context->blocksize +
+      context->leftover;
+  }
+  else {
+    context->leftover = 0;
+    context->sourcesize = (int64_t)context->nblocks * context->blocksize;
+  }
+  context->destsize = nbytes;
+  context->range_start = start - (int64_t)first * context->blocksize;
+  context->range_nbytes = nbytes;
+
+  ntbytes = do_job(context);
+  context->range_nbytes = -1;
+  if (ntbytes < 0) {
+    return ntbytes;
+  }
+  return (ntbytes == nbytes) ? nbytes : -1;
+}
+
+
+/* The public routine for decompression.  See blosc.h for docstrings. */
+int blosc_decompress(const void *src, void *dest, size_t destsize)
+{
+  int result;
+  struct blosc_context* context = get_global_context();
+
+  if (context == NULL) {
+    return -1;
+  }
+
+  result = (int)blosc_run_decompression_with_context(context, src, dest,
+                                                     int_destsize(destsize),
+                                                     borrow_global_pool(context));
+
+  /* Give the threads back, so that other calling threads can use them */
+  return_global_pool(context);
+
+  return result;
+}
+
+
+/* The public routine for compression with 64-bit sizes.  See blosc.h
+   for docstrings. */
+int64_t blosc_compress64(int clevel, int doshuffle, size_t typesize,
+                         size_t nbytes, const void *src, void *dest,
+                         size_t destsize)
+{
+  int error;
+  int64_t result;
+  struct blosc_context* context = get_global_context();
+
+  if (context == NULL) {
+    return -1;
+  }
+
+  error = initialize_context_compression(context, clevel, doshuffle, typesize, nbytes,
+                                  src, dest, destsize, g_compressor, g_force_blocksize,
+                                  borrow_global_pool(context), 1);
+  if (error >= 0) {
+    error = write_compression_header(context, clevel, doshuffle);
+  }
+  result = (error < 0) ? error : blosc_compress_context(context);
+
+  /* Give the threads back, so that other calling threads can use them */
+  return_global_pool(context);
+
+  return result;
+}
+
+
+/* The public routine for decompression with 64-bit sizes.  See blosc.h
+   for docstrings. */
+int64_t blosc_decompress64(const void *src, void *dest, size_t destsize)
+{
+  int64_t result;
+  struct blosc_context* context = get_global_context();
+
+  if (context == NULL) {
+    return -1;
+  }
+
+  result = blosc_run_decompression_with_context(context, src, dest, destsize,
+                                                borrow_global_pool(context));
+
+  /* Give the threads back, so that other calling threads can use them */
+  return_global_pool(context);
+
+  return result;
+}
+
+
+/* Decompress handing every block to a function.  See blosc.h for
+   docstrings. */
+int64_t blosc_decompress_apply(const void *src, blosc_apply_fn apply,
+                               void *apply_data, int numinternalthreads)
+{
+  struct blosc_context context;
+  int64_t result;
+
+  context.pool = NULL;
+  context.scratch = NULL;
+  context.allocator = g_allocator;
+  if (read_decompression_header(&context, src, numinternalthreads) < 0) {
+    return -1;
+  }
+  context.apply = apply;
+  context.apply_data = apply_data;
+
+  /* Blocks go through the threads even if memcpy'ed.  Errors of
+     `apply` come back as they are. */
+  result = do_job(&context);
+
+  /* Give the threads back to the cache so that next calls can reuse them */
+  blosc_release_threadpool(&context);
+
+  return result;
+}
+
+
+/* Run the blocks of all the buffers in `contexts` as a single parallel
+   job.  `first` holds the first block of every buffer in the job.
+   Buffers that are not to be run must have a giveup code <= 0 and no
+   blocks in `first`. */
+static int run_batch(struct blosc_context* contexts, int nitems,
+                     int32_t* first, int compress, int numthreads)
+{
+  struct blosc_context batch;
+  int rc;
+
+  batch.compress = compress;
+  batch.deterministic = g_deterministic;
+  batch.numthreads = numthreads;
+  batch.nblocks = first[nitems];
+  batch.header_flags = NULL;
+  batch.header64 = 0;
+  batch.num_output_bytes = 0;
+  batch.batch = contexts;
+  batch.batch_size = nitems;
+  batch.batch_blocks = first;
+  batch.pool = NULL;
+  batch.scratch = NULL;
+  batch.allocator = g_allocator;
+
+  rc = (int)parallel_blosc(&batch);
+
+  /* Give the threads back to the cache so that next calls can reuse them */
+  blosc_release_threadpool(&batch);
+
+  return (rc < 0) ? rc : 0;
+}
+
+/* Get the room for the contexts of a batch of `nitems` buffers */
+static int new_batch(int nitems, struct blosc_context** contexts, int32_t** first)
+{
+  *contexts = (struct blosc_context*)my_malloc(&g_allocator,
+                                               nitems * sizeof(struct blosc_context));
+  *first = (int32_t*)my_malloc(&g_allocator, (nitems + 1) * sizeof(int32_t));
+  if (*contexts == NULL || *first == NULL) {
+    my_free(&g_allocator, *contexts);
+    my_free(&g_allocator, *first);
+    return -1;
+  }
+  return 0;
+}
+
+/* The public routine for batch compression.  See blosc.h for docstrings. */
+int blosc_compress_batch(struct blosc_batch_item* items, int nitems,
+                         size_t blocksize, int numinternalthreads)
+{
+  struct blosc_context* contexts;
+  struct blosc_context* context;
+  struct blosc_batch_item* item;
+  int32_t* first;
+  int32_t nblocks = 0;
+  int32_t ntbytes;
+  int i, rc;
+
+  if (nitems <= 0) {
+    return 0;
+  }
+  if (numinternalthreads == 1) {
+    /* Nothing to gain from running the buffers together */
+    for (i = 0; i < nitems; i++) {
+      item = &items[i];
+      item->result = blosc_compress_ctx(item->clevel, item->doshuffle,
+                                        item->typesize, item->nbytes,
+                                        item->src, item->dest, item->destsize,
+                                        item->compressor, blocksize, 1);
+    }
+    return 0;
+  }
+
+  if (new_batch(nitems, &contexts, &first) < 0) {
+    return -1;
+  }
+
+  /* Set up every buffer and count its blocks in the job */
+  for (i = 0; i < nitems; i++) {
+    item = &items[i];
+    context = &contexts[i];
+    context->pool = NULL;
+    context->scratch = NULL;
+    context->allocator = g_allocator;
+    first[i] = nblocks;
+
+    rc = initialize_context_compression(context, item->clevel, item->doshuffle,
+                                        item->typesize, item->nbytes,
+                                        item->src, item->dest, item->destsize,
+                                        blosc_compname_to_compcode(item->compressor),
+                                        blocksize, numinternalthreads, 0);
+    if (rc >= 0) {
+      rc = write_compression_header(context, item->clevel, item->doshuffle);
+    }
+    if (rc < 0) {
+      context->thread_giveup_code = rc;
+      continue;
+    }
+    if (*(context->header_flags) & BLOSC_MEMCPYED) {
+      if (context->sourcesize + BLOSC_MAX_OVERHEAD > context->destsize) {
+        /* We are exceeding maximum output size */
+        context->thread_giveup_code = 0;
+        continue;
+      }
+      context->num_output_bytes = BLOSC_MAX_OVERHEAD;
+    }
+    context->thread_giveup_code = 1;
+    nblocks += context->nblocks;
+  }
+  first[nitems] = nblocks;
+
+  rc = run_batch(contexts, nitems, first, 1, numinternalthreads);
+
+  /* Collect the results */
+  for (i = 0; i < nitems; i++) {
+    item = &items[i];
+    context = &contexts[i];
+    if (rc < 0) {
+      item->result = rc;
+      continue;
+    }
+    ntbytes = context->thread_giveup_code;
+    if (ntbytes > 0) {
+      ntbytes = (int32_t)context->num_output_bytes;
+    }
+    else if (ntbytes == 0 && !(*(context->header_flags) & BLOSC_MEMCPYED) &&
+             context->sourcesize + BLOSC_MAX_OVERHEAD <= context->destsize) {
+      /* Last chance for fitting `src` buffer in `dest` */
+      *(context->header_flags) |= BLOSC_MEMCPYED;
+      set_checksums(context, 0);
+      memcpy(context->dest+BLOSC_MAX_OVERHEAD, context->src, context->sourcesize);
+      ntbytes = (int32_t)context->sourcesize + BLOSC_MAX_OVERHEAD;
+    }
+    if (ntbytes >= 0) {
+      /* Set the number of compressed bytes in header */
+      write_cbytes(context, ntbytes);
+    }
+    item->result = ntbytes;
+  }
+
+  my_free(&g_allocator, contexts);
+  my_free(&g_allocator, first);
+
+  return rc;
+}
+
+/* The public routine for batch decompression.  See blosc.h for docstrings. */
+int blosc_decompress_batch(struct blosc_batch_item* items, int nitems,
+                           int numinternalthreads)
+{
+  struct blosc_context* contexts;
+  struct blosc_context* context;
+  struct blosc_batch_item* item;
+  int32_t* first;
+  int32_t nblocks = 0;
+  int i, rc;
+
+  if (nitems <= 0) {
+    return 0;
+  }
+  if (numinternalthreads == 1) {
+    /* Nothing to gain from running the buffers together */
+    for (i = 0; i < nitems; i++) {
+      item = &items[i];
+      item->result = blosc_decompress_ctx(item->src, item->dest,
+                                          item->destsize, 1);
+    }
+    return 0;
+  }
+
+  if (new_batch(nitems, &contexts, &first) < 0) {
+    return -1;
+  }
+
+  /* Read the header of every buffer and count its blocks in the job */
+  for (i = 0; i < nitems; i++) {
+    item = &items[i];
+    context = &contexts[i];
+    context->pool = NULL;
+    context->scratch = NULL;
+    context->allocator = g_allocator;
+    first[i] = nblocks;
+
+    if (initialize_context_decompression(context, item->src, item->dest,
+                                         int_destsize(item->destsize),
+                                         numinternalthreads) < 0) {
+      context->thread_giveup_code = -1;
+      continue;
+    }
+    context->thread_giveup_code = 1;
+    nblocks += context->nblocks;
+  }
+  first[nitems] = nblocks;
+
+  rc = run_batch(contexts, nitems, first, 0, numinternalthreads);
+
+  /* Collect the results */
+  for (i = 0; i < nitems; i++) {
+    context = &contexts[i];
+    if (rc < 0) {
+      items[i].result = rc;
+    }
+    else if (context->thread_giveup_code > 0) {
+      items[i].result = (int)context->num_output_bytes;
+    }
+    else {
+      items[i].result = (context->thread_giveup_code < 0) ? -1 : 0;
+    }
+  }
+
+  my_free(&g_allocator, contexts);
+  my_free(&g_allocator, first);
+
+  return rc;
+}
+
+
+/* Specific routine optimized for decompression a small number of
+   items out of a compressed chunk.  This does not use threads because
+   it would affect negatively to performance. */
+int blosc_getitem(const void *src, int start, int nitems, void *dest)
+{
+  uint8_t *_src=NULL;               /* current pos for source buffer */
+  uint8_t version, versionlz;       /* versions for compressed header */
+  uint8_t flags;                    /* flags for header */
+  int32_t ntbytes = 0;              /* the number of uncompressed bytes */
+  int32_t nblocks;                  /* number of total blocks in buffer */
+  int32_t leftover;                 /* extra bytes at end of buffer */
+  uint8_t *bstarts;                 /* start pointers for each block */
+  int tmp_init = 0;
+  int32_t typesize, blocksize;
+  int64_t nbytes;
+  int32_t j, bsize, bsize2, leftoverblock;
+  int32_t cbytes;
+  int64_t startb, stopb, bstart;
+  int stop = start + nitems;
+  int header64;
+  uint8_t *tmp;
+  uint8_t *tmp2;
+  int32_t ebsize;
+
+  _src = (uint8_t *)(src);
+
+  /* Read the header block */
+  version = _src[0];                        /* blosc format version */
+  versionlz = _src[1];                      /* blosclz format version */
+  flags = _src[2];                          /* flags */
+  typesize = (int32_t)_src[3];              /* typesize */
+  header64 = (version == BLOSC_VERSION_FORMAT64);
+  if (header64) {
+    blocksize = sw32_(_src + 4);            /* block size */
+    nbytes = sw64_(_src + 8);               /* buffer size */
+    _src += BLOSC_HEADER64_LENGTH;
+  }
+  else {
+    nbytes = sw32_(_src + 4);               /* buffer size */
+    blocksize = sw32_(_src + 8);            /* block size */
+    _src += BLOSC_MIN_HEADER_LENGTH;
+  }
+
+  ebsize = blocksize + typesize * (int32_t)sizeof(int32_t);
+
+  versionlz += 0;                           /* shut up compiler warning */
 
-  _src += 16;
   bstarts = _src;
   /* Compute some params */
   /* Total blocks */
-  nblocks = nbytes / blocksize;
-  leftover = nbytes % blocksize;
+  nblocks = (int32_t)(nbytes / blocksize);
+  leftover = (int32_t)(nbytes % blocksize);
   nblocks = (leftover>0)? nblocks+1: nblocks;
-  _src += sizeof(int32_t)*nblocks;
 
-  /* Check region boundaries */
-  if ((start < 0) || (start*typesize > nbytes)) {
-    fprintf(stderr, "`start` out of bounds");
+  /* Check region boundaries */
+  if ((start < 0) || ((int64_t)start*typesize > nbytes)) {
+    fprintf(stderr, "`start` out of bounds");
+    return -1;
+  }
+
+  if ((stop < 0) || ((int64_t)stop*typesize > nbytes)) {
+    fprintf(stderr, "`start`+`nitems` out of bounds");
+    return -1;
+  }
+
+  tmp = my_malloc(&g_allocator, blocksize);     /* tmp for thread 0 */
+  tmp2 = my_malloc(&g_allocator, ebsize);       /* tmp2 for thread 0 */
+  if (tmp == NULL || tmp2 == NULL) {
+    my_free(&g_allocator, tmp);
+    my_free(&g_allocator, tmp2);
+    return -1;
+  }
+
+  for (j = 0; j < nblocks; j++) {
+    bsize = blocksize;
+    leftoverblock = 0;
+    if ((j == nblocks - 1) && (leftover > 0)) {
+      bsize = leftover;
+      leftoverblock = 1;
+    }
+
+    /* Compute start & stop for each block */
+    startb = (int64_t)start * typesize - (int64_t)j * blocksize;
+    stopb = (int64_t)stop * typesize - (int64_t)j * blocksize;
+    if ((startb >= blocksize) || (stopb <= 0)) {
+      continue;
+    }
+    if (startb < 0) {
+      startb = 0;
+    }
+    if (stopb > blocksize) {
+      stopb = blocksize;
+    }
+    bsize2 = (int32_t)(stopb - startb);
+
+    /* Do the actual data copy */
+    if (flags & BLOSC_MEMCPYED) {
+      /* We want to memcpy only */
+      memcpy((uint8_t *)dest + ntbytes,
+             bstarts + (int64_t)j*blocksize + startb,
+             bsize2);
+      cbytes = bsize2;
+    }
+    else {
+      struct blosc_context context;
+      uint8_t *checksum = NULL;
+      /* blosc_d only uses typesize, flags and the allocator (and the
+         source buffer for checking blocks) */
+      context.typesize = typesize;
+      context.header_flags = &flags;
+      context.allocator = g_allocator;
+      context.src = (const uint8_t *)src;
+      context.untrusted = 0;
+      context.header64 = header64;
+      if (flags & BLOSC_DOCHECKSUM) {
+        checksum = bstarts + (int64_t)nblocks * (header64 ? 8 : 4) +
+          (int64_t)j * CHECKSUM_SIZE;
+      }
+
+      /* Regular decompression.  Put results in tmp2. */
+      bstart = header64 ? sw64_(bstarts + j * 8) : sw32_(bstarts + j * 4);
+      cbytes = blosc_d(&context, bsize, leftoverblock,
+                       (uint8_t *)src + bstart, tmp2, tmp, checksum);
+      if (cbytes < 0) {
+        ntbytes = cbytes;
+        break;
+      }
+      /* Copy to destination */
+      memcpy((uint8_t *)dest + ntbytes, tmp2 + startb, bsize2);
+      cbytes = bsize2;
+    }
+    ntbytes += cbytes;
+  }
+
+  my_free(&g_allocator, tmp);
+  my_free(&g_allocator, tmp2);
+
+  return ntbytes;
+}
+
+
+/* Make the temporaries of a thread at least `ebsize` bytes large.
+   Temporaries are kept between jobs and only grown when needed.
+   Returns -1 if memory is exhausted. */
+static int grow_temporaries(struct thread_context* thread, int32_t ebsize)
+{
+  if (ebsize > thread->tmpblocksize)
+  {
+    scratch_free(&thread->allocator, thread->tmp);
+    scratch_free(&thread->allocator, thread->tmp2);
+    thread->tmp = scratch_malloc(&thread->allocator, ebsize);
+    thread->tmp2 = scratch_malloc(&thread->allocator, ebsize);
+    if (thread->tmp == NULL || thread->tmp2 == NULL) {
+      scratch_free(&thread->allocator, thread->tmp);
+      scratch_free(&thread->allocator, thread->tmp2);
+      thread->tmp = NULL;
+      thread->tmp2 = NULL;
+      thread->tmpblocksize = 0;
+      return -1;
+    }
+    thread->tmpblocksize = ebsize;
+  }
+  return 0;
+}
+
+/* Get the blosclz hash table of a thread, allocating it on first use.
+   Returns NULL if the codec is not blosclz or memory is exhausted. */
+static struct blosclz_htab* get_htab(struct thread_context* thread,
+                                     const struct blosc_context* context)
+{
+  if (context->compcode != BLOSC_BLOSCLZ) {
+    return NULL;
+  }
+  if (thread->htab == NULL) {
+    thread->htab = (struct blosclz_htab*)my_malloc(&thread->allocator,
+                                                   sizeof(struct blosclz_htab));
+    if (thread->htab == NULL) {
+      return NULL;
+    }
+    /* Only cleared once: see blosclz_compress_ht() */
+    memset(thread->htab, 0, sizeof(struct blosclz_htab));
+  }
+  return thread->htab;
+}
+
+/* Make the staging area of a thread at least `size` bytes large,
+   keeping the blocks already staged there */
+static int grow_staging(struct thread_context* context, int64_t size)
+{
+  uint8_t* staging;
+
+  if (size < 2 * context->staging_size) {
+    size = 2 * context->staging_size;
+  }
+  if ((uint64_t)size > (uint64_t)SIZE_MAX) {
+    return -1;
+  }
+  staging = scratch_malloc(&context->allocator, (size_t)size);
+  if (staging == NULL) {
+    return -1;
+  }
+  if (context->staging_used > 0) {
+    memcpy(staging, context->staging, (size_t)context->staging_used);
+  }
+  scratch_free(&context->allocator, context->staging);
+  context->staging = staging;
+  context->staging_size = size;
+
+  return 0;
+}
+
+/* Get the buffer of the job in `parent` that block `nblock` (counted
+   over all the buffers of the job) belongs to.  `*cursor` keeps the
+   position of the search; as blocks are claimed in increasing order,
+   it only moves forward. */
+static struct blosc_context* job_buffer(struct blosc_context* parent,
+                                        int32_t nblock, int32_t* cursor)
+{
+  if (parent->batch == NULL) {
+    return parent;
+  }
+  while (nblock >= parent->batch_blocks[*cursor + 1]) {
+    (*cursor)++;
+  }
+  return &parent->batch[*cursor];
+}
+
+/* Move the blocks staged by all the threads of the pool to the place
+   decided for them in the destination buffer */
+static void copy_staged_blocks(struct thread_context* context)
+{
+  struct blosc_context* parent = context->parent_context;
+  struct blosc_context* buffer;
+  struct thread_pool* pool = context->pool;
+  int32_t nblocks = parent->nblocks;
+  int32_t grain, nblock_, tblock, first;
+  int32_t cursor = 0;
+  struct thread_context* owner;
+
+  grain = nblocks / (parent->numthreads * 8);
+  if (grain < 1) {
+    grain = 1;
+  }
+  nblock_ = ATOMIC_ADD32(&parent->thread_nblock, grain);
+  while (nblock_ < nblocks) {
+    tblock = (nblock_ + grain > nblocks) ? nblocks : nblock_ + grain;
+    for (; nblock_ < tblock; nblock_++) {
+      buffer = job_buffer(parent, nblock_, &cursor);
+      if (buffer->thread_giveup_code <= 0 || !is_staged(buffer)) {
+        continue;
+      }
+      first = (parent->batch != NULL) ? parent->batch_blocks[cursor] : 0;
+      if (nblock_ - first < buffer->placed_blocks) {
+        continue;
+      }
+      owner = pool->thread_contexts[pool->block_owner[nblock_]];
+      memcpy(buffer->dest + get_bstart(buffer, nblock_ - first),
+             owner->staging + pool->block_offset[nblock_],
+             pool->block_cbytes[nblock_]);
+    }
+    nblock_ = ATOMIC_ADD32(&parent->thread_nblock, grain);
+  }
+}
+
+/* Move the staged blocks of `context` that come right after the ones
+   already in place to their final place, so that they are copied while
+   the other threads are still compressing, and blocks that follow can
+   be compressed straight into the destination.  Only one thread at a
+   time does this; if another one is at it, just go on: blocks left
+   behind are moved by the JOB_COPY_STAGED job at the end.  The slots
+   of the blocks of `context` in `pool` start at `first_slot`. */
+static void place_ready_blocks(struct thread_pool* pool,
+                               struct blosc_context* context,
+                               int32_t first_slot)
+{
+  int32_t j, slot;
+  int64_t ntdest;
+  struct thread_context* owner;
+
+  if (!ATOMIC_CAS32(&pool->placer, 0, 1)) {
+    return;
+  }
+  j = ATOMIC_READ32(&context->placed_blocks);
+  while (j < context->nblocks &&
+         ATOMIC_READ32(&pool->block_owner[first_slot + j]) >= 0) {
+    slot = first_slot + j;
+    owner = pool->thread_contexts[pool->block_owner[slot]];
+    ntdest = context->placed_bytes;
+    set_bstart(context, j, ntdest);
+    memcpy(context->dest + ntdest, owner->staging + pool->block_offset[slot],
+           pool->block_cbytes[slot]);
+    context->placed_bytes = ntdest + pool->block_cbytes[slot];
+    ATOMIC_ADD32(&owner->staged_blocks, -1);
+    ATOMIC_ADD32(&context->placed_blocks, 1);
+    j++;
+  }
+  ATOMIC_ADD32(&pool->placer, -1);
+}
+
+/* (De-)compress block `nblock_` of `context` with the working space of
+   `thread`.  `slot` is where the block is recorded if it is staged.
+
+   Returns the number of output bytes that the caller still has to
+   account for (compressed bytes are accounted here), or a negative
+   value if the buffer has to be given up (the reason is left in
+   `context->thread_giveup_code`). */
+static int32_t process_block(struct thread_context* thread,
+                             struct blosc_context* context,
+                             int32_t nblock_, int32_t slot)
+{
+  struct thread_pool* pool = thread->pool;
+  int32_t blocksize = context->blocksize;
+  int32_t ebsize = blocksize + context->typesize * (int32_t)sizeof(int32_t);
+  int32_t flags = *(context->header_flags);
+  int32_t bsize = blocksize;
+  int32_t leftoverblock = 0;
+  int32_t cbytes;
+  int64_t ntdest, placed = 0;
+  int64_t boffset = (int64_t)nblock_ * blocksize;
+  int32_t first_slot = slot - nblock_;
+  int staged = is_staged(context);
+  int in_place = 0;
+  int rc;
+
+  if (grow_temporaries(thread, ebsize) < 0) {
+    context->thread_giveup_code = -1;
+    return -1;
+  }
+
+  if (nblock_ == (context->nblocks - 1) && (context->leftover > 0)) {
+    bsize = context->leftover;
+    leftoverblock = 1;
+  }
+  if (staged) {
+    /* Catch up with the blocks done by other threads, in case this one
+       is the next to go in place */
+    place_ready_blocks(pool, context, first_slot);
+    in_place = ATOMIC_CAS32(&context->placed_blocks, nblock_, nblock_);
+  }
+  if (context->compress) {
+    if (flags & BLOSC_MEMCPYED) {
+      /* We want to memcpy only */
+      memcpy(context->dest+header_length(context)+boffset,
+             context->src+boffset, bsize);
+      cbytes = bsize;
+    }
+    else if (staged && in_place) {
+      /* All the blocks before this one are in place, so its own place
+         is known: compress it right there.  Nobody else moves blocks
+         past this one until it is done. */
+      placed = context->placed_bytes;
+      cbytes = blosc_c(context, bsize, leftoverblock, placed, context->destsize,
+                       context->src+boffset, context->dest+placed,
+                       thread->tmp, get_htab(thread, context),
+                       block_checksum(context, nblock_));
+    }
+    else if (staged) {
+      /* Compress into the staging area, to be put in place later.  Once
+         the blocks staged before are all in place, their room is free. */
+      if (ATOMIC_READ32(&thread->staged_blocks) == 0) {
+        thread->staging_used = 0;
+      }
+      if (thread->staging_used + ebsize > thread->staging_size) {
+        /* Blocks in the staging area may be being moved right now */
+        while (!ATOMIC_CAS32(&pool->placer, 0, 1)) {
+          CPU_RELAX();
+        }
+        rc = grow_staging(thread, thread->staging_used + ebsize);
+        ATOMIC_ADD32(&pool->placer, -1);
+        if (rc < 0) {
+          context->thread_giveup_code = -1;
+          return -1;
+        }
+      }
+      cbytes = blosc_c(context, bsize, leftoverblock, 0, ebsize,
+                       context->src+boffset,
+                       thread->staging + thread->staging_used, thread->tmp,
+                       get_htab(thread, context), block_checksum(context, nblock_));
+    }
+    else {
+      /* Regular compression */
+      cbytes = blosc_c(context, bsize, leftoverblock, 0, ebsize,
+                       context->src+boffset, thread->tmp2, thread->tmp,
+                       get_htab(thread, context), block_checksum(context, nblock_));
+    }
+  }
+  else if (context->apply != NULL) {
+    cbytes = apply_block(context, nblock_, bsize, leftoverblock, thread->tmp2,
+                         thread->tmp);
+  }
+  else if (context->range_nbytes >= 0) {
+    cbytes = range_block(context, nblock_, bsize, leftoverblock, thread->tmp2,
+                         thread->tmp);
+  }
+  else {
+    if (flags & BLOSC_MEMCPYED) {
+      /* We want to memcpy only */
+      memcpy(context->dest+boffset,
+             context->src+header_length(context)+boffset, bsize);
+      cbytes = bsize;
+    }
+    else {
+      cbytes = blosc_d(context, bsize, leftoverblock,
+                       context->src + get_bstart(context, nblock_),
+                       context->dest+boffset, thread->tmp,
+                       block_checksum(context, nblock_));
+    }
+  }
+
+  /* Check whether another thread gave up in the meanwhile */
+  if (context->thread_giveup_code <= 0) {
+    return -1;
+  }
+
+  /* Check results for the compressed/decompressed block */
+  if (cbytes < 0) {            /* compr/decompr failure */
+    /* Set giveup_code error */
+    context->thread_giveup_code = cbytes;
+    return -1;
+  }
+
+  if (!context->compress || (flags & BLOSC_MEMCPYED)) {
+    return cbytes;
+  }
+
+  if (cbytes == 0) {
+    context->thread_giveup_code = 0;  /* uncompressible buffer */
+    return -1;
+  }
+  /* Reserve room for the compressed block in destination */
+  ntdest = ATOMIC_ADD64(&context->num_output_bytes, cbytes);
+  if (ntdest+cbytes > context->destsize) {
+    context->thread_giveup_code = 0;  /* uncompressible buffer */
+    return -1;
+  }
+  if (in_place) {
+    set_bstart(context, nblock_, placed);
+    context->placed_bytes = placed + cbytes;
+    ATOMIC_ADD32(&context->placed_blocks, 1);
+    place_ready_blocks(pool, context, first_slot);
+  }
+  else if (staged) {
+    /* Remember where the block is; its final place is not known yet */
+    pool->block_cbytes[slot] = cbytes;
+    pool->block_offset[slot] = thread->staging_used;
+    thread->staging_used += cbytes;
+    ATOMIC_ADD32(&thread->staged_blocks, 1);
+    ATOMIC_CAS32(&pool->block_owner[slot], -1, thread->tid);
+    place_ready_blocks(pool, context, first_slot);
+  }
+  else {
+    set_bstart(context, nblock_, ntdest); /* update block start counter */
+
+    /* Copy the compressed buffer to destination */
+    memcpy(context->dest+ntdest, thread->tmp2, cbytes);
+  }
+
+  return 0;
+}
+
+/* Create the working space of a thread of `pool`, allocated from
+   `allocator` */
+static struct thread_context* new_thread_context(struct thread_pool* pool, int32_t tid,
+                                                 const struct blosc_allocator* allocator)
+{
+  struct thread_context* context;
+
+  context = (struct thread_context*)my_malloc(allocator, sizeof(struct thread_context));
+  if (context == NULL) {
+    return NULL;
+  }
+  context->pool = pool;
+  context->parent_context = NULL;
+  context->tid = tid;
+  context->allocator = *allocator;
+
+  /* Temporaries are allocated lazily, when the first job arrives */
+  context->tmp = NULL;
+  context->tmp2 = NULL;
+  context->tmpblocksize = 0;
+  context->htab = NULL;
+  context->staging = NULL;
+  context->staging_size = 0;
+  context->staging_used = 0;
+  context->staged_blocks = 0;
+
+  return context;
+}
+
+/* Release the working space of a thread */
+static void free_thread_context(struct thread_context* context)
+{
+  struct blosc_allocator allocator = context->allocator;
+
+  scratch_free(&allocator, context->tmp);
+  scratch_free(&allocator, context->tmp2);
+  my_free(&allocator, context->htab);
+  scratch_free(&allocator, context->staging);
+  my_free(&allocator, context);
+}
+
+/* Get the block and split that make task `task` of a split-level job,
+   as well as the number of splits in that block */
+static void split_task(const struct blosc_context* context, int32_t task,
+                       int32_t* nblock, int32_t* split, int32_t* nsplits)
+{
+  int32_t nfull = context->nblocks - (context->leftover > 0);
+
+  if (task < nfull * context->nsplits) {
+    *nblock = task / context->nsplits;
+    *split = task % context->nsplits;
+    *nsplits = context->nsplits;
+  }
+  else {
+    /* The leftover block is never split */
+    *nblock = nfull;
+    *split = 0;
+    *nsplits = 1;
+  }
+}
+
+/* Compress one split into the staging area of `thread` */
+static void compress_split_task(struct thread_context* thread, int32_t task)
+{
+  struct blosc_context* context = thread->parent_context;
+  struct thread_pool* pool = thread->pool;
+  int32_t typesize = context->typesize;
+  int32_t ebsize = context->blocksize + typesize * (int32_t)sizeof(int32_t);
+  int32_t nblock_, split, nsplits, bsize, neblock, maxout, cbytes, k;
+  int64_t ntdest;
+  const uint8_t* bsrc;
+  const uint8_t* plane;
+  uint8_t* out;
+
+  split_task(context, task, &nblock_, &split, &nsplits);
+  bsize = context->blocksize;
+  if (nblock_ == context->nblocks - 1 && context->leftover > 0) {
+    bsize = context->leftover;
+  }
+  neblock = bsize / nsplits;
+  bsrc = context->src + (int64_t)nblock_ * context->blocksize;
+  if (grow_temporaries(thread, ebsize) < 0) {
+    context->thread_giveup_code = -1;
+    return;
+  }
+
+  if ((*(context->header_flags) & BLOSC_DOSHUFFLE) && (typesize > 1)) {
+    if (nsplits == 1) {
+      shuffle(typesize, bsize, bsrc, thread->tmp);
+    }
+    else {
+      /* A split of a shuffled block is a byte plane: gather it */
+      for (k = 0; k < neblock; k++) {
+        thread->tmp[k] = bsrc[k * typesize + split];
+      }
+    }
+    plane = thread->tmp;
+  }
+  else {
+    plane = bsrc + split * neblock;
+  }
+
+  maxout = split_maxout(context, neblock);
+  if (thread->staging_used + maxout > thread->staging_size &&
+      grow_staging(thread, thread->staging_used + maxout) < 0) {
+    context->thread_giveup_code = -1;
+    return;
+  }
+  out = thread->staging + thread->staging_used;
+  cbytes = compress_split(context, plane, neblock, out, maxout, get_accel(context),
+                          get_htab(thread, context));
+  if (cbytes < 0) {
+    context->thread_giveup_code = cbytes;
+    return;
+  }
+  if (cbytes == 0 || cbytes == neblock) {
+    /* The compressor has been unable to compress data at all */
+    memcpy(out, plane, neblock);
+    cbytes = neblock;
+  }
+
+  /* Reserve room for the split (and its size) in destination */
+  ntdest = ATOMIC_ADD64(&context->num_output_bytes, cbytes + (int32_t)sizeof(int32_t));
+  if (ntdest + cbytes + (int32_t)sizeof(int32_t) > context->destsize) {
+    context->thread_giveup_code = 0;  /* uncompressible buffer */
+    return;
+  }
+  pool->block_cbytes[task] = cbytes;
+  pool->block_owner[task] = thread->tid;
+  pool->block_offset[task] = thread->staging_used;
+  thread->staging_used += cbytes;
+}
+
+/* Decompress one split.  Shuffled blocks are decompressed into the
+   scratch of the pool, to be unshuffled once all their splits are done. */
+static void decompress_split_task(struct thread_context* thread, int32_t task)
+{
+  struct blosc_context* context = thread->parent_context;
+  int32_t nblock_, split, nsplits, bsize, neblock, cbytes, nbytes, j;
+  const uint8_t* sp;
+  uint8_t* out;
+
+  split_task(context, task, &nblock_, &split, &nsplits);
+  bsize = context->blocksize;
+  if (nblock_ == context->nblocks - 1 && context->leftover > 0) {
+    bsize = context->leftover;
+  }
+  neblock = bsize / nsplits;
+
+  /* Skip the previous splits of the block */
+  sp = context->src + get_bstart(context, nblock_);
+  for (j = 0; j < split; j++) {
+    sp += sizeof(int32_t) + sw32_(sp);
+  }
+  cbytes = sw32_(sp);
+  sp += sizeof(int32_t);
+
+  if ((*(context->header_flags) & BLOSC_DOSHUFFLE) && (context->typesize > 1)) {
+    out = thread->pool->split_scratch;
+  }
+  else {
+    out = context->dest;
+  }
+  out += (int64_t)nblock_ * context->blocksize + split * neblock;
+
+  nbytes = decompress_split((*(context->header_flags) & 0xe0) >> 5,
+                            sp, cbytes, out, neblock, context->untrusted,
+                            &context->allocator);
+  if (nbytes < 0) {
+    context->thread_giveup_code = nbytes;
+    return;
+  }
+  ATOMIC_ADD64(&context->num_output_bytes, nbytes);
+}
+
+/* Move one staged split (and its size) to its final place */
+static void copy_split_task(struct thread_context* thread, int32_t task)
+{
+  struct blosc_context* context = thread->parent_context;
+  struct thread_pool* pool = thread->pool;
+  struct thread_context* owner = pool->thread_contexts[pool->block_owner[task]];
+  int32_t nblock_, split, nsplits, j;
+  uint8_t* out;
+
+  split_task(context, task, &nblock_, &split, &nsplits);
+  out = context->dest + get_bstart(context, nblock_);
+  for (j = task - split; j < task; j++) {
+    out += sizeof(int32_t) + pool->block_cbytes[j];
+  }
+  _sw32(out, pool->block_cbytes[task]);
+  memcpy(out + sizeof(int32_t), owner->staging + pool->block_offset[task],
+         pool->block_cbytes[task]);
+}
+
+/* Do tasks of the current split-level job until none are left */
+static void run_split_tasks(struct thread_context* thread)
+{
+  struct blosc_context* context = thread->parent_context;
+  int32_t task, bsize;
+
+  task = ATOMIC_ADD32(&context->thread_nblock, 1);
+  while (task < context->ntasks && context->thread_giveup_code > 0) {
+    if (context->job == JOB_SPLITS) {
+      if (context->compress) {
+        compress_split_task(thread, task);
+      }
+      else {
+        decompress_split_task(thread, task);
+      }
+    }
+    else if (context->job == JOB_COPY_SPLITS) {
+      copy_split_task(thread, task);
+    }
+    else {
+      /* JOB_UNSHUFFLE: tasks are whole blocks */
+      bsize = context->blocksize;
+      if (task == context->nblocks - 1 && context->leftover > 0) {
+        bsize = context->leftover;
+      }
+      unshuffle(context->typesize, bsize,
+                thread->pool->split_scratch + (int64_t)task * context->blocksize,
+                context->dest + (int64_t)task * context->blocksize);
+    }
+    task = ATOMIC_ADD32(&context->thread_nblock, 1);
+  }
+}
+
+/* Get the index of the NUMA node where the calling thread runs */
+static int32_t current_node(void)
+{
+#if defined(HAVE_NUMA)
+  int cpu = sched_getcpu();
+  int32_t node;
+
+  for (node = 0; cpu >= 0 && node < g_numa_nodes; node++) {
+    if (CPU_ISSET(cpu, &g_node_cpus[node])) {
+      return node;
+    }
+  }
+#endif
+  return 0;
+}
+
+/* Claim up to `grain` blocks of the job of `parent`.  Returns the
+   position of the first block claimed and sets `*tblock` past the last
+   one, or returns -1 when no blocks are left.  In NUMA-aware jobs,
+   positions index pool->node_blocks: the blocks of node `home` are
+   claimed first, and then the ones of the other nodes (`*visited`
+   keeps track of the nodes already exhausted). */
+static int32_t claim_blocks(struct thread_pool* pool, struct blosc_context* parent,
+                            int32_t grain, int32_t home, int32_t* visited,
+                            int32_t* tblock)
+{
+  int32_t node, pos, last;
+
+  if (!parent->numa) {
+    pos = ATOMIC_ADD32(&parent->thread_nblock, grain);
+    last = parent->nblocks;
+  }
+  else {
+    for (;;) {
+      if (*visited == g_numa_nodes) {
+        return -1;
+      }
+      node = (home + *visited) % g_numa_nodes;
+      pos = pool->node_first[node] + ATOMIC_ADD32(&pool->node_next[node].nblock, grain);
+      last = pool->node_first[node + 1];
+      if (pos < last) {
+        break;
+      }
+      (*visited)++;
+    }
+  }
+  if (pos >= last) {
     return -1;
   }
+  *tblock = (pos + grain > last) ? last : pos + grain;
+  return pos;
+}
+
+/* Do the share of the current job of the pool that falls to `context`.
+   This is run by the threads of the pool and by the calling thread. */
+static void run_job(struct thread_context* context)
+{
+  struct blosc_context* parent;
+  struct blosc_context* buffer;
+  struct blosc_context* current = NULL;
+  int32_t grain;                /* number of blocks claimed at once */
+  int32_t pos;                  /* position of the block being done */
+  int32_t tblock;               /* limit position on a thread */
+  int32_t nblock_;              /* private copy of nblock */
+  int32_t home = 0;             /* NUMA node of the thread */
+  int32_t visited = 0;           /* NUMA nodes exhausted so far */
+  int32_t nblocks;
+  int32_t first;
+  int32_t cursor = 0;
+  int64_t ntbytes = 0;
+  int32_t cbytes;
+
+  /* Attach to the context of the job to be done */
+  context->parent_context = context->pool->context;
+  parent = context->parent_context;
+
+  if (parent->job == JOB_COPY_STAGED) {
+    copy_staged_blocks(context);
+    return;
+  }
+  if (parent->job >= JOB_SPLITS) {
+    run_split_tasks(context);
+    return;
+  }
+
+  nblocks = parent->nblocks;
+
+  /* Blocks are handed out dynamically, so that threads which are
+     done with cheap blocks (or which get more CPU time) just take
+     more work.  Compression claims blocks one by one, following the
+     block order.  Decompression can happen using any order, so it
+     claims chunks of consecutive blocks, which keeps both the
+     number of atomic operations and the jumps in memory low.  The
+     blocks of all the buffers in a batch are claimed in the same way,
+     as if they belonged to one single buffer.  In NUMA-aware jobs,
+     the blocks of the node of the thread go first. */
+  if (parent->compress &&
+      (parent->batch != NULL || !(*(parent->header_flags) & BLOSC_MEMCPYED))) {
+    grain = 1;
+  }
+  else {
+    grain = nblocks / (parent->numthreads * 8);
+    if (grain < 1) {
+      grain = 1;
+    }
+  }
+  if (parent->numa) {
+    home = current_node();
+  }
+  pos = claim_blocks(context->pool, parent, grain, home, &visited, &tblock);
+
+  /* Loop over blocks */
+  while (pos >= 0 && parent->thread_giveup_code > 0) {
+    nblock_ = parent->numa ? context->pool->node_blocks[pos] : pos;
+    buffer = job_buffer(parent, nblock_, &cursor);
+    if (buffer != current) {
+      /* Sum up the bytes decompressed for the previous buffer */
+      if (current != NULL && ntbytes > 0 && current->thread_giveup_code > 0) {
+        ATOMIC_ADD64(&current->num_output_bytes, ntbytes);
+      }
+      ntbytes = 0;
+      current = buffer;
+    }
+
+    if (buffer->thread_giveup_code > 0) {
+      first = (parent->batch != NULL) ? parent->batch_blocks[cursor] : 0;
+      cbytes = process_block(context, buffer, nblock_ - first, nblock_);
+      if (cbytes < 0 && parent->batch == NULL) {
+        break;
+      }
+      if (cbytes > 0) {
+        ntbytes += cbytes;
+      }
+    }
+
+    /* Claim more blocks when the current chunk is exhausted */
+    pos++;
+    if (pos == tblock) {
+      pos = claim_blocks(context->pool, parent, grain, home, &visited, &tblock);
+    }
+
+  } /* closes while (pos) */
+
+  /* Sum up all the bytes decompressed (or memcpy'ed) */
+  if (current != NULL && ntbytes > 0 && current->thread_giveup_code > 0) {
+    ATOMIC_ADD64(&current->num_output_bytes, ntbytes);
+  }
+}
+
+/* Decompress & unshuffle several blocks in a single thread */
+static void *t_blosc(void *ctxt)
+{
+  struct thread_context* context = (struct thread_context*)ctxt;
+  struct thread_pool* pool = context->pool;
+
+  while(1)
+  {
+    /* Synchronization point for all threads (wait for initialization) */
+    WAIT_INIT(pool);
+
+    if(pool->end_threads)
+    {
+      break;
+    }
+
+    run_job(context);
+
+    /* Meeting point for all threads (wait for finalization) */
+    WAIT_FINISH(pool);
+  }
+
+  free_thread_context(context);
+
+  return(NULL);
+}
+
+
+/* Wind down a pool whose thread `tid` could not be set up, together
+   with the threads started so far.  Returns NULL. */
+static struct thread_pool* abort_threads(struct thread_pool* pool, int32_t tid)
+{
+  /* The threads started are still waiting for the first job */
+  pool->nthreads = tid;
+  pool->barr_init.nparticipants = tid;
+  pool->barr_finish.nparticipants = tid;
+  destroy_threads(pool);
+  return NULL;
+}
+
+/* Create a new pool of `nthreads` threads waiting for jobs, whose
+   memory comes from `allocator` */
+static struct thread_pool* init_threads(int32_t nthreads,
+                                        const struct blosc_allocator* allocator)
+{
+  int32_t tid;
+  int rc2;
+  struct thread_pool* pool;
+  struct thread_context* thread_context;
+
+  pool = (struct thread_pool*)my_malloc(allocator, sizeof(struct thread_pool));
+  if (pool == NULL) {
+    return NULL;
+  }
+  pool->nthreads = nthreads;
+  pool->end_threads = 0;
+  pool->allocator = *allocator;
+  pool->context = NULL;
+  pool->block_cbytes = NULL;
+  pool->block_owner = NULL;
+  pool->block_offset = NULL;
+  pool->block_slots = 0;
+  pool->placer = 0;
+  pool->split_scratch = NULL;
+  pool->split_scratch_size = 0;
+  pool->numa = (g_numa && g_numa_nodes > 1);
+  pool->node_blocks = NULL;
+  pool->node_pages = NULL;
+  pool->node_status = NULL;
+  pool->node_slots = 0;
+  memset(pool->thread_contexts, 0, sizeof(pool->thread_contexts));
+  memset((void*)pool->slot_busy, 0, sizeof(pool->slot_busy));
+
+  /* Barrier initialization */
+  barrier_init(&pool->barr_init, pool->nthreads);
+  barrier_init(&pool->barr_finish, pool->nthreads);
+  pool->leader_started = 0;
+  pool->async_job = NULL;
+  pool->async_running = 0;
+  pthread_mutex_init(&pool->async_mutex, NULL);
+  pthread_cond_init(&pool->async_cv, NULL);
+
+#if !defined(_WIN32)
+  /* Initialize and set thread detached attribute */
+  pthread_attr_init(&pool->ct_attr);
+  pthread_attr_setdetachstate(&pool->ct_attr, PTHREAD_CREATE_JOINABLE);
+#endif
+
+  if (nthreads == 0) {
+    /* Working spaces are created as executor tasks need them */
+    return(pool);
+  }
+
+  /* The thread borrowing the pool does its share of every job, as the
+     thread with id 0.  Its working space is kept in the pool. */
+  pool->thread_contexts[0] = new_thread_context(pool, 0, &pool->allocator);
+  if (pool->thread_contexts[0] == NULL) {
+    return abort_threads(pool, 0);
+  }
+
+  /* Finally, create the rest of threads in detached state */
+  for (tid = 1; tid < pool->nthreads; tid++) {
+    /* Create a thread context thread owns context (will destroy when finished) */
+    thread_context = new_thread_context(pool, tid, &pool->allocator);
+    if (thread_context == NULL) {
+      return abort_threads(pool, tid);
+    }
+    pool->thread_contexts[tid] = thread_context;
+
+#if defined(HAVE_NUMA)
+    if (pool->numa) {
+      /* Spread the threads evenly among the nodes */
+      pthread_attr_setaffinity_np(&pool->ct_attr, sizeof(cpu_set_t),
+                                  &g_node_cpus[tid * g_numa_nodes / nthreads]);
+    }
+#endif
+#if !defined(_WIN32)
+    rc2 = pthread_create(&pool->threads[tid], &pool->ct_attr, t_blosc, (void *)thread_context);
+#else
+    rc2 = pthread_create(&pool->threads[tid], NULL, t_blosc, (void *)thread_context);
+#endif
+    if (rc2) {
+      fprintf(stderr, "ERROR; return code from pthread_create() is %d\n", rc2);
+      fprintf(stderr, "\tError detail: %s\n", strerror(rc2));
+      free_thread_context(thread_context);
+      pool->thread_contexts[tid] = NULL;
+      return abort_threads(pool, tid);
+    }
+  }
+
+  return(pool);
+}
+
+/* Tell all the threads in `pool` to finish and release its resources */
+static int destroy_threads(struct thread_pool* pool)
+{
+  int32_t t;
+  void* status;
+  int rc2;
+  struct blosc_allocator allocator;
+
+  /* Tell all existing threads to finish */
+  pthread_mutex_lock(&pool->async_mutex);
+  pool->end_threads = 1;
+  pthread_cond_signal(&pool->async_cv);
+  pthread_mutex_unlock(&pool->async_mutex);
+  if (pool->leader_started) {
+    rc2 = pthread_join(pool->leader, &status);
+    if (rc2) {
+      fprintf(stderr, "ERROR; return code from pthread_join() is %d\n", rc2);
+      fprintf(stderr, "\tError detail: %s\n", strerror(rc2));
+    }
+  }
+
+  /* Sync threads */
+  if (pool->nthreads > 0) {
+    WAIT_INIT(pool);
+  }
+
+  /* Join exiting threads */
+  for (t=1; t<pool->nthreads; t++) {
+    rc2 = pthread_join(pool->threads[t], &status);
+    if (rc2) {
+      fprintf(stderr, "ERROR; return code from pthread_join() is %d\n", rc2);
+      fprintf(stderr, "\tError detail: %s\n", strerror(rc2));
+    }
+  }
 
-  if ((stop < 0) || (stop*typesize > nbytes)) {
-    fprintf(stderr, "`start`+`nitems` out of bounds");
-    return -1;
-  }
+  /* Barriers */
+  barrier_destroy(&pool->barr_init);
+  barrier_destroy(&pool->barr_finish);
+  pthread_mutex_destroy(&pool->async_mutex);
+  pthread_cond_destroy(&pool->async_cv);
 
-  for (j = 0; j < nblocks; j++) {
-    bsize = blocksize;
-    leftoverblock = 0;
-    if ((j == nblocks - 1) && (leftover > 0)) {
-      bsize = leftover;
-      leftoverblock = 1;
+  /* Thread attributes */
+#if !defined(_WIN32)
+  pthread_attr_destroy(&pool->ct_attr);
+#endif
+
+  /* Working spaces not owned by threads (calling thread, executor tasks) */
+  if (pool->nthreads > 0) {
+    free_thread_context(pool->thread_contexts[0]);
+  }
+  else {
+    for (t = 0; t < BLOSC_MAX_THREADS; t++) {
+      if (pool->thread_contexts[t] != NULL) {
+        free_thread_context(pool->thread_contexts[t]);
+      }
     }
+  }
+  my_free(&pool->allocator, pool->block_cbytes);
+  my_free(&pool->allocator, pool->block_owner);
+  my_free(&pool->allocator, pool->block_offset);
+  scratch_free(&pool->allocator, pool->split_scratch);
+  my_free(&pool->allocator, pool->node_blocks);
+  my_free(&pool->allocator, pool->node_pages);
+  my_free(&pool->allocator, pool->node_status);
+  allocator = pool->allocator;
+  my_free(&allocator, pool);
 
-    /* Compute start & stop for each block */
-    startb = start * typesize - j * blocksize;
-    stopb = stop * typesize - j * blocksize;
-    if ((startb >= (int)blocksize) || (stopb <= 0)) {
+  return 0;
+}
+
+/* Whether `a` and `b` allocate memory in the same way */
+static int same_allocator(const struct blosc_allocator* a,
+                          const struct blosc_allocator* b)
+{
+  return a->alloc == b->alloc && a->free == b->free && a->data == b->data;
+}
+
+/* Get a pool of `nthreads` threads allocated from `allocator`, reusing
+   an idle one if possible.  Slots in the cache are claimed with a
+   compare-and-swap, so no global lock is needed here.  A pool can only
+   be looked at once claimed: until then, whoever claims it may destroy
+   it. */
+static struct thread_pool* acquire_thread_pool(int32_t nthreads,
+                                               const struct blosc_allocator* allocator)
+{
+  int i;
+  struct thread_pool* pool;
+
+  for (i = 0; i < POOL_CACHE_SIZE; i++) {
+    pool = g_pool_cache[i];
+    if (pool == NULL || !ATOMIC_CAS_PTR(&g_pool_cache[i], pool, NULL)) {
       continue;
     }
-    if (startb < 0) {
-      startb = 0;
+    if (pool->nthreads == nthreads &&
+        same_allocator(&pool->allocator, allocator)) {
+      return pool;
     }
-    if (stopb > (int)blocksize) {
-      stopb = blocksize;
+    /* Not the one wanted: put it back */
+    if (!ATOMIC_CAS_PTR(&g_pool_cache[i], NULL, pool)) {
+      recycle_thread_pool(pool);
     }
-    bsize2 = stopb - startb;
+  }
 
-    /* Do the actual data copy */
-    if (flags & BLOSC_MEMCPYED) {
-      /* We want to memcpy only */
-      memcpy((uint8_t *)dest + ntbytes,
-          (uint8_t *)src + BLOSC_MAX_OVERHEAD + j*blocksize + startb,
-             bsize2);
-      cbytes = bsize2;
-    }
-    else {
-      struct blosc_context context;
-      /* blosc_d only uses typesize and flags */
-      context.typesize = typesize;
-      context.header_flags = &flags;
+  /* No suitable pool is idle.  Create a new one. */
+  return init_threads(nthreads, allocator);
+}
 
-      /* Regular decompression.  Put results in tmp2. */
-      cbytes = blosc_d(&context, bsize, leftoverblock,
-                       (uint8_t *)src + sw32_(bstarts + j * 4),
-                       tmp2, tmp, tmp2);
-      if (cbytes < 0) {
-        ntbytes = cbytes;
-        break;
-      }
-      /* Copy to destination */
-      memcpy((uint8_t *)dest + ntbytes, tmp2 + startb, bsize2);
-      cbytes = bsize2;
+/* Put an idle pool into the cache, or destroy it if the cache is full.
+   Pools from allocators other than the global one are not cached, so
+   that no memory of theirs is held once they are released. */
+static void recycle_thread_pool(struct thread_pool* pool)
+{
+  int i;
+
+  pool->context = NULL;
+  if (!same_allocator(&pool->allocator, &g_allocator)) {
+    destroy_threads(pool);
+    return;
+  }
+  for (i = 0; i < POOL_CACHE_SIZE; i++) {
+    if (g_pool_cache[i] == NULL &&
+        ATOMIC_CAS_PTR(&g_pool_cache[i], NULL, pool)) {
+      return;
     }
-    ntbytes += cbytes;
   }
 
-  my_free(tmp);
-  my_free(tmp2);
-
-  return ntbytes;
+  destroy_threads(pool);
 }
 
-
-/* Decompress & unshuffle several blocks in a single thread */
-static void *t_blosc(void *ctxt)
+/* Destroy all the idle pools in the cache */
+static void drain_thread_pool_cache(void)
 {
-  struct thread_context* context = (struct thread_context*)ctxt;
-  int32_t cbytes, ntdest;
-  int32_t tblocks;              /* number of blocks per thread */
-  int32_t leftover2;
-  int32_t tblock;               /* limit block on a thread */
-  int32_t nblock_;              /* private copy of nblock */
-  int32_t bsize, leftoverblock;
-  /* Parameters for threads */
-  int32_t blocksize;
-  int32_t ebsize;
-  int32_t compress;
-  int32_t maxbytes;
-  int32_t ntbytes;
-  int32_t flags;
-  int32_t nblocks;
-  int32_t leftover;
-  uint8_t *bstarts;
-  const uint8_t *src;
-  uint8_t *dest;
-  uint8_t *tmp;
-  uint8_t *tmp2;
-  int rc;
+  int i;
+  struct thread_pool* pool;
 
-  while(1)
-  {
-    /* Synchronization point for all threads (wait for initialization) */
-    WAIT_INIT(NULL, context->parent_context);
+  for (i = 0; i < POOL_CACHE_SIZE; i++) {
+    pool = g_pool_cache[i];
+    if (pool != NULL && ATOMIC_CAS_PTR(&g_pool_cache[i], pool, NULL)) {
+      destroy_threads(pool);
+    }
+  }
 
-    if(context->parent_context->end_threads)
-    {
-      break;
+  /* The pool of the non-contextual API, unless some call is using it */
+  if (ATOMIC_CAS32(&g_global_pool_busy, 0, 1)) {
+    if (g_global_pool != NULL) {
+      destroy_threads(g_global_pool);
+      g_global_pool = NULL;
     }
+    ATOMIC_ADD32(&g_global_pool_busy, -1);
+  }
+}
 
-    /* Get parameters for this thread before entering the main loop */
-    blocksize = context->parent_context->blocksize;
-    ebsize = blocksize + context->parent_context->typesize * (int32_t)sizeof(int32_t);
-    compress = context->parent_context->compress;
-    flags = *(context->parent_context->header_flags);
-    maxbytes = context->parent_context->destsize;
-    nblocks = context->parent_context->nblocks;
-    leftover = context->parent_context->leftover;
-    bstarts = context->parent_context->bstarts;
-    src = context->parent_context->src;
-    dest = context->parent_context->dest;
+/* Lend the pool of the non-contextual API to `context`, creating it if
+   needed.  Returns the number of threads that the call can use: 1 when
+   another call has the pool. */
+static int32_t borrow_global_pool(struct blosc_context* context)
+{
+  struct thread_pool* pool;
 
-    if (blocksize > context->tmpblocksize)
-    {
-      my_free(context->tmp);
-      my_free(context->tmp2);
-      context->tmp = my_malloc(blocksize);
-      context->tmp2 = my_malloc(ebsize);
-    }
+  /* Executors bring their own threads, and wrong numbers of threads
+     are reported by the job itself */
+  if (g_threads <= 1 || g_threads > BLOSC_MAX_THREADS || g_executor != NULL) {
+    return g_threads;
+  }
+  if (!ATOMIC_CAS32(&g_global_pool_busy, 0, 1)) {
+    return 1;
+  }
+  pool = g_global_pool;
+  if (pool != NULL && (pool->nthreads != g_threads ||
+                       !same_allocator(&pool->allocator, &g_allocator))) {
+    destroy_threads(pool);
+    pool = NULL;
+  }
+  if (pool == NULL) {
+    pool = init_threads(g_threads, &g_allocator);
+  }
+  g_global_pool = pool;
+  if (pool == NULL) {
+    ATOMIC_ADD32(&g_global_pool_busy, -1);
+    return 1;
+  }
+  context->pool = pool;
+  return g_threads;
+}
+
+/* Give the pool of `context` back after a call of the non-contextual
+   API */
+static void return_global_pool(struct blosc_context* context)
+{
+  if (context->pool != NULL && context->pool == g_global_pool) {
+    context->pool = NULL;
+    ATOMIC_ADD32(&g_global_pool_busy, -1);
+  }
+  else {
+    blosc_release_threadpool(context);
+  }
+}
 
-    tmp = context->tmp;
-    tmp2 = context->tmp2;
+/* The thread of a pool that runs asynchronous jobs.  It plays the
+   role of the caller of the synchronous functions, so it also works as
+   thread 0 of the pool. */
+static void *t_leader(void *ctxt)
+{
+  struct thread_pool* pool = (struct thread_pool*)ctxt;
+  struct blosc_async* job;
+  int result;
 
-    ntbytes = 0;                /* only useful for decompression */
+  while (1) {
+    pthread_mutex_lock(&pool->async_mutex);
+    while (pool->async_job == NULL && !pool->end_threads) {
+      pthread_cond_wait(&pool->async_cv, &pool->async_mutex);
+    }
+    job = pool->async_job;
+    pool->async_job = NULL;
+    pthread_mutex_unlock(&pool->async_mutex);
+    if (job == NULL) {
+      break;
+    }
 
-    if (compress && !(flags & BLOSC_MEMCPYED)) {
-      /* Compression always has to follow the block order */
-      pthread_mutex_lock(&context->parent_context->count_mutex);
-      context->parent_context->thread_nblock++;
-      nblock_ = context->parent_context->thread_nblock;
-      pthread_mutex_unlock(&context->parent_context->count_mutex);
-      tblock = nblocks;
+    pool->async_running = 1;
+    if (job->context.compress) {
+      result = (int)blosc_compress_context(&job->context);
     }
     else {
-      /* Decompression can happen using any order.  We choose
-       sequential block order on each thread */
-
-      /* Blocks per thread */
-      tblocks = nblocks / context->parent_context->numthreads;
-      leftover2 = nblocks % context->parent_context->numthreads;
-      tblocks = (leftover2>0)? tblocks+1: tblocks;
-
-      nblock_ = context->tid*tblocks;
-      tblock = nblock_ + tblocks;
-      if (tblock > nblocks) {
-        tblock = nblocks;
-      }
+      result = (int)blosc_run_decompression_with_context(&job->context, job->src,
+                                                         job->dest,
+                                                         int_destsize(job->destsize),
+                                                         job->context.numthreads);
     }
+    pool->async_running = 0;
 
-    /* Loop over blocks */
-    leftoverblock = 0;
-    while ((nblock_ < tblock) && context->parent_context->thread_giveup_code > 0) {
-      bsize = blocksize;
-      if (nblock_ == (nblocks - 1) && (leftover > 0)) {
-        bsize = leftover;
-        leftoverblock = 1;
-      }
-      if (compress) {
-        if (flags & BLOSC_MEMCPYED) {
-          /* We want to memcpy only */
-          memcpy(dest+BLOSC_MAX_OVERHEAD+nblock_*blocksize,
-                 src+nblock_*blocksize, bsize);
-          cbytes = bsize;
-        }
-        else {
-          /* Regular compression */
-          cbytes = blosc_c(context->parent_context, bsize, leftoverblock, 0, ebsize,
-                           src+nblock_*blocksize, tmp2, tmp);
-        }
-      }
-      else {
-        if (flags & BLOSC_MEMCPYED) {
-          /* We want to memcpy only */
-          memcpy(dest+nblock_*blocksize,
-                 src+BLOSC_MAX_OVERHEAD+nblock_*blocksize, bsize);
-          cbytes = bsize;
-        }
-        else {
-          cbytes = blosc_d(context->parent_context, bsize, leftoverblock,
-                           src + sw32_(bstarts + nblock_ * 4),
-                           dest+nblock_*blocksize,
-                           tmp, tmp2);
-        }
-      }
-
-      /* Check whether current thread has to giveup */
-      if (context->parent_context->thread_giveup_code <= 0) {
-        break;
-      }
+    /* The callback runs before waiters are released */
+    job->result = result;
+    if (job->callback != NULL) {
+      job->callback(result, job->user_data);
+    }
+    pthread_mutex_lock(&job->mutex);
+    job->done = 1;
+    pthread_cond_broadcast(&job->cv);
+    pthread_mutex_unlock(&job->mutex);
+  }
 
-      /* Check results for the compressed/decompressed block */
-      if (cbytes < 0) {            /* compr/decompr failure */
-        /* Set giveup_code error */
-        pthread_mutex_lock(&context->parent_context->count_mutex);
-        context->parent_context->thread_giveup_code = cbytes;
-        pthread_mutex_unlock(&context->parent_context->count_mutex);
-        break;
-      }
+  return(NULL);
+}
 
-      if (compress && !(flags & BLOSC_MEMCPYED)) {
-        /* Start critical section */
-        pthread_mutex_lock(&context->parent_context->count_mutex);
-        ntdest = context->parent_context->num_output_bytes;
-        _sw32(bstarts + nblock_ * 4, ntdest); /* update block start counter */
-        if ( (cbytes == 0) || (ntdest+cbytes > maxbytes) ) {
-          context->parent_context->thread_giveup_code = 0;  /* uncompressible buffer */
-          pthread_mutex_unlock(&context->parent_context->count_mutex);
-          break;
-        }
-        context->parent_context->thread_nblock++;
-        nblock_ = context->parent_context->thread_nblock;
-        context->parent_context->num_output_bytes += cbytes;           /* update return bytes counter */
-        pthread_mutex_unlock(&context->parent_context->count_mutex);
-        /* End of critical section */
-
-        /* Copy the compressed buffer to destination */
-        memcpy(dest+ntdest, tmp2, cbytes);
-      }
-      else {
-        nblock_++;
-        /* Update counter for this thread */
-        ntbytes += cbytes;
-      }
+/* Borrow a pool for `job` and hand the job over to its leader thread.
+   `job->context.numthreads` must be set. */
+static int submit_async(struct blosc_async* job)
+{
+  int rc2;
+  struct thread_pool* pool;
 
-    } /* closes while (nblock_) */
+  job->done = 0;
+  job->result = 0;
+  pthread_mutex_init(&job->mutex, NULL);
+  pthread_cond_init(&job->cv, NULL);
 
-    /* Sum up all the bytes decompressed */
-    if ((!compress || (flags & BLOSC_MEMCPYED)) && context->parent_context->thread_giveup_code > 0) {
-      /* Update global counter for all threads (decompression only) */
-      pthread_mutex_lock(&context->parent_context->count_mutex);
-      context->parent_context->num_output_bytes += ntbytes;
-      pthread_mutex_unlock(&context->parent_context->count_mutex);
+  /* Serial jobs also need a pool, for its leader thread */
+  if (blosc_set_nthreads_(&job->context) < 0) {
+    return -1;
+  }
+  if (job->context.pool == NULL) {
+    job->context.pool = acquire_thread_pool(1, &job->context.allocator);
+    if (job->context.pool == NULL) {
+      return -1;
     }
+  }
+  pool = job->context.pool;
 
-    /* Meeting point for all threads (wait for finalization) */
-    WAIT_FINISH(NULL, context->parent_context);
+  if (!pool->leader_started) {
+    rc2 = pthread_create(&pool->leader, NULL, t_leader, (void *)pool);
+    if (rc2) {
+      fprintf(stderr, "ERROR; return code from pthread_create() is %d\n", rc2);
+      fprintf(stderr, "\tError detail: %s\n", strerror(rc2));
+      blosc_release_threadpool(&job->context);
+      return -1;
+    }
+    pool->leader_started = 1;
   }
 
-  /* Cleanup our working space and context */
-  my_free(context->tmp);
-  my_free(context->tmp2);
-  my_free(context);
+  pthread_mutex_lock(&pool->async_mutex);
+  pool->async_job = job;
+  pthread_cond_signal(&pool->async_cv);
+  pthread_mutex_unlock(&pool->async_mutex);
 
-  return(NULL);
+  return 0;
 }
 
+/* Release an asynchronous job that did not make it to a pool */
+static void discard_async(struct blosc_async* job)
+{
+  struct blosc_allocator allocator = job->context.allocator;
+
+  pthread_mutex_destroy(&job->mutex);
+  pthread_cond_destroy(&job->cv);
+  my_free(&allocator, job);
+}
 
-static int init_threads(struct blosc_context* context)
+struct blosc_async* blosc_compress_async(int clevel, int doshuffle, size_t typesize,
+                                         size_t nbytes, const void* src, void* dest,
+                                         size_t destsize, const char* compressor,
+                                         size_t blocksize, int numinternalthreads,
+                                         blosc_async_callback callback, void* user_data)
 {
-  int32_t tid;
-  int rc2;
-  int32_t ebsize;
-  struct thread_context* thread_context;
+  struct blosc_async* job;
 
-  /* Initialize mutex and condition variable objects */
-  pthread_mutex_init(&context->count_mutex, NULL);
+  job = (struct blosc_async*)my_malloc(&g_allocator, sizeof(struct blosc_async));
+  if (job == NULL) {
+    return NULL;
+  }
+  job->context.pool = NULL;
+  job->context.scratch = NULL;
+  job->context.allocator = g_allocator;
+  job->callback = callback;
+  job->user_data = user_data;
+
+  /* Parameters are checked right away */
+  if (initialize_context_compression(&job->context, clevel, doshuffle, typesize,
+                                     nbytes, src, dest, destsize,
+                                     blosc_compname_to_compcode(compressor),
+                                     blocksize, numinternalthreads, 0) < 0 ||
+      write_compression_header(&job->context, clevel, doshuffle) < 0) {
+    my_free(&g_allocator, job);
+    return NULL;
+  }
 
-  /* Set context thread sentinels */
-  context->thread_giveup_code = 1;
-  context->thread_nblock = -1;
+  if (submit_async(job) < 0) {
+    discard_async(job);
+    return NULL;
+  }
 
-  /* Barrier initialization */
-#ifdef _POSIX_BARRIERS_MINE
-  pthread_barrier_init(&context->barr_init, NULL, context->numthreads+1);
-  pthread_barrier_init(&context->barr_finish, NULL, context->numthreads+1);
-#else
-  pthread_mutex_init(&context->count_threads_mutex, NULL);
-  pthread_cond_init(&context->count_threads_cv, NULL);
-  context->count_threads = 0;      /* Reset threads counter */
-#endif
+  return job;
+}
 
-#if !defined(_WIN32)
-  /* Initialize and set thread detached attribute */
-  pthread_attr_init(&context->ct_attr);
-  pthread_attr_setdetachstate(&context->ct_attr, PTHREAD_CREATE_JOINABLE);
-#endif
+struct blosc_async* blosc_decompress_async(const void *src, void *dest,
+                                           size_t destsize, int numinternalthreads,
+                                           blosc_async_callback callback,
+                                           void* user_data)
+{
+  struct blosc_async* job;
 
-  /* Finally, create the threads in detached state */
-  for (tid = 0; tid < context->numthreads; tid++) {
-    context->tids[tid] = tid;
+  job = (struct blosc_async*)my_malloc(&g_allocator, sizeof(struct blosc_async));
+  if (job == NULL) {
+    return NULL;
+  }
+  job->context.pool = NULL;
+  job->context.scratch = NULL;
+  job->context.allocator = g_allocator;
+  job->context.compress = 0;
+  job->context.numthreads = numinternalthreads;
+  job->src = src;
+  job->dest = dest;
+  job->destsize = destsize;
+  job->callback = callback;
+  job->user_data = user_data;
+
+  if (submit_async(job) < 0) {
+    discard_async(job);
+    return NULL;
+  }
 
-    /* Create a thread context thread owns context (will destroy when finished) */
-    thread_context = (struct thread_context*)my_malloc(sizeof(struct thread_context));
-    thread_context->parent_context = context;
-    thread_context->tid = tid;
+  return job;
+}
 
-    ebsize = context->blocksize + context->typesize * (int32_t)sizeof(int32_t);
-    thread_context->tmp = my_malloc(context->blocksize);
-    thread_context->tmp2 = my_malloc(ebsize);
-    thread_context->tmpblocksize = context->blocksize;
+int blosc_async_poll(struct blosc_async* job)
+{
+  return job->done;
+}
 
-#if !defined(_WIN32)
-    rc2 = pthread_create(&context->threads[tid], &context->ct_attr, t_blosc, (void *)thread_context);
-#else
-    rc2 = pthread_create(&context->threads[tid], NULL, t_blosc, (void *)thread_context);
-#endif
-    if (rc2) {
-      fprintf(stderr, "ERROR; return code from pthread_create() is %d\n", rc2);
-      fprintf(stderr, "\tError detail: %s\n", strerror(rc2));
-      return(-1);
-    }
+int blosc_async_wait(struct blosc_async* job)
+{
+  int result;
+
+  pthread_mutex_lock(&job->mutex);
+  while (!job->done) {
+    pthread_cond_wait(&job->cv, &job->mutex);
   }
+  pthread_mutex_unlock(&job->mutex);
+  result = job->result;
 
+  /* The pool (and its leader) can go back to the cache now */
+  blosc_release_threadpool(&job->context);
+  discard_async(job);
 
-  return(0);
+  return result;
 }
 
+
 int blosc_set_nthreads(int nthreads_new)
 {
   int ret = g_threads;
 
-  /* Re-initialize Blosc */
-  blosc_destroy();
-  blosc_init();
+  /* Pools are borrowed on every call, so there is no need to
+     re-initialize Blosc (but it has to be initialized) */
+  if (!g_initlib) blosc_init();
 
   g_threads = nthreads_new;
 
@@ -1653,15 +5556,16 @@ int blosc_set_nthreads_(struct blosc_context* context)
     return -1;
   }
 
-  /* Launch a new pool of threads */
-  if (context->numthreads > 1 && context->numthreads != context->threads_started) {
+  /* Borrow a pool with the right number of threads */
+  if (context->numthreads > 1 &&
+      (context->pool == NULL || context->pool->nthreads != context->numthreads)) {
     blosc_release_threadpool(context);
-    init_threads(context);
+    context->pool = acquire_thread_pool(context->numthreads, &context->allocator);
+    if (context->pool == NULL) {
+      return -1;
+    }
   }
 
-  /* We have now started the threads */
-  context->threads_started = context->numthreads;
-
   return context->numthreads;
 }
 
@@ -1752,17 +5656,23 @@ void blosc_cbuffer_sizes(const void *cbuffer, size_t *nbytes,
   uint8_t *_src = (uint8_t *)(cbuffer);    /* current pos for source buffer */
   uint8_t version, versionlz;              /* versions for compressed header */
 
-  /* Read the version info (could be useful in the future) */
+  /* Read the version info */
   version = _src[0];                       /* blosc format version */
   versionlz = _src[1];                     /* blosclz format version */
 
-  version += 0;                            /* shut up compiler warning */
   versionlz += 0;                          /* shut up compiler warning */
 
   /* Read the interesting values */
-  *nbytes = (size_t)sw32_(_src + 4);       /* uncompressed buffer size */
-  *blocksize = (size_t)sw32_(_src + 8);    /* block size */
-  *cbytes = (size_t)sw32_(_src + 12);      /* compressed buffer size */
+  if (version == BLOSC_VERSION_FORMAT64) {
+    *blocksize = (size_t)sw32_(_src + 4);  /* block size */
+    *nbytes = (size_t)sw64_(_src + 8);     /* uncompressed buffer size */
+    *cbytes = (size_t)sw64_(_src + 16);    /* compressed buffer size */
+  }
+  else {
+    *nbytes = (size_t)sw32_(_src + 4);     /* uncompressed buffer size */
+    *blocksize = (size_t)sw32_(_src + 8);  /* block size */
+    *cbytes = (size_t)sw32_(_src + 12);    /* compressed buffer size */
+  }
 }
 
 
@@ -1819,71 +5729,175 @@ void blosc_set_blocksize(size_t size)
   g_force_blocksize = (int32_t)size;
 }
 
-void blosc_init(void)
+/* Choose whether compressed blocks are laid out in block order (1,
+   the default) or as soon as threads are done with them (0). */
+void blosc_set_deterministic(int deterministic)
 {
-  pthread_mutex_init(&global_comp_mutex, NULL);
-  g_global_context = (struct blosc_context*)my_malloc(sizeof(struct blosc_context));
-  g_global_context->threads_started = 0;
-  g_initlib = 1;
+  g_deterministic = deterministic ? 1 : 0;
 }
 
-void blosc_destroy(void)
+/* Choose whether compressed blocks get checksums (1) or not (0, the
+   default). */
+void blosc_set_checksums(int checksums)
 {
-  g_initlib = 0;
-  blosc_release_threadpool(g_global_context);
-  my_free(g_global_context);
-  pthread_mutex_destroy(&global_comp_mutex);
+  g_checksums = checksums ? 1 : 0;
 }
 
-int blosc_release_threadpool(struct blosc_context* context)
+/* Set the number of iterations that threads spin at barriers before
+   going to sleep.  Returns the previous budget. */
+int blosc_set_spin_budget(int budget)
 {
-  int32_t t;
-  void* status;
-  int rc;
-  int rc2;
+  int32_t old_budget = g_spin_budget;
 
-  if (context->threads_started > 0)
-  {
-    /* Tell all existing threads to finish */
-    context->end_threads = 1;
-
-    /* Sync threads */
-    WAIT_INIT(-1, context);
-
-    /* Join exiting threads */
-    for (t=0; t<context->threads_started; t++) {
-      rc2 = pthread_join(context->threads[t], &status);
-      if (rc2) {
-        fprintf(stderr, "ERROR; return code from pthread_join() is %d\n", rc2);
-        fprintf(stderr, "\tError detail: %s\n", strerror(rc2));
-      }
+  g_spin_budget = (budget < 0) ? 0 : budget;
+  return old_budget;
+}
+
+/* Register the executor for running parallel jobs (NULL for using
+   Blosc's own threads). */
+void blosc_set_executor(blosc_executor executor, void* executor_data)
+{
+  g_executor = executor;
+  g_executor_data = executor_data;
+}
+
+int blosc_set_allocator(blosc_alloc_fn alloc_fn, blosc_free_fn free_fn,
+                        void* allocator_data)
+{
+  if ((alloc_fn == NULL) != (free_fn == NULL)) {
+    fprintf(stderr, "Error.  Both alloc and free functions must be given\n");
+    return -1;
+  }
+  /* Idle pools come from the previous allocator */
+  drain_thread_pool_cache();
+  g_allocator.alloc = alloc_fn;
+  g_allocator.free = free_fn;
+  g_allocator.data = allocator_data;
+  return 0;
+}
+
+#if defined(HAVE_NUMA)
+/* Add the CPUs in `list` (like "0-3,8-11") to `cpus` */
+static void parse_cpulist(const char* list, cpu_set_t* cpus)
+{
+  char* end;
+  long first, last, cpu;
+
+  while (*list >= '0' && *list <= '9') {
+    first = strtol(list, &end, 10);
+    last = first;
+    if (*end == '-') {
+      last = strtol(end + 1, &end, 10);
+    }
+    for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+      CPU_SET(cpu, cpus);
+    }
+    list = (*end == ',') ? end + 1 : end;
+  }
+}
+
+/* Find out the NUMA nodes having CPUs, and which CPUs they have */
+static int32_t probe_numa_nodes(void)
+{
+  char path[64];
+  char list[4096];
+  FILE* f;
+  size_t len;
+  int32_t node, nnodes = 0;
+
+  for (node = 0; node < MAX_NUMA_NODES; node++) {
+    g_node_index[node] = -1;
+    sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+    f = fopen(path, "r");
+    if (f == NULL) {
+      continue;
+    }
+    len = fread(list, 1, sizeof(list) - 1, f);
+    fclose(f);
+    list[len] = '\0';
+    CPU_ZERO(&g_node_cpus[nnodes]);
+    parse_cpulist(list, &g_node_cpus[nnodes]);
+    if (CPU_COUNT(&g_node_cpus[nnodes]) > 0) {
+      g_node_index[node] = nnodes++;
     }
+  }
+  return nnodes;
+}
+#endif  /* HAVE_NUMA */
 
-    /* Release mutex and condition variable objects */
-    pthread_mutex_destroy(&context->count_mutex);
+/* Enable or disable NUMA-aware scheduling.  Returns the number of NUMA
+   nodes found. */
+int blosc_set_numa(int numa)
+{
+#if defined(HAVE_NUMA)
+  if (g_numa_nodes == 0) {
+    g_numa_nodes = probe_numa_nodes();
+  }
+#endif
+  g_numa = numa ? 1 : 0;
+  return g_numa_nodes;
+}
 
-    /* Barriers */
-  #ifdef _POSIX_BARRIERS_MINE
-      pthread_barrier_destroy(&context->barr_init);
-      pthread_barrier_destroy(&context->barr_finish);
-  #else
-      pthread_mutex_destroy(&context->count_threads_mutex);
-      pthread_cond_destroy(&context->count_threads_cv);
-  #endif
+int blosc_set_hugepages(int hugepages)
+{
+#if defined(HAVE_HUGEPAGES)
+  g_hugepages = hugepages ? 1 : 0;
+  return 1;
+#else
+  (void)hugepages;
+  return 0;
+#endif
+}
 
-      /* Thread attributes */
-  #if !defined(_WIN32)
-      pthread_attr_destroy(&context->ct_attr);
-  #endif
+void blosc_init(void)
+{
+  pthread_mutex_init(&g_contexts_mutex, NULL);
+  pthread_key_create(&g_context_key, free_global_context);
+  g_contexts = NULL;
+  g_initlib = 1;
+}
 
+void blosc_destroy(void)
+{
+  struct blosc_context* context;
+  struct blosc_allocator allocator;
+
+  g_initlib = 0;
+  /* Free the contexts of all the threads (including the ones that are
+     still alive) */
+  pthread_key_delete(g_context_key);
+  pthread_mutex_lock(&g_contexts_mutex);
+  while (g_contexts != NULL) {
+    context = g_contexts;
+    g_contexts = context->next;
+    blosc_release_threadpool(context);
+    free_thread_context(context->scratch);
+    allocator = context->allocator;
+    my_free(&allocator, context);
   }
+  pthread_mutex_unlock(&g_contexts_mutex);
+  pthread_mutex_destroy(&g_contexts_mutex);
+
+  /* Join the threads of all the idle pools, as nothing is to run them
+     anymore */
+  drain_thread_pool_cache();
+}
 
-  context->threads_started = 0;
+int blosc_release_threadpool(struct blosc_context* context)
+{
+  if (context->pool != NULL) {
+    recycle_thread_pool(context->pool);
+    context->pool = NULL;
+  }
 
   return 0;
 }
 
 int blosc_free_resources(void)
 {
-  return blosc_release_threadpool(g_global_context);
+  /* Contexts of the global API do not keep pools between calls, so
+     all the idle pools are in the cache (or are the global one) */
+  drain_thread_pool_cache();
+
+  return 0;
 }
@@ -10,6 +10,12 @@
 
 #include <limits.h>
 #include <stdlib.h>
+#if defined(_MSC_VER) && (_MSC_VER < 1600)
+  /* stdint.h only available in VS2010 (VC++ 16.0) and newer */
+  #include "win32/stdint-windows.h"
+#else
+  #include <stdint.h>
+#endif
 #include "blosc-export.h"
 
 #ifdef __cplusplus
@@ -41,6 +47,19 @@ extern "C" {
 /* Maximum source buffer size to be compressed */
 #define BLOSC_MAX_BUFFERSIZE (INT_MAX - BLOSC_MAX_OVERHEAD)
 
+/* Format version of buffers with 64-bit sizes and block starts, as
+   written by blosc_compress64() */
+#define BLOSC_VERSION_FORMAT64  3
+
+/* Header length of buffers with 64-bit sizes */
+#define BLOSC_HEADER64_LENGTH 32
+
+/* The maximum overhead during compression with blosc_compress64() */
+#define BLOSC_MAX_OVERHEAD64 BLOSC_HEADER64_LENGTH
+
+/* Maximum source buffer size to be compressed with blosc_compress64() */
+#define BLOSC_MAX_BUFFERSIZE64 (INT64_MAX - BLOSC_MAX_OVERHEAD64)
+
 /* Maximum typesize before considering source buffer as a stream of bytes */
 #define BLOSC_MAX_TYPESIZE 255         /* Cannot be larger than 255 */
 
@@ -50,6 +69,7 @@ extern "C" {
 /* Codes for internal flags (see blosc_cbuffer_metainfo) */
 #define BLOSC_DOSHUFFLE 0x1
 #define BLOSC_MEMCPYED  0x2
+#define BLOSC_DOCHECKSUM 0x4
 
 /* Codes for the different compressors shipped with Blosc */
 #define BLOSC_BLOSCLZ   0
@@ -98,10 +118,17 @@ extern "C" {
 /**
   Initialize the Blosc library environment.
 
-  You must call this previous to any other Blosc call, unless you want
-  Blosc to be used simultaneously in a multi-threaded environment, in
-  which case you should *exclusively* use the
-  blosc_compress_ctx()/blosc_decompress_ctx() pair (see below).
+  You must call this previous to any other Blosc call, unless you
+  *exclusively* use the blosc_compress_ctx()/blosc_decompress_ctx()
+  pair (see below).  After this, blosc_compress() and
+  blosc_decompress() can be called simultaneously from several
+  threads: each calling thread gets its own context, and all of them
+  share one pool of threads (see blosc_set_nthreads()), so that the
+  number of threads does not grow with the number of callers.
+  Global settings (compressor, number of threads...) are not meant to
+  be changed while other threads are compressing or decompressing.
+  Threads are created on first use and kept until blosc_destroy() (or
+  blosc_free_resources()).
   */
 BLOSC_EXPORT void blosc_init(void);
 
@@ -111,7 +138,10 @@ BLOSC_EXPORT void blosc_init(void);
 
   You must call this after to you are done with all the Blosc calls,
   unless you have not used blosc_init() before (see blosc_init()
-  above).
+  above).  It frees the contexts of all the threads that used
+  blosc_compress() or blosc_decompress(), and stops the idle threads
+  of the pools kept for later calls (see blosc_free_resources()).  No
+  Blosc call may be running in other threads at that point.
   */
 BLOSC_EXPORT void blosc_destroy(void);
 
@@ -157,9 +187,8 @@ BLOSC_EXPORT int blosc_compress(int clevel, int doshuffle, size_t typesize,
 
 /**
   Context interface to blosc compression. This does not require a call
-  to blosc_init() and can be called from multithreaded applications
-  without the global lock being used, so allowing Blosc be executed
-  simultaneously in those scenarios.
+  to blosc_init() and can be called from multithreaded applications,
+  so allowing Blosc be executed simultaneously in those scenarios.
 
   It uses the same parameters than the blosc_compress() function plus:
 
@@ -168,7 +197,10 @@ BLOSC_EXPORT int blosc_compress(int clevel, int doshuffle, size_t typesize,
   `blocksize`: the requested size of the compressed blocks.  If 0, an
    automatic blocksize will be used.
 
-  `numinternalthreads`: the number of threads to use internally.
+  `numinternalthreads`: the number of threads to use internally.  The
+   threads are borrowed from a process-wide cache of thread pools and
+   given back when the call finishes, so they are only created the
+   first time a given number of threads is requested.
 
   A negative return value means that an internal error happened.  This
   should never happen.  If you see this, please report it back
@@ -198,12 +230,14 @@ BLOSC_EXPORT int blosc_decompress(const void *src, void *dest, size_t destsize);
 /**
   Context interface to blosc decompression. This does not require a
   call to blosc_init() and can be called from multithreaded
-  applications without the global lock being used, so allowing Blosc
-  be executed simultaneously in those scenarios.
+  applications, so allowing Blosc be executed simultaneously in those
+  scenarios.
 
   It uses the same parameters than the blosc_decompress() function plus:
 
-  `numinternalthreads`: number of threads to use internally.
+  `numinternalthreads`: number of threads to use internally.  As in
+   blosc_compress_ctx(), threads come from the process-wide cache of
+   thread pools.
 
   Decompression is memory safe and guaranteed not to write the `dest`
   buffer more than what is specified in `destsize`.
@@ -215,6 +249,479 @@ BLOSC_EXPORT int blosc_decompress(const void *src, void *dest, size_t destsize);
 BLOSC_EXPORT int blosc_decompress_ctx(const void *src, void *dest,
                                           size_t destsize, int numinternalthreads);
 
+
+/**
+  Compress buffers of any size, up to BLOSC_MAX_BUFFERSIZE64 bytes.
+  The parameters are the same as in blosc_compress(), and all the
+  blocks are (de-)compressed in one single parallel job.
+
+  The result is written with a 32-byte header holding 64-bit sizes and
+  block starts (format version BLOSC_VERSION_FORMAT64), which is only
+  understood by Blosc 1.7.0 and newer.  Set `destsize` to at least
+  (`nbytes`+BLOSC_MAX_OVERHEAD64) for compression to always succeed.
+
+  Returns the size of the compressed buffer, 0 if it does not fit in
+  `destsize`, or a negative value if an internal error happened.
+*/
+BLOSC_EXPORT int64_t blosc_compress64(int clevel, int doshuffle, size_t typesize,
+                                      size_t nbytes, const void *src, void *dest,
+                                      size_t destsize);
+
+/**
+  Decompress a buffer written by any of the compression functions, as
+  blosc_decompress() does, whatever its size.
+
+  The rest of decompression functions handle buffers with 64-bit
+  headers too, as long as their uncompressed size fits in an int.
+
+  Returns the size of the decompressed buffer, or 0 (zero) or a
+  negative value if an error occurs.
+*/
+BLOSC_EXPORT int64_t blosc_decompress64(const void *src, void *dest, size_t destsize);
+
+
+/* Receives decompressed block `nblock` (`nbytes` long).  Returns a
+   negative value to stop the decompression. */
+typedef int (*blosc_apply_fn)(int nblock, const void *block, size_t nbytes,
+                              void *apply_data);
+
+/**
+  Decompress `src` without writing it anywhere: every block is
+  decompressed into the working space of a thread, and `apply` is
+  called on it right away by the same thread, while it is still in
+  cache.  This lets sums, filters or conversions run along with the
+  decompression.
+
+  With `numinternalthreads` above 1, `apply` is called from several
+  threads at the same time, and blocks come in no particular order.
+  The block is only valid during the call.
+
+  Returns the number of decompressed bytes, the value returned by
+  `apply` if it is negative, or another negative value if an error
+  occurs.
+*/
+BLOSC_EXPORT int64_t blosc_decompress_apply(const void *src, blosc_apply_fn apply,
+                                            void *apply_data,
+                                            int numinternalthreads);
+
+
+/* Allocates `size` bytes aligned to `alignment` (a power of 2), or
+   returns NULL.  `allocator_data` is the one given at registration. */
+typedef void* (*blosc_alloc_fn)(size_t size, size_t alignment,
+                                void *allocator_data);
+
+/* Releases a block returned by the matching blosc_alloc_fn */
+typedef void (*blosc_free_fn)(void *ptr, void *allocator_data);
+
+/* A reusable compression/decompression context */
+struct blosc_ctx;
+
+/**
+  Create a context for compressing and decompressing many buffers with
+  the same parameters, which have the same meaning as in
+  blosc_compress_ctx().  The context keeps its scratch buffers and its
+  pool of threads between calls, so that repeated calls on buffers of
+  similar sizes do not allocate memory.  A context can be used by only
+  one thread at a time.
+
+  Returns NULL if the parameters are wrong or memory is exhausted.
+*/
+BLOSC_EXPORT struct blosc_ctx* blosc_create_ctx(const char* compressor, int clevel,
+                                                int doshuffle, size_t typesize,
+                                                size_t blocksize,
+                                                int numinternalthreads);
+
+/**
+  Compress `nbytes` of `src` into `dest` using the parameters of `ctx`.
+  The return value is the same as for blosc_compress().
+*/
+BLOSC_EXPORT int blosc_compress_with_ctx(struct blosc_ctx* ctx, size_t nbytes,
+                                         const void* src, void* dest, size_t destsize);
+
+/**
+  Decompress `src` into `dest` using the threads of `ctx`.  The return
+  value is the same as for blosc_decompress().
+*/
+BLOSC_EXPORT int blosc_decompress_with_ctx(struct blosc_ctx* ctx, const void* src,
+                                           void* dest, size_t destsize);
+
+/**
+  Make `ctx` allocate its scratch buffers, its pool of threads and the
+  state of the codecs from `alloc_fn` and `free_fn` (see
+  blosc_set_allocator()), instead of the allocator that was in place
+  when it was created.  The working space from the previous allocator
+  is released right away.  Passing NULL for both functions goes back
+  to the default allocator.
+
+  Returns 0 on success, or -1 if only one function is given or memory
+  is exhausted.
+*/
+BLOSC_EXPORT int blosc_ctx_set_allocator(struct blosc_ctx* ctx,
+                                         blosc_alloc_fn alloc_fn,
+                                         blosc_free_fn free_fn,
+                                         void* allocator_data);
+
+/**
+  Release `ctx`, its scratch buffers and its pool of threads.
+*/
+BLOSC_EXPORT void blosc_free_ctx(struct blosc_ctx* ctx);
+
+
+/* An append-only sequence of compressed chunks (a super-chunk) */
+struct blosc_schunk;
+
+/**
+  Create an empty super-chunk.  All its chunks are compressed with the
+  parameters given here, which have the same meaning as in
+  blosc_create_ctx(); the context is kept for the life of the
+  super-chunk.  Chunks are stored one after the other in a single
+  buffer, along with an index of where each one starts, so that
+  looking a chunk up takes constant time.  A super-chunk can be used
+  by only one thread at a time.
+
+  Returns NULL if the parameters are wrong or memory is exhausted.
+*/
+BLOSC_EXPORT struct blosc_schunk* blosc_schunk_new(const char* compressor,
+                                                   int clevel, int doshuffle,
+                                                   size_t typesize,
+                                                   size_t blocksize,
+                                                   int numinternalthreads);
+
+/**
+  Compress `nbytes` of `src` (at most BLOSC_MAX_BUFFERSIZE) as a new
+  chunk at the end of `schunk`.
+
+  Returns the index of the new chunk, or a negative value if an error
+  occurs.
+*/
+BLOSC_EXPORT int64_t blosc_schunk_append(struct blosc_schunk* schunk,
+                                         const void* src, size_t nbytes);
+
+/**
+  Return the number of chunks in `schunk`.  Chunks are numbered from 0
+  on, in the order they were appended, so iterating over them is a
+  loop up to this number.
+*/
+BLOSC_EXPORT int64_t blosc_schunk_nchunks(const struct blosc_schunk* schunk);
+
+/**
+  Get the uncompressed (`nbytes`) and compressed (`cbytes`) size of all
+  the chunks of `schunk`.
+*/
+BLOSC_EXPORT void blosc_schunk_sizes(const struct blosc_schunk* schunk,
+                                     int64_t* nbytes, int64_t* cbytes);
+
+/**
+  Point `chunk` to the compressed chunk `nchunk` of `schunk`, which is
+  a regular Blosc buffer of `cbytes` bytes.  The pointer is valid until
+  the next chunk is appended.
+
+  Returns 0 on success, or -1 if there is no such chunk.
+*/
+BLOSC_EXPORT int blosc_schunk_get_chunk(const struct blosc_schunk* schunk,
+                                        int64_t nchunk, const void** chunk,
+                                        size_t* cbytes);
+
+/**
+  Decompress chunk `nchunk` of `schunk` into `dest`, with the threads
+  of the super-chunk.  The return value is the same as for
+  blosc_decompress().
+*/
+BLOSC_EXPORT int blosc_schunk_decompress_chunk(struct blosc_schunk* schunk,
+                                               int64_t nchunk, void* dest,
+                                               size_t destsize);
+
+/**
+  Serialize `schunk` into the contiguous buffer `dest`: a 64-byte
+  header with the compression parameters and sizes, the chunks, and
+  the offset index, compressed.  Passing NULL for `dest` returns the
+  maximum size that the serialized super-chunk can take.
+
+  Returns the number of bytes written, 0 if they do not fit in
+  `destsize`, or a negative value if an error occurs.
+*/
+BLOSC_EXPORT int64_t blosc_schunk_serialize(struct blosc_schunk* schunk,
+                                            void* dest, size_t destsize);
+
+/**
+  Create a super-chunk out of one serialized in `buffer` (of `size`
+  bytes).  The chunks are copied, so that more can be appended and
+  `buffer` can be released.
+
+  Returns NULL if `buffer` is not a valid super-chunk, or memory is
+  exhausted.
+*/
+BLOSC_EXPORT struct blosc_schunk* blosc_schunk_from_buffer(const void* buffer,
+                                                           size_t size,
+                                                           int numinternalthreads);
+
+/**
+  Serialize `schunk` into file `filename`, as blosc_schunk_serialize()
+  does.
+
+  Returns 0 on success, or -1 if an error occurs.
+*/
+BLOSC_EXPORT int blosc_schunk_save(struct blosc_schunk* schunk,
+                                   const char* filename);
+
+/**
+  Read a super-chunk from file `filename`, as written by
+  blosc_schunk_save().
+
+  Returns NULL if the file cannot be read or is not a valid super-chunk.
+*/
+BLOSC_EXPORT struct blosc_schunk* blosc_schunk_load(const char* filename,
+                                                    int numinternalthreads);
+
+/**
+  Release `schunk`, its chunks and its context.
+*/
+BLOSC_EXPORT void blosc_schunk_free(struct blosc_schunk* schunk);
+
+
+/* A compression stream, fed with data as it comes */
+struct blosc_stream;
+
+/* Receives `size` bytes of compressed output that go at `offset` in
+   the compressed buffer.  Returns a negative value on failure. */
+typedef int (*blosc_stream_write_fn)(const void *data, size_t size,
+                                     int64_t offset, void *user_data);
+
+/**
+  Create a stream that compresses data pushed in pieces of any size
+  into a regular Blosc buffer, without holding the whole of it.  The
+  parameters have the same meaning as in blosc_create_ctx().
+  `maxbytes` is the most bytes the stream will get (streams past
+  BLOSC_MAX_BUFFERSIZE get a 64-bit header, see blosc_compress64()).
+
+  Every group of `numinternalthreads` blocks is compressed in parallel
+  as soon as it is full, and the compressed blocks are handed to
+  `write` right away, in order.  The header and the block starts go in
+  front of the blocks, so they are handed over by
+  blosc_stream_finish(), at offset 0.  The room for them is worked out
+  from `maxbytes`, which is why it must be given beforehand.
+
+  Returns NULL if the parameters are wrong or memory is exhausted.
+*/
+BLOSC_EXPORT struct blosc_stream* blosc_stream_new(const char* compressor,
+                                                   int clevel, int doshuffle,
+                                                   size_t typesize,
+                                                   size_t blocksize,
+                                                   int numinternalthreads,
+                                                   size_t maxbytes,
+                                                   blosc_stream_write_fn write,
+                                                   void* user_data);
+
+/**
+  Push `nbytes` of `src` into `stream`.
+
+  Returns 0 on success, or -1 if `maxbytes` is exceeded, or compressing
+  or writing failed.  After an error, the stream can only be released.
+*/
+BLOSC_EXPORT int blosc_stream_write(struct blosc_stream* stream,
+                                    const void* src, size_t nbytes);
+
+/**
+  Compress the data left in `stream` and write the header and the
+  block starts.  No more data can be pushed afterwards.
+
+  Returns the size of the compressed buffer, or -1 if an error occurs.
+*/
+BLOSC_EXPORT int64_t blosc_stream_finish(struct blosc_stream* stream);
+
+/**
+  Release `stream` and its working space.
+*/
+BLOSC_EXPORT void blosc_stream_free(struct blosc_stream* stream);
+
+
+/* A decoder handing out the blocks of a compressed buffer in order */
+struct blosc_decoder;
+
+/**
+  Create a decoder for the compressed buffer `src`, for consuming it
+  block by block without a destination for all of it.  `src` must stay
+  around while the decoder is used.
+
+  With `numinternalthreads` above 1, the decoder reads ahead: the next
+  `numinternalthreads` blocks are decompressed at once in parallel, and
+  handed out one by one afterwards.  Memory used is the size of those
+  blocks, whatever the size of the buffer.
+
+  Returns NULL if `numinternalthreads` is wrong or memory is exhausted.
+*/
+BLOSC_EXPORT struct blosc_decoder* blosc_decoder_new(const void* src,
+                                                     int numinternalthreads);
+
+/**
+  Point `block` to the next decompressed block of `decoder`.  The data
+  is valid until the next call.
+
+  Returns the size of the block, 0 when all of them have been handed
+  out, or a negative value if an error occurs.
+*/
+BLOSC_EXPORT int blosc_decoder_next(struct blosc_decoder* decoder,
+                                    const void** block);
+
+/**
+  Make `decoder` start again from the first block.
+*/
+BLOSC_EXPORT void blosc_decoder_rewind(struct blosc_decoder* decoder);
+
+/**
+  Release `decoder` and its working space.
+*/
+BLOSC_EXPORT void blosc_decoder_free(struct blosc_decoder* decoder);
+
+
+/* A reader for compressed buffers laid out in a region of memory */
+struct blosc_reader;
+
+/**
+  Create a reader for the compressed buffers (chunks) in the `size`
+  bytes at `region`, typically a file mapped with mmap().  The chunk
+  number `i` starts at byte `offsets[i]` of the region, for `i` below
+  `nchunks`.  `offsets` is copied, but `region` must stay around while
+  the reader is used.
+
+  Reads only touch the header of the chunk, the block starts of the
+  blocks with bytes in the range asked for and those blocks, so that
+  page faults and I/O go with the size of the range and not with the
+  size of the chunk.  Blocks are decompressed using
+  `numinternalthreads` threads.
+
+  A reader is not meant to be used by several threads at the same time.
+
+  Returns NULL if `numinternalthreads` or `nchunks` are wrong or memory
+  is exhausted.
+*/
+BLOSC_EXPORT struct blosc_reader* blosc_reader_new(const void* region,
+                                                   size_t size,
+                                                   const int64_t* offsets,
+                                                   int64_t nchunks,
+                                                   int numinternalthreads);
+
+/**
+  Return the number of uncompressed bytes of the chunk `nchunk` of
+  `reader`, or a negative value if it is not in the region.
+*/
+BLOSC_EXPORT int64_t blosc_reader_nbytes(struct blosc_reader* reader,
+                                         int64_t nchunk);
+
+/**
+  Decompress the `nbytes` bytes starting at byte `start` of the chunk
+  `nchunk` of `reader` into `dest`, which must have room for them.
+
+  Returns `nbytes`, or a negative value if the chunk is not in the
+  region, the range is out of the chunk or the data is corrupted.
+*/
+BLOSC_EXPORT int64_t blosc_reader_read(struct blosc_reader* reader,
+                                       int64_t nchunk, int64_t start,
+                                       int64_t nbytes, void* dest);
+
+/**
+  Release `reader` and its working space.  The region is left alone.
+*/
+BLOSC_EXPORT void blosc_reader_free(struct blosc_reader* reader);
+
+
+/* A handle to a compression/decompression running in the background */
+struct blosc_async;
+
+/* Called with the result of an asynchronous job and its `user_data` */
+typedef void (*blosc_async_callback)(int result, void *user_data);
+
+/**
+  Asynchronous version of blosc_compress_ctx().  The parameters are
+  checked and the header is written right away, then the compression
+  is handed over to a pool of `numinternalthreads` threads (borrowed
+  from the same cache as the context functions) and this returns
+  without waiting for it.  `src` and `dest` must stay untouched until
+  the job is done.
+
+  If `callback` is not NULL, it is called from an internal thread with
+  the return value of the compression and `user_data`, once the job is
+  done and before blosc_async_wait() returns.  It must not wait for
+  its own job.
+
+  Returns a handle for blosc_async_poll() and blosc_async_wait(), or
+  NULL if the parameters are wrong or resources are exhausted.  Every
+  handle must be passed to blosc_async_wait() exactly once.
+*/
+BLOSC_EXPORT struct blosc_async* blosc_compress_async(int clevel, int doshuffle,
+                                                      size_t typesize, size_t nbytes,
+                                                      const void* src, void* dest,
+                                                      size_t destsize,
+                                                      const char* compressor,
+                                                      size_t blocksize,
+                                                      int numinternalthreads,
+                                                      blosc_async_callback callback,
+                                                      void* user_data);
+
+/**
+  Asynchronous version of blosc_decompress_ctx().  It works as
+  blosc_compress_async(), and the result passed to `callback` and
+  returned by blosc_async_wait() is the one of blosc_decompress_ctx().
+*/
+BLOSC_EXPORT struct blosc_async* blosc_decompress_async(const void *src, void *dest,
+                                                        size_t destsize,
+                                                        int numinternalthreads,
+                                                        blosc_async_callback callback,
+                                                        void* user_data);
+
+/**
+  Return 1 if the asynchronous `job` is done (its callback included),
+  or 0 if it is still running.  This never blocks.
+*/
+BLOSC_EXPORT int blosc_async_poll(struct blosc_async* job);
+
+/**
+  Wait for the asynchronous `job` to finish and return its result
+  (the same as for the synchronous function).  This releases the
+  handle, which cannot be used anymore afterwards.
+*/
+BLOSC_EXPORT int blosc_async_wait(struct blosc_async* job);
+
+
+/* A buffer to be (de-)compressed by the batch functions */
+struct blosc_batch_item {
+  const void *src;
+  void *dest;
+  size_t nbytes;            /* bytes in `src` (compression only) */
+  size_t destsize;          /* room in `dest` */
+  int clevel;               /* compression parameters, as in */
+  int doshuffle;            /*   blosc_compress_ctx() (not used */
+  size_t typesize;          /*   for decompression) */
+  const char *compressor;
+  int result;               /* output: what the _ctx function returns */
+};
+
+/**
+  Compress the `nitems` buffers described in `items` in one go.  Every
+  item is compressed as blosc_compress_ctx() would do with its
+  parameters and `blocksize`, and the return value of that function is
+  left in its `result` field.
+
+  The blocks of all the buffers are handed out to the
+  `numinternalthreads` threads as one single job, so that many small
+  buffers keep the threads as busy as one large buffer does.
+
+  Returns 0 when all the items have been processed (look at their
+  `result` for how each one went) or a negative value if the batch
+  could not be run at all.
+*/
+BLOSC_EXPORT int blosc_compress_batch(struct blosc_batch_item* items, int nitems,
+                                      size_t blocksize, int numinternalthreads);
+
+/**
+  Decompress the `nitems` buffers described in `items` in one go.  The
+  `src`, `dest` and `destsize` fields are used as in
+  blosc_decompress_ctx(), whose return value is left in `result`.  The
+  rest works as in blosc_compress_batch().
+*/
+BLOSC_EXPORT int blosc_decompress_batch(struct blosc_batch_item* items, int nitems,
+                                        int numinternalthreads);
+
 /**
   Get `nitems` (of typesize size) in `src` buffer starting in `start`.
   The items are returned in `dest` buffer, which has to have enough
@@ -227,10 +734,14 @@ BLOSC_EXPORT int blosc_getitem(const void *src, int start, int nitems, void *des
 
 
 /**
-  Initialize a pool of threads for compression/decompression.  If
-  `nthreads` is 1, then the serial version is chosen and a possible
-  previous existing pool is ended.  If this is not called, `nthreads`
-  is set to 1 internally.
+  Set the number of threads for compression/decompression.  If
+  `nthreads` is 1, then the serial version is chosen.  If this is not
+  called, `nthreads` is set to 1 internally.  All the calls to
+  blosc_compress() and blosc_decompress() share one pool of threads,
+  which is lent to one call at a time: calls made while another one is
+  using it run serially in their calling thread.  The calling thread
+  counts as one of the `nthreads`: it does its share of the work, so
+  only `nthreads` - 1 threads are created in the pool.
 
   Returns the previous number of threads.
   */
@@ -301,9 +812,10 @@ BLOSC_EXPORT int blosc_get_complib_info(char *compname, char **complib, char **v
 
 /**
   Free possible memory temporaries and thread resources.  Use this
-  when you are not going to use Blosc for a long while.  In case of
-  problems releasing the resources, it returns a negative number, else
-  it returns 0.
+  when you are not going to use Blosc for a long while.  This also
+  terminates the idle thread pools cached for the context functions.
+  In case of problems releasing the resources, it returns a negative
+  number, else it returns 0.
   */
 BLOSC_EXPORT int blosc_free_resources(void);
 
@@ -315,7 +827,8 @@ BLOSC_EXPORT int blosc_free_resources(void);
   compression by blocks).
 
   You only need to pass the first BLOSC_MIN_HEADER_LENGTH bytes of a
-  compressed buffer for this call to work.
+  compressed buffer (BLOSC_HEADER64_LENGTH bytes for buffers written by
+  blosc_compress64()) for this call to work.
 
   This function should always succeed.
   */
@@ -330,10 +843,12 @@ BLOSC_EXPORT void blosc_cbuffer_sizes(const void *cbuffer, size_t *nbytes,
   The `flags` is a set of bits, where the currently used ones are:
     * bit 0: whether the shuffle filter has been applied or not
     * bit 1: whether the internal buffer is a pure memcpy or not
+    * bit 2: whether the blocks come with checksums or not
 
-  You can use the `BLOSC_DOSHUFFLE` and `BLOSC_MEMCPYED` symbols for
-  extracting the interesting bits (e.g. ``flags & BLOSC_DOSHUFFLE``
-  says whether the buffer is shuffled or not).
+  You can use the `BLOSC_DOSHUFFLE`, `BLOSC_MEMCPYED` and
+  `BLOSC_DOCHECKSUM` symbols for extracting the interesting bits
+  (e.g. ``flags & BLOSC_DOSHUFFLE`` says whether the buffer is
+  shuffled or not).
 
   This function should always succeed.
   */
@@ -374,6 +889,137 @@ BLOSC_EXPORT char *blosc_cbuffer_complib(const void *cbuffer);
   */
 BLOSC_EXPORT void blosc_set_blocksize(size_t blocksize);
 
+/**
+  Choose the layout of the blocks in buffers compressed with several
+  threads.  If 1 (the default), blocks are staged by the threads and
+  then written in block order, so the compressed buffer is
+  byte-identical regardless of the number of threads.  If 0, every
+  block is written as soon as its thread is done with it, which saves
+  a copy but makes the output depend on the thread timing.  Both
+  layouts are decompressed in the same way.
+  */
+BLOSC_EXPORT void blosc_set_deterministic(int deterministic);
+
+
+/**
+  Enable (1) or disable (0, the default) block checksums in the
+  buffers compressed from now on.  Every compressed block gets a
+  CRC32C of its bytes, stored after the block starts, and the
+  `BLOSC_DOCHECKSUM` flag is set in the header.  Blocks are checked
+  before being decompressed, and a corrupted one makes the
+  decompression fail instead of handing out garbage.  The CRC32C uses
+  the SSE4.2 instructions when the processor has them.
+
+  Memcpy'ed buffers carry no checksums.  Buffers with checksums are
+  still decompressed by previous versions of Blosc, which skip them.
+  */
+BLOSC_EXPORT void blosc_set_checksums(int checksums);
+
+
+/**
+  Set the number of iterations that threads spin at the barriers
+  which delimit every parallel job before going to sleep.  The actual
+  spin adapts to how long waits were in previous jobs, but never
+  exceeds `budget`.  Larger budgets lower the latency of the threaded
+  code on small buffers at the cost of burning more CPU while waiting;
+  0 makes threads sleep right away.  The default is 2000.
+
+  Returns the previous budget.
+  */
+BLOSC_EXPORT int blosc_set_spin_budget(int budget);
+
+
+/**
+  Enable (1) or disable (0, the default) NUMA-aware scheduling.  When
+  enabled on a machine with several NUMA nodes, the threads of new
+  pools are pinned to the CPUs of the nodes (spread evenly), and every
+  thread first takes the blocks whose source (compression) or
+  destination (decompression) lives in the memory of its own node.
+  Destination pages that are not touched yet are split evenly among
+  the nodes, so that each one first-touches its share into its own
+  memory.  Pools created before the call are not pinned; use
+  blosc_free_resources() for getting rid of them.  This is only
+  supported on Linux.
+
+  Returns the number of NUMA nodes found (0 if unknown).
+  */
+BLOSC_EXPORT int blosc_set_numa(int numa);
+
+
+/**
+  Enable (1) or disable (0, the default) huge pages for the scratch
+  buffers of Blosc (temporaries and staging areas of every thread) of
+  256 KB or more, which cuts the TLB misses of shuffling and codecs on
+  large blocks.  Buffers are mapped in 2 MB pages reserved by the
+  administrator (MAP_HUGETLB) when available, or as transparent huge
+  pages (madvise()) otherwise, and fall back to regular pages if both
+  fail.  Every buffer is rounded up to 2 MB, so this pays off with
+  large blocks and long-lived working space (reusable contexts, the
+  non-contextual API, pools of threads) rather than with one-off calls.
+  Buffers already allocated keep their pages until they are grown or
+  released (see blosc_free_resources()).  Buffers from an allocator
+  registered with blosc_set_allocator() are left to it.  This is only
+  supported on Linux.
+
+  Returns 1 if huge pages are supported, 0 otherwise.
+  */
+BLOSC_EXPORT int blosc_set_hugepages(int hugepages);
+
+
+/* A task of a parallel job: `task(job, index)` does the share of `job`
+   that falls to task number `index` */
+typedef void (*blosc_task)(void *job, int index);
+
+/* Runs `task(job, i)` for every i in [0, ntasks), with as much
+   parallelism as wished, and returns once all the tasks are done */
+typedef void (*blosc_executor)(blosc_task task, void *job, int ntasks,
+                               void *executor_data);
+
+/**
+  Register an `executor` for running the parallel work of Blosc, so
+  that it can be submitted to the task scheduler of the application
+  instead of running on threads created by Blosc.  `executor_data` is
+  passed back to the executor on every call.
+
+  A parallel (de-)compression with `nthreads` threads is run as
+  `nthreads` tasks.  Tasks take blocks from a shared counter until none
+  are left, so they balance the work among themselves however many of
+  them actually run at the same time; running them one after another
+  is correct too.  Asynchronous jobs still run on Blosc's own threads.
+
+  Passing NULL goes back to Blosc's own threads (the default).  The
+  executor cannot be changed while Blosc functions are running.
+  */
+BLOSC_EXPORT void blosc_set_executor(blosc_executor executor, void *executor_data);
+
+
+/**
+  Register the functions that Blosc uses for all of its internal
+  memory: scratch buffers, pools of threads, the contexts of the
+  functions above and the state of the codecs.  `allocator_data` is
+  passed back to them on every call, so that applications can plug in
+  arenas, huge page allocators or per-tenant memory budgets.  Blosc
+  copes with allocations failing: the call in progress returns a
+  negative value.  The Snappy library is the only exception, as it
+  allocates through C++ `new`.
+
+  Every object remembers the functions it was allocated with and is
+  released through them, so changing the allocator is safe; even so,
+  the previous functions must stay valid until all the memory they
+  gave has been released.  Idle pools of threads are released right
+  away, and the working space of the non-contextual API (one per
+  calling thread) is made again from the new functions on the next
+  call of every thread (or released by blosc_destroy()).  Contexts from
+  blosc_create_ctx() take the allocator in place at creation, and can
+  be given one of their own with blosc_ctx_set_allocator().  The
+  allocator cannot be changed while Blosc functions are running.
+
+  Passing NULL for both functions goes back to the default allocator.
+  Returns 0 on success, or -1 if only one function is given.
+  */
+BLOSC_EXPORT int blosc_set_allocator(blosc_alloc_fn alloc_fn, blosc_free_fn free_fn,
+                                     void *allocator_data);
+
 #ifdef __cplusplus
 }
 #endif
@@ -158,6 +158,24 @@ else BLOCK_COPY(op, ref, len, op_limit);
 
 int blosclz_compress(int opt_level, const void* input, int length,
 		     void* output, int maxout, int accel)
+{
+  struct blosclz_htab* htab;
+  int cbytes;
+
+  htab = (struct blosclz_htab*) calloc(1, sizeof(struct blosclz_htab));
+  if (htab == NULL) {
+    return 0;
+  }
+  cbytes = blosclz_compress_ht(opt_level, input, length, output, maxout,
+                               accel, htab);
+  free(htab);
+  return cbytes;
+}
+
+
+int blosclz_compress_ht(int opt_level, const void* input, int length,
+			void* output, int maxout, int accel,
+			struct blosclz_htab* htab)
 {
   uint8_t* ip = (uint8_t*) input;
   uint8_t* ibase = (uint8_t*) input;
@@ -174,8 +192,8 @@ int blosclz_compress(int opt_level, const void* input, int length,
      get maximum compression, even with large blocksizes. */
   int8_t hash_log_[10] = {-1, 11, 11, 11, 12, 13, 13, 13, 13, 13};
   uint8_t hash_log = hash_log_[opt_level];
-  uint16_t hash_size = 1 << hash_log;
-  uint16_t *htab;
+  uint16_t* hash = htab->entries;
+  uint16_t base;
   uint8_t* op_limit;
 
   int32_t hval;
@@ -193,8 +211,6 @@ int blosclz_compress(int opt_level, const void* input, int length,
     return 0;                   /* mark this as uncompressible */
   }
 
-  htab = (uint16_t *) calloc(hash_size, sizeof(uint16_t));
-
   /* sanity check */
   if(BLOSCLZ_UNEXPECT_CONDITIONAL(length < 4)) {
     if(length) {
@@ -203,12 +219,22 @@ int blosclz_compress(int opt_level, const void* input, int length,
       ip_bound++;
       while(ip <= ip_bound)
         *op++ = *ip++;
-      free(htab);
       return length+1;
     }
     else goto out;
   }
 
+  /* Offsets are stored biased by `base`.  Entries left by previous
+     calls are below it, so they read as offset 0, just as if the table
+     had been cleared.  When the bias runs out (or for inputs larger
+     than 64 KB), the table is cleared and offsets are stored as is. */
+  base = htab->base;
+  if ((int32_t)base + length > 65536) {
+    memset(htab->entries, 0, sizeof(htab->entries));
+    base = 0;
+  }
+  htab->base = ((int32_t)base + length > 65535) ? 65535 : (uint16_t)(base + length);
+
   /* prepare the acceleration to be used in condition */
   accel = accel < 1 ? 1 : accel;
   accel -= 1;
@@ -237,14 +263,14 @@ int blosclz_compress(int opt_level, const void* input, int length,
     /* find potential match */
     HASH_FUNCTION(hval, ip, hash_log);
     /* hval = hash_sequence(ip, hash_log, hash_size); */
-    ref = ibase + htab[hval];
+    ref = ibase + (hash[hval] >= base ? (uint16_t)(hash[hval] - base) : 0);
 
     /* calculate distance to the match */
     distance = (int32_t)(anchor - ref);
 
     /* update hash table if necessary */
     if ((distance & accel) == 0)
-      htab[hval] = (uint16_t)(anchor - ibase);
+      hash[hval] = (uint16_t)(base + (anchor - ibase));
 
     /* is this a match? check the first 3 bytes */
     if (distance==0 || (distance >= MAX_FARDISTANCE) ||
@@ -379,9 +405,9 @@ int blosclz_compress(int opt_level, const void* input, int length,
 
     /* update the hash at match boundary */
     HASH_FUNCTION(hval, ip, hash_log);
-    htab[hval] = (uint16_t)(ip++ - ibase);
+    hash[hval] = (uint16_t)(base + (ip++ - ibase));
     HASH_FUNCTION(hval, ip, hash_log);
-    htab[hval] = (uint16_t)(ip++ - ibase);
+    hash[hval] = (uint16_t)(base + (ip++ - ibase));
 
     /* assuming literal copy */
     *op++ = MAX_COPY-1;
@@ -420,11 +446,9 @@ int blosclz_compress(int opt_level, const void* input, int length,
   /* marker for blosclz */
   *(uint8_t*)output |= (1 << 5);
 
-  free(htab);
   return (int)(op - (uint8_t*)output);
 
  out:
-  free(htab);
   return 0;
 
 }
@@ -43,6 +43,30 @@ extern "C" {
 int blosclz_compress(int opt_level, const void* input, int length,
                      void* output, int maxout, int accel);
 
+/* Log2 of the number of entries in the largest hash table used */
+#define BLOSCLZ_HASH_LOG 13
+
+/**
+  A hash table to be kept between calls to blosclz_compress_ht().  It
+  has to be zeroed before its first use.  Every call stores its
+  offsets biased by `base`, and then moves `base` past them, so the
+  entries left by previous calls look stale without clearing the
+  table.  It is only cleared when the bias runs out.
+*/
+struct blosclz_htab {
+  unsigned short entries[1 << BLOSCLZ_HASH_LOG];
+  unsigned short base;
+};
+
+/**
+  Same as blosclz_compress(), but using `htab` instead of allocating
+  and clearing a new hash table.  The output is the same.
+*/
+
+int blosclz_compress_ht(int opt_level, const void* input, int length,
+                        void* output, int maxout, int accel,
+                        struct blosclz_htab* htab);
+
 /**
   Decompress a block of compressed data and returns the size of the
   decompressed block. If error occurs, e.g. the compressed data is
@@ -0,0 +1,113 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "crc32c-sse42.h"
+
+/* Make sure SSE4.2 and PCLMULQDQ are available for the compilation
+   target and compiler (Visual C++ has the intrinsics anyway). */
+#if !defined(_MSC_VER) && (!defined(__SSE4_2__) || !defined(__PCLMUL__))
+  #error SSE4.2 or PCLMULQDQ is not supported by the target architecture/platform and/or this compiler.
+#endif
+
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+
+
+/* The CRC32 instruction has a latency of 3 cycles but can start every
+   cycle, so long stretches are cut in three streams that are run
+   together and then combined.  These are the bytes of every stream. */
+#define CRC32C_LONG  8192
+#define CRC32C_SHORT 256
+
+/* x^(8n-33) and x^(16n-33) modulo the CRC32C polynomial (bit-reflected)
+   for n = CRC32C_LONG and n = CRC32C_SHORT.  Multiplying a CRC by them
+   (see shift_crc()) moves it past n and 2n zero bytes. */
+static const uint32_t long_shifts[2] = {0x54a86326, 0x1dc403cc};
+static const uint32_t short_shifts[2] = {0xb9e02b86, 0xdd7e3b0c};
+
+
+/* Update `crc` with the 8 bytes at `src` */
+static inline uint32_t crc_word(uint32_t crc, const uint8_t* src)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+  uint64_t word;
+
+  memcpy(&word, src, sizeof(word));
+  return (uint32_t)_mm_crc32_u64(crc, word);
+#else
+  uint32_t words[2];
+
+  memcpy(words, src, sizeof(words));
+  crc = _mm_crc32_u32(crc, words[0]);
+  return _mm_crc32_u32(crc, words[1]);
+#endif
+}
+
+/* Move `crc` past as many zero bytes as `shift` stands for: multiply
+   them and reduce the 64-bit product with the CRC32 instruction */
+static inline uint32_t shift_crc(uint32_t crc, uint32_t shift)
+{
+  uint8_t product[8];
+
+  _mm_storel_epi64((__m128i*)product,
+                   _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc),
+                                        _mm_cvtsi32_si128((int)shift), 0));
+  return crc_word(0, product);
+}
+
+/* Update `crc` with the 3 * `n` bytes at `src`, as three streams of `n`
+   bytes run together */
+static inline uint32_t crc_streams(uint32_t crc, const uint8_t* src, size_t n,
+                                   const uint32_t* shifts)
+{
+  uint32_t crc1 = 0, crc2 = 0;
+  const uint8_t* end = src + n;
+
+  while (src < end) {
+    crc = crc_word(crc, src);
+    crc1 = crc_word(crc1, src + n);
+    crc2 = crc_word(crc2, src + 2 * n);
+    src += 8;
+  }
+  return shift_crc(crc, shifts[1]) ^ shift_crc(crc1, shifts[0]) ^ crc2;
+}
+
+/* SSE4.2-accelerated CRC32C routine */
+uint32_t
+crc32c_sse42(uint32_t crc, const uint8_t* src, size_t len)
+{
+  crc = ~crc;
+
+  /* Get `src` aligned for the words */
+  while (len > 0 && ((uintptr_t)src & 7) != 0) {
+    crc = _mm_crc32_u8(crc, *src++);
+    len--;
+  }
+
+  while (len >= 3 * CRC32C_LONG) {
+    crc = crc_streams(crc, src, CRC32C_LONG, long_shifts);
+    src += 3 * CRC32C_LONG;
+    len -= 3 * CRC32C_LONG;
+  }
+  while (len >= 3 * CRC32C_SHORT) {
+    crc = crc_streams(crc, src, CRC32C_SHORT, short_shifts);
+    src += 3 * CRC32C_SHORT;
+    len -= 3 * CRC32C_SHORT;
+  }
+
+  /* Whatever is left, in a single stream */
+  while (len >= 8) {
+    crc = crc_word(crc, src);
+    src += 8;
+    len -= 8;
+  }
+  while (len > 0) {
+    crc = _mm_crc32_u8(crc, *src++);
+    len--;
+  }
+
+  return ~crc;
+}
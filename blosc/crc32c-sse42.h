@@ -0,0 +1,29 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+/* SSE4.2-accelerated CRC32C routine. */
+
+#ifndef CRC32C_SSE42_H
+#define CRC32C_SSE42_H
+
+#include "shuffle-common.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+  SSE4.2-accelerated CRC32C routine (it needs PCLMULQDQ too).
+*/
+BLOSC_NO_EXPORT uint32_t crc32c_sse42(uint32_t crc, const uint8_t* src,
+                                      size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CRC32C_SSE42_H */
@@ -0,0 +1,40 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+/*  CRC32C (Castagnoli) checksums for the blocks of compressed buffers.
+    crc32c() dynamically dispatches to the hardware-accelerated routine
+    when the host processor has one. */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include "shuffle-common.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+  Generic (table-driven) CRC32C routine.
+  Updates `crc` (0 to start with) with the `len` bytes of `src`.
+*/
+BLOSC_NO_EXPORT uint32_t crc32c_generic(uint32_t crc, const uint8_t* src,
+                                        size_t len);
+
+/**
+  Primary CRC32C routine.
+  Updates `crc` (0 to start with) with the `len` bytes of `src`.  This
+  function dynamically dispatches to the SSE4.2 routine when the host
+  processor supports it, and to the generic one otherwise.
+*/
+BLOSC_NO_EXPORT uint32_t crc32c(uint32_t crc, const uint8_t* src, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CRC32C_H */
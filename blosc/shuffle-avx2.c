@@ -463,21 +463,19 @@ shuffle_avx2(const size_t bytesoftype, const size_t blocksize,
 void
 unshuffle_avx2(const size_t bytesoftype, const size_t blocksize,
                const uint8_t* const _src, uint8_t* const _dest) {
-  int unaligned_src = (int)((uintptr_t)_src % 16);
-  int unaligned_dest = (int)((uintptr_t)_dest % 16);
   int multiple_of_block = (blocksize % (32 * bytesoftype)) == 0;
   int too_small = (blocksize < 256);
 
-  if (unaligned_src || unaligned_dest || !multiple_of_block || too_small) {
-    /* _src or _dest buffer is not aligned, not multiple of the vectorization
-     * size or is not too small.  Call the generic routine. */
+  if (!multiple_of_block || too_small) {
+    /* Not multiple of the vectorization size or too small.
+     * Call the generic routine. */
     unshuffle_generic(bytesoftype, blocksize, _src, _dest);
     return;
   }
 
   /* Optimized unshuffle */
-  /* The buffers must be aligned on a 16 bytes boundary, have a power */
-  /* of 2 size and be larger or equal than 256 bytes. */
+  /* The kernels load and store unaligned, so the buffers can have any */
+  /* alignment; the size must be a power of 2 larger or equal than 256. */
   if (bytesoftype == 4) {
     unshuffle4_avx2(_dest, _src, blocksize);
   }
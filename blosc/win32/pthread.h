@@ -36,6 +36,7 @@
 #endif
 
 #include <windows.h>
+#include <errno.h>
 
 /*
  * Defines that adapt Windows API threads to pthreads API
@@ -89,4 +90,15 @@ extern int pthread_create(pthread_t *thread, const void *unused,
 
 extern int win32_pthread_join(pthread_t *thread, void **value_ptr);
 
+/*
+ * Thread-specific data, based on TLS indexes.  Destructors are not
+ * supported: values of exiting threads are not cleaned up.
+ */
+#define pthread_key_t DWORD
+#define pthread_key_create(key, destructor) \
+	((*(key) = TlsAlloc()) == TLS_OUT_OF_INDEXES ? EAGAIN : 0)
+#define pthread_key_delete(key) (TlsFree(key) ? 0 : EINVAL)
+#define pthread_getspecific(key) TlsGetValue(key)
+#define pthread_setspecific(key, value) (TlsSetValue((key), (value)) ? 0 : ENOMEM)
+
 #endif /* PTHREAD_H */
@@ -0,0 +1,288 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for user-registered allocators (blosc_set_allocator() and
+  blosc_ctx_set_allocator()).
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+#if defined(_WIN32)
+  #include <windows.h>
+  #define LOCK_T CRITICAL_SECTION
+  #define LOCK_INIT(l) InitializeCriticalSection(l)
+  #define LOCK(l) EnterCriticalSection(l)
+  #define UNLOCK(l) LeaveCriticalSection(l)
+#else
+  #include <pthread.h>
+  #define LOCK_T pthread_mutex_t
+  #define LOCK_INIT(l) pthread_mutex_init(l, NULL)
+  #define LOCK(l) pthread_mutex_lock(l)
+  #define UNLOCK(l) pthread_mutex_unlock(l)
+#endif
+
+int tests_run = 0;
+
+/* Room in front of every block for remembering its size */
+#define HEADER_SIZE 64
+
+/* Bookkeeping of an allocator (its `allocator_data`) */
+struct counter {
+  LOCK_T lock;
+  int nallocs;
+  int nfrees;
+  int misaligned;
+  size_t live;          /* bytes currently allocated */
+  size_t budget;        /* fail allocations past this (0 for no limit) */
+};
+
+/* Global vars */
+void *src, *dest, *dest2;
+size_t size = 1*MB;
+struct counter global_counter, ctx_counter;
+
+
+static void* count_alloc(size_t nbytes, size_t alignment, void* data)
+{
+  struct counter* counter = (struct counter*)data;
+  uint8_t* block = NULL;
+
+  LOCK(&counter->lock);
+  if (counter->budget == 0 || counter->live + nbytes <= counter->budget) {
+    block = (uint8_t*)blosc_test_malloc(HEADER_SIZE, nbytes + HEADER_SIZE);
+  }
+  if (block != NULL) {
+    *(size_t*)block = nbytes;
+    block += HEADER_SIZE;
+    counter->nallocs++;
+    counter->live += nbytes;
+    if (alignment > HEADER_SIZE || (uintptr_t)block % alignment != 0) {
+      counter->misaligned++;
+    }
+  }
+  UNLOCK(&counter->lock);
+  return block;
+}
+
+static void count_free(void* ptr, void* data)
+{
+  struct counter* counter = (struct counter*)data;
+  uint8_t* block = (uint8_t*)ptr - HEADER_SIZE;
+
+  LOCK(&counter->lock);
+  counter->nfrees++;
+  counter->live -= *(size_t*)block;
+  UNLOCK(&counter->lock);
+  blosc_test_free(block);
+}
+
+static void reset_counter(struct counter* counter, size_t budget)
+{
+  counter->nallocs = 0;
+  counter->nfrees = 0;
+  counter->misaligned = 0;
+  counter->live = 0;
+  counter->budget = budget;
+}
+
+
+/* Run a roundtrip with the _ctx functions */
+static char *roundtrip(const char *compressor, int nthreads) {
+  int cbytes, nbytes;
+
+  memset(dest2, 0, size);
+  cbytes = blosc_compress_ctx(5, 1, 4, size, src, dest, size + BLOSC_MAX_OVERHEAD,
+                              compressor, 0, nthreads);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+  nbytes = blosc_decompress_ctx(dest, dest2, size, nthreads);
+  mu_assert("ERROR: nbytes incorrect", nbytes == (int)size);
+  mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2, size) == 0);
+  return 0;
+}
+
+
+/* All the memory of the library goes through the global allocator */
+static char *test_global_allocator() {
+  char *compressors[] = {"blosclz", "lz4", "zlib"};
+  char *msg;
+  int i, cbytes;
+
+  reset_counter(&global_counter, 0);
+  mu_assert("ERROR: cannot set allocator",
+            blosc_set_allocator(count_alloc, count_free, &global_counter) == 0);
+  for (i = 0; i < 3; i++) {
+    if (blosc_compname_to_compcode(compressors[i]) < 0) {
+      continue;
+    }
+    msg = roundtrip(compressors[i], 1);
+    if (msg) return msg;
+    msg = roundtrip(compressors[i], 4);
+    if (msg) return msg;
+  }
+  cbytes = blosc_compress(5, 1, 4, size, src, dest, size + BLOSC_MAX_OVERHEAD);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+  mu_assert("ERROR: allocator not used", global_counter.nallocs > 0);
+  mu_assert("ERROR: misaligned block", global_counter.misaligned == 0);
+
+  /* Going back to the default allocator releases the idle pools, and
+     blosc_destroy() the context of the global API */
+  mu_assert("ERROR: cannot unset allocator",
+            blosc_set_allocator(NULL, NULL, NULL) == 0);
+  blosc_destroy();
+  blosc_init();
+  mu_assert("ERROR: leaked blocks", global_counter.nallocs == global_counter.nfrees);
+  mu_assert("ERROR: leaked bytes", global_counter.live == 0);
+  return 0;
+}
+
+
+/* The context of the global API follows the allocator when it changes */
+static char *test_global_switch() {
+  int nthreads, nallocs, cbytes;
+
+  for (nthreads = 1; nthreads <= 4; nthreads += 3) {
+    blosc_set_nthreads(nthreads);
+    cbytes = blosc_compress(5, 1, 4, size, src, dest, size + BLOSC_MAX_OVERHEAD);
+    mu_assert("ERROR: compression failed", cbytes > 0);
+    reset_counter(&global_counter, 0);
+    blosc_set_allocator(count_alloc, count_free, &global_counter);
+    cbytes = blosc_compress(5, 1, 4, size, src, dest, size + BLOSC_MAX_OVERHEAD);
+    mu_assert("ERROR: compression failed", cbytes > 0);
+    mu_assert("ERROR: context not made again", global_counter.nallocs > 0);
+    mu_assert("ERROR: decompression failed",
+              blosc_decompress(dest, dest2, size) == (int)size);
+    if (nthreads == 1) {
+      nallocs = global_counter.nallocs;
+      cbytes = blosc_compress(5, 1, 4, size, src, dest, size + BLOSC_MAX_OVERHEAD);
+      mu_assert("ERROR: compression failed", cbytes > 0);
+      mu_assert("ERROR: memory allocated on every call",
+                global_counter.nallocs == nallocs);
+    }
+
+    /* Going back to the default allocator gives everything back */
+    blosc_set_allocator(NULL, NULL, NULL);
+    nallocs = global_counter.nallocs;
+    cbytes = blosc_compress(5, 1, 4, size, src, dest, size + BLOSC_MAX_OVERHEAD);
+    mu_assert("ERROR: compression failed", cbytes > 0);
+    mu_assert("ERROR: old allocator still used", global_counter.nallocs == nallocs);
+    mu_assert("ERROR: old context not released",
+              global_counter.nallocs == global_counter.nfrees);
+  }
+  blosc_set_nthreads(1);
+  return 0;
+}
+
+
+/* A context with an allocator of its own does not touch the global one */
+static char *test_ctx_allocator() {
+  struct blosc_ctx *ctx;
+  int i, cbytes, nbytes;
+
+  reset_counter(&global_counter, 0);
+  reset_counter(&ctx_counter, 0);
+  blosc_set_allocator(count_alloc, count_free, &global_counter);
+  ctx = blosc_create_ctx("blosclz", 5, 1, 4, 0, 4);
+  mu_assert("ERROR: cannot create context", ctx != NULL);
+  mu_assert("ERROR: cannot set allocator",
+            blosc_ctx_set_allocator(ctx, count_alloc, count_free, &ctx_counter) == 0);
+  for (i = 0; i < 3; i++) {
+    cbytes = blosc_compress_with_ctx(ctx, size, src, dest, size + BLOSC_MAX_OVERHEAD);
+    mu_assert("ERROR: compression failed", cbytes > 0);
+    nbytes = blosc_decompress_with_ctx(ctx, dest, dest2, size);
+    mu_assert("ERROR: nbytes incorrect", nbytes == (int)size);
+  }
+  mu_assert("ERROR: context allocator not used", ctx_counter.nallocs > 0);
+  /* Only the context itself comes from the global allocator */
+  mu_assert("ERROR: global allocator used", global_counter.nallocs == 2);
+  blosc_free_ctx(ctx);
+  blosc_set_allocator(NULL, NULL, NULL);
+
+  mu_assert("ERROR: leaked blocks", ctx_counter.nallocs == ctx_counter.nfrees);
+  mu_assert("ERROR: leaked bytes", ctx_counter.live == 0);
+  mu_assert("ERROR: leaked blocks", global_counter.nallocs == global_counter.nfrees);
+  return 0;
+}
+
+
+/* Allocations failing (e.g. a memory budget exhausted) make the calls
+   fail, and nothing leaks */
+static char *test_budget() {
+  size_t budgets[] = {1*KB, 16*KB, 64*KB};
+  int i, nthreads, cbytes;
+
+  for (i = 0; i < 3; i++) {
+    for (nthreads = 1; nthreads <= 4; nthreads += 3) {
+      reset_counter(&global_counter, budgets[i]);
+      blosc_set_allocator(count_alloc, count_free, &global_counter);
+      cbytes = blosc_compress_ctx(5, 1, 4, size, src, dest, size + BLOSC_MAX_OVERHEAD,
+                                  "blosclz", 0, nthreads);
+      mu_assert("ERROR: compression did not fail", cbytes < 0);
+      blosc_set_allocator(NULL, NULL, NULL);
+      mu_assert("ERROR: leaked blocks", global_counter.nallocs == global_counter.nfrees);
+      mu_assert("ERROR: leaked bytes", global_counter.live == 0);
+    }
+  }
+  return 0;
+}
+
+
+/* Both functions must be given, or none */
+static char *test_wrong_params() {
+  mu_assert("ERROR: missing free function accepted",
+            blosc_set_allocator(count_alloc, NULL, NULL) < 0);
+  mu_assert("ERROR: missing alloc function accepted",
+            blosc_set_allocator(NULL, count_free, NULL) < 0);
+  return 0;
+}
+
+
+static char *all_tests() {
+  mu_run_test(test_global_allocator);
+  mu_run_test(test_global_switch);
+  mu_run_test(test_ctx_allocator);
+  mu_run_test(test_budget);
+  mu_run_test(test_wrong_params);
+  return 0;
+}
+
+#define BUFFER_ALIGN_SIZE   32
+
+int main(int argc, char **argv) {
+  int32_t *_src;
+  char *result;
+  size_t i;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  LOCK_INIT(&global_counter.lock);
+  LOCK_INIT(&ctx_counter.lock);
+  blosc_init();
+
+  /* Initialize buffers */
+  src = blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest = blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD);
+  dest2 = blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  _src = (int32_t *)src;
+  for (i=0; i < (size/4); i++) {
+    _src[i] = (int32_t)(i * 3);
+  }
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  blosc_test_free(src);
+  blosc_test_free(dest);
+  blosc_test_free(dest2);
+
+  blosc_destroy();
+
+  return result != 0;
+}
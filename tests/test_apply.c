@@ -0,0 +1,166 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for blosc_decompress_apply().
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+
+int tests_run = 0;
+
+/* Global vars */
+uint8_t *src, *dest;
+size_t size = 1*MB + 1000;   /* the last block is a leftover one */
+size_t blocksize;
+
+/* What the function saw, block by block */
+#define MAX_BLOCKS 4096
+int seen[MAX_BLOCKS];
+int wrong[MAX_BLOCKS];
+int stop_at = -1;
+
+
+/* Check `block` against src */
+static int check_block(int nblock, const void *block, size_t nbytes,
+                       void *apply_data) {
+  (void)apply_data;
+  if (nblock < 0 || nblock >= MAX_BLOCKS) {
+    return -2;
+  }
+  if (nblock == stop_at) {
+    return -7;
+  }
+  seen[nblock]++;
+  if ((size_t)nblock * blocksize + nbytes > size ||
+      memcmp(src + (size_t)nblock * blocksize, block, nbytes) != 0) {
+    wrong[nblock]++;
+  }
+  return 0;
+}
+
+
+static char *check_apply(int clevel, int nthreads) {
+  size_t nbytes, cbytes;
+  int cbytes_, i, nblocks;
+  int64_t result;
+
+  cbytes_ = blosc_compress_ctx(clevel, 1, 4, size, src, dest,
+                               size + BLOSC_MAX_OVERHEAD, "blosclz", 0, 1);
+  mu_assert("ERROR: compression failed", cbytes_ > 0);
+  blosc_cbuffer_sizes(dest, &nbytes, &cbytes, &blocksize);
+  nblocks = (int)((size + blocksize - 1) / blocksize);
+  mu_assert("ERROR: too many blocks", nblocks <= MAX_BLOCKS);
+
+  memset(seen, 0, sizeof(seen));
+  memset(wrong, 0, sizeof(wrong));
+  result = blosc_decompress_apply(dest, check_block, NULL, nthreads);
+  mu_assert("ERROR: wrong result", result == (int64_t)size);
+  for (i = 0; i < nblocks; i++) {
+    mu_assert("ERROR: block not seen once", seen[i] == 1);
+    mu_assert("ERROR: block data differs", wrong[i] == 0);
+  }
+  return 0;
+}
+
+
+static char *test_serial() {
+  return check_apply(5, 1);
+}
+
+
+static char *test_parallel() {
+  char *msg;
+
+  msg = check_apply(5, 4);
+  if (msg) return msg;
+  return check_apply(9, 3);
+}
+
+
+static char *test_memcpyed() {
+  char *msg;
+
+  msg = check_apply(0, 1);
+  if (msg) return msg;
+  return check_apply(0, 2);
+}
+
+
+/* The function stops the decompression with its own error */
+static char *test_stop() {
+  int nthreads;
+
+  mu_assert("ERROR: compression failed",
+            blosc_compress_ctx(5, 1, 4, size, src, dest, size + BLOSC_MAX_OVERHEAD,
+                               "lz4", 0, 1) > 0);
+  stop_at = 3;
+  for (nthreads = 1; nthreads <= 4; nthreads += 3) {
+    mu_assert("ERROR: error not passed on",
+              blosc_decompress_apply(dest, check_block, NULL, nthreads) == -7);
+  }
+  stop_at = -1;
+  return 0;
+}
+
+
+/* Buffers with a wrong header are rejected before any block */
+static char *test_bad_header() {
+  uint8_t header[BLOSC_MIN_HEADER_LENGTH];
+
+  mu_assert("ERROR: compression failed",
+            blosc_compress_ctx(5, 1, 4, size, src, dest, size + BLOSC_MAX_OVERHEAD,
+                               "lz4", 0, 1) > 0);
+  memcpy(header, dest, sizeof(header));
+  memset(dest + 8, 0, 4);                        /* blocksize */
+  mu_assert("ERROR: zero blocksize accepted",
+            blosc_decompress_apply(dest, check_block, NULL, 2) < 0);
+  memcpy(dest, header, sizeof(header));
+  return 0;
+}
+
+
+static char *all_tests() {
+  mu_run_test(test_serial);
+  mu_run_test(test_parallel);
+  mu_run_test(test_memcpyed);
+  mu_run_test(test_stop);
+  mu_run_test(test_bad_header);
+  return 0;
+}
+
+#define BUFFER_ALIGN_SIZE   32
+
+int main(int argc, char **argv) {
+  char *result;
+  size_t i;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  blosc_init();
+
+  /* Initialize buffers */
+  src = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD);
+  for (i = 0; i < size; i++) {
+    src[i] = (uint8_t)((i / 7) ^ (i % 13));
+  }
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  blosc_test_free(src);
+  blosc_test_free(dest);
+
+  blosc_destroy();
+
+  return result != 0;
+}
@@ -0,0 +1,152 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for the asynchronous compression/decompression functions.
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+
+int tests_run = 0;
+
+#define NJOBS 4
+
+/* Global vars */
+void *src, *dest[NJOBS], *dest2[NJOBS];
+int clevel = 5;
+int doshuffle = 1;
+size_t typesize = 4;
+size_t size = 1*MB;
+
+
+/* Store the result of a job in the int pointed by `user_data` */
+static void store_result(int result, void *user_data) {
+  *(int *)user_data = result;
+}
+
+
+/* Check several jobs running at the same time, with callbacks */
+static char *test_concurrent_jobs() {
+  struct blosc_async *jobs[NJOBS];
+  int results[NJOBS];
+  int i, cbytes, nbytes;
+
+  cbytes = blosc_compress_ctx(clevel, doshuffle, typesize, size, src, dest2[0],
+                              size + BLOSC_MAX_OVERHEAD, "blosclz", 0, 2);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+
+  for (i = 0; i < NJOBS; i++) {
+    results[i] = -999;
+    jobs[i] = blosc_compress_async(clevel, doshuffle, typesize, size, src,
+                                   dest[i], size + BLOSC_MAX_OVERHEAD, "blosclz",
+                                   0, 2, store_result, &results[i]);
+    mu_assert("ERROR: cannot submit compression", jobs[i] != NULL);
+  }
+  for (i = 0; i < NJOBS; i++) {
+    mu_assert("ERROR: wrong cbytes", blosc_async_wait(jobs[i]) == cbytes);
+    mu_assert("ERROR: callback not called", results[i] == cbytes);
+    mu_assert("ERROR: compressed data differs",
+              memcmp(dest[i], dest2[0], cbytes) == 0);
+  }
+
+  for (i = 0; i < NJOBS; i++) {
+    jobs[i] = blosc_decompress_async(dest[i], dest2[i], size, 2,
+                                     store_result, &results[i]);
+    mu_assert("ERROR: cannot submit decompression", jobs[i] != NULL);
+  }
+  for (i = 0; i < NJOBS; i++) {
+    nbytes = blosc_async_wait(jobs[i]);
+    mu_assert("ERROR: nbytes incorrect", nbytes == (int)size);
+    mu_assert("ERROR: callback not called", results[i] == nbytes);
+    mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2[i], size) == 0);
+  }
+  return 0;
+}
+
+
+/* Check polling, without callbacks and with a single thread */
+static char *test_poll_serial() {
+  struct blosc_async *job;
+  int cbytes;
+
+  job = blosc_compress_async(clevel, doshuffle, typesize, size, src, dest[0],
+                             size + BLOSC_MAX_OVERHEAD, "blosclz", 0, 1,
+                             NULL, NULL);
+  mu_assert("ERROR: cannot submit compression", job != NULL);
+  while (!blosc_async_poll(job)) { }
+  cbytes = blosc_async_wait(job);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+
+  memset(dest2[0], 0, size);
+  job = blosc_decompress_async(dest[0], dest2[0], size, 1, NULL, NULL);
+  mu_assert("ERROR: cannot submit decompression", job != NULL);
+  while (!blosc_async_poll(job)) { }
+  mu_assert("ERROR: nbytes incorrect", blosc_async_wait(job) == (int)size);
+  mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2[0], size) == 0);
+  return 0;
+}
+
+
+/* Check that wrong parameters are reported at submission time */
+static char *test_wrong_params() {
+  mu_assert("ERROR: wrong clevel accepted",
+            blosc_compress_async(10, doshuffle, typesize, size, src, dest[0],
+                                 size + BLOSC_MAX_OVERHEAD, "blosclz", 0, 2,
+                                 NULL, NULL) == NULL);
+  mu_assert("ERROR: wrong nthreads accepted",
+            blosc_decompress_async(dest[0], dest2[0], size, 0,
+                                   NULL, NULL) == NULL);
+  return 0;
+}
+
+
+static char *all_tests() {
+  mu_run_test(test_concurrent_jobs);
+  mu_run_test(test_poll_serial);
+  mu_run_test(test_wrong_params);
+  return 0;
+}
+
+#define BUFFER_ALIGN_SIZE   32
+
+int main(int argc, char **argv) {
+  int32_t *_src;
+  char *result;
+  size_t i;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  blosc_init();
+
+  /* Initialize buffers */
+  src = blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  for (i = 0; i < NJOBS; i++) {
+    dest[i] = blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD);
+    dest2[i] = blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD);
+  }
+  _src = (int32_t *)src;
+  for (i=0; i < (size/4); i++) {
+    _src[i] = (int32_t)(i * 3);
+  }
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  blosc_test_free(src);
+  for (i = 0; i < NJOBS; i++) {
+    blosc_test_free(dest[i]);
+    blosc_test_free(dest2[i]);
+  }
+
+  blosc_destroy();
+
+  return result != 0;
+}
@@ -0,0 +1,177 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for the blosc_compress_batch()/blosc_decompress_batch()
+  pair.
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+
+int tests_run = 0;
+
+#define NITEMS 64
+#define CHUNKSIZE (32*KB)
+
+/* Items with some special cases */
+#define UNCOMPRESSIBLE_ITEM 5
+#define TINY_ITEM 7
+#define WRONG_ITEM 9
+
+/* Global vars */
+void *src[NITEMS], *dest[NITEMS], *dest2[NITEMS], *ref;
+struct blosc_batch_item items[NITEMS];
+size_t destsize = CHUNKSIZE + BLOSC_MAX_OVERHEAD;
+
+
+/* Set up the items for compressing all the chunks */
+static void setup_compression() {
+  int i;
+
+  for (i = 0; i < NITEMS; i++) {
+    items[i].src = src[i];
+    items[i].dest = dest[i];
+    items[i].nbytes = (i == TINY_ITEM) ? 100 : CHUNKSIZE;
+    items[i].destsize = destsize;
+    items[i].clevel = (i == WRONG_ITEM) ? 10 : 5;
+    items[i].doshuffle = 1;
+    items[i].typesize = 4;
+    items[i].compressor = "blosclz";
+    items[i].result = -999;
+  }
+}
+
+
+/* Compress and decompress all the chunks with `nthreads` threads */
+static char *batch_roundtrip(int nthreads) {
+  int i, cbytes;
+
+  setup_compression();
+  mu_assert("ERROR: batch compression failed",
+            blosc_compress_batch(items, NITEMS, 0, nthreads) == 0);
+  for (i = 0; i < NITEMS; i++) {
+    if (i == WRONG_ITEM) {
+      mu_assert("ERROR: wrong item not detected", items[i].result < 0);
+      continue;
+    }
+    /* Results must be the same as compressing chunks one by one */
+    cbytes = blosc_compress_ctx(5, 1, 4, items[i].nbytes, src[i], ref,
+                                destsize, "blosclz", 0, 1);
+    mu_assert("ERROR: cbytes differs", items[i].result == cbytes);
+    mu_assert("ERROR: compressed data differs",
+              memcmp(dest[i], ref, cbytes) == 0);
+  }
+  mu_assert("ERROR: uncompressible item not memcpy'ed",
+            items[UNCOMPRESSIBLE_ITEM].result == CHUNKSIZE + BLOSC_MAX_OVERHEAD);
+
+  for (i = 0; i < NITEMS; i++) {
+    items[i].src = dest[i];
+    items[i].dest = dest2[i];
+    items[i].destsize = CHUNKSIZE;
+    memset(dest2[i], 0, CHUNKSIZE);
+  }
+  /* This one has too little room for its decompressed data */
+  items[WRONG_ITEM].src = dest[0];
+  items[WRONG_ITEM].destsize = CHUNKSIZE / 2;
+  mu_assert("ERROR: batch decompression failed",
+            blosc_decompress_batch(items, NITEMS, nthreads) == 0);
+  for (i = 0; i < NITEMS; i++) {
+    if (i == WRONG_ITEM) {
+      mu_assert("ERROR: wrong item not detected", items[i].result < 0);
+      continue;
+    }
+    mu_assert("ERROR: nbytes incorrect", items[i].result == (int)((i == TINY_ITEM) ? 100 : CHUNKSIZE));
+    mu_assert("ERROR: roundtrip data differs",
+              memcmp(src[i], dest2[i], items[i].result) == 0);
+  }
+  return 0;
+}
+
+
+static char *test_serial() {
+  return batch_roundtrip(1);
+}
+
+
+static char *test_threads() {
+  char *msg;
+  int nthreads;
+
+  for (nthreads = 2; nthreads <= 8; nthreads *= 2) {
+    msg = batch_roundtrip(nthreads);
+    if (msg) return msg;
+  }
+  return 0;
+}
+
+
+static char *test_empty_batch() {
+  mu_assert("ERROR: empty batch failed",
+            blosc_compress_batch(items, 0, 0, 4) == 0);
+  mu_assert("ERROR: empty batch failed",
+            blosc_decompress_batch(items, 0, 4) == 0);
+  return 0;
+}
+
+
+static char *all_tests() {
+  mu_run_test(test_serial);
+  mu_run_test(test_threads);
+  mu_run_test(test_empty_batch);
+  return 0;
+}
+
+#define BUFFER_ALIGN_SIZE   32
+
+int main(int argc, char **argv) {
+  int32_t *_src;
+  char *result;
+  uint32_t seed = 1;
+  size_t i, j;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  blosc_init();
+
+  /* Initialize buffers */
+  for (i = 0; i < NITEMS; i++) {
+    src[i] = blosc_test_malloc(BUFFER_ALIGN_SIZE, CHUNKSIZE);
+    dest[i] = blosc_test_malloc(BUFFER_ALIGN_SIZE, destsize);
+    dest2[i] = blosc_test_malloc(BUFFER_ALIGN_SIZE, CHUNKSIZE);
+    _src = (int32_t *)src[i];
+    for (j = 0; j < CHUNKSIZE / 4; j++) {
+      if (i == UNCOMPRESSIBLE_ITEM) {
+        seed ^= seed << 13;     /* xorshift32 */
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        _src[j] = (int32_t)seed;
+      }
+      else {
+        _src[j] = (int32_t)(j * i);
+      }
+    }
+  }
+  ref = blosc_test_malloc(BUFFER_ALIGN_SIZE, destsize);
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  for (i = 0; i < NITEMS; i++) {
+    blosc_test_free(src[i]);
+    blosc_test_free(dest[i]);
+    blosc_test_free(dest2[i]);
+  }
+  blosc_test_free(ref);
+
+  blosc_destroy();
+
+  return result != 0;
+}
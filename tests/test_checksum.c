@@ -0,0 +1,303 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for block checksums (blosc_set_checksums()).
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+#include "../blosc/crc32c.h"
+
+int tests_run = 0;
+
+/* Global vars */
+uint8_t *src, *dest, *dest2, *dest3;
+size_t size = 1*MB + 1000;   /* the last block is a leftover one */
+size_t dest_size;
+
+
+/* The dispatched CRC32C matches the generic one, whatever the length
+   and alignment */
+static char *test_crc32c() {
+  size_t lengths[] = {0, 1, 7, 8, 9, 100, 767, 768, 769, 3000,
+                      3*8192 - 1, 3*8192, 3*8192 + 13, 100000};
+  size_t offset;
+  uint32_t crc;
+  int i;
+
+  mu_assert("ERROR: wrong check value",
+            crc32c(0, (const uint8_t *)"123456789", 9) == 0xe3069283);
+  mu_assert("ERROR: wrong generic check value",
+            crc32c_generic(0, (const uint8_t *)"123456789", 9) == 0xe3069283);
+  for (i = 0; i < 14; i++) {
+    for (offset = 0; offset < 8; offset += 3) {
+      mu_assert("ERROR: CRC32C differs from the generic one",
+                crc32c(0, src + offset, lengths[i]) ==
+                crc32c_generic(0, src + offset, lengths[i]));
+    }
+  }
+  /* In pieces */
+  crc = crc32c(0, src, 5000);
+  mu_assert("ERROR: CRC32C in pieces differs",
+            crc32c(crc, src + 5000, 95000) == crc32c(0, src, 100000));
+  return 0;
+}
+
+
+/* Compress with checksums, check the flag and decompress */
+static char *check_roundtrip(size_t nbytes, size_t blocksize, int nthreads) {
+  size_t typesize;
+  int flags, cbytes;
+
+  cbytes = blosc_compress_ctx(5, 1, 4, nbytes, src, dest, dest_size,
+                              "blosclz", blocksize, nthreads);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+  blosc_cbuffer_metainfo(dest, &typesize, &flags);
+  mu_assert("ERROR: no checksum flag", flags & BLOSC_DOCHECKSUM);
+  memset(dest2, 0, size);
+  mu_assert("ERROR: wrong decompressed size",
+            blosc_decompress_ctx(dest, dest2, size, nthreads) == (int)nbytes);
+  mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2, nbytes) == 0);
+  return 0;
+}
+
+
+static char *test_roundtrip() {
+  char *msg;
+  int nthreads;
+
+  for (nthreads = 1; nthreads <= 4; nthreads += 3) {
+    msg = check_roundtrip(size, 0, nthreads);
+    if (msg) return msg;
+    /* Fewer blocks than threads: every split is a task */
+    msg = check_roundtrip(300*KB, 256*KB, nthreads);
+    if (msg) return msg;
+  }
+
+  /* Blocks laid out as soon as they are done */
+  blosc_set_deterministic(0);
+  msg = check_roundtrip(size, 0, 4);
+  blosc_set_deterministic(1);
+  return msg;
+}
+
+
+/* The output does not depend on the number of threads */
+static char *test_deterministic() {
+  int cbytes, cbytes2;
+
+  cbytes = blosc_compress_ctx(5, 1, 4, size, src, dest, dest_size,
+                              "lz4", 0, 1);
+  cbytes2 = blosc_compress_ctx(5, 1, 4, size, src, dest3, dest_size,
+                               "lz4", 0, 4);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+  mu_assert("ERROR: sizes differ", cbytes == cbytes2);
+  mu_assert("ERROR: buffers differ", memcmp(dest, dest3, cbytes) == 0);
+
+  cbytes = blosc_compress_ctx(5, 1, 4, 300*KB, src, dest, dest_size,
+                              "lz4", 256*KB, 1);
+  cbytes2 = blosc_compress_ctx(5, 1, 4, 300*KB, src, dest3, dest_size,
+                               "lz4", 256*KB, 4);
+  mu_assert("ERROR: split sizes differ", cbytes > 0 && cbytes == cbytes2);
+  mu_assert("ERROR: split buffers differ", memcmp(dest, dest3, cbytes) == 0);
+  return 0;
+}
+
+
+/* Corrupted blocks are caught by every way of decompressing */
+static char *check_corrupted(size_t nbytes, size_t blocksize, size_t where) {
+  size_t nbytes_, cbytes, blocksize_;
+  int nthreads;
+
+  mu_assert("ERROR: compression failed",
+            blosc_compress_ctx(5, 1, 4, nbytes, src, dest, dest_size,
+                               "blosclz", blocksize, 1) > 0);
+  blosc_cbuffer_sizes(dest, &nbytes_, &cbytes, &blocksize_);
+  dest[cbytes - where] ^= 0x10;
+  for (nthreads = 1; nthreads <= 4; nthreads += 3) {
+    mu_assert("ERROR: corrupted buffer decompressed",
+              blosc_decompress_ctx(dest, dest2, size, nthreads) < 0);
+  }
+  mu_assert("ERROR: corrupted item got",
+            blosc_getitem(dest, (int)(nbytes / 4) - 10, 10, dest2) < 0);
+  dest[cbytes - where] ^= 0x10;
+  mu_assert("ERROR: fixed buffer not decompressed",
+            blosc_decompress_ctx(dest, dest2, size, 4) == (int)nbytes);
+  return 0;
+}
+
+
+static char *test_corrupted() {
+  char *msg;
+
+  /* Near the end of the last block, and further into it */
+  msg = check_corrupted(size, 0, 1);
+  if (msg) return msg;
+  msg = check_corrupted(size, 0, 100);
+  if (msg) return msg;
+  return check_corrupted(300*KB, 256*KB, 1);
+}
+
+
+/* Memcpy'ed buffers carry no checksums */
+static char *test_memcpyed() {
+  size_t typesize;
+  int flags, cbytes;
+
+  cbytes = blosc_compress_ctx(0, 1, 4, size, src, dest, dest_size,
+                              "blosclz", 0, 1);
+  mu_assert("ERROR: compression failed", cbytes == (int)size + BLOSC_MAX_OVERHEAD);
+  blosc_cbuffer_metainfo(dest, &typesize, &flags);
+  mu_assert("ERROR: checksum flag set", !(flags & BLOSC_DOCHECKSUM));
+  mu_assert("ERROR: wrong decompressed size",
+            blosc_decompress_ctx(dest, dest2, size, 2) == (int)size);
+  mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2, size) == 0);
+  return 0;
+}
+
+
+/* Put the output of a stream in `dest` */
+static int write_out(const void *data, size_t nbytes, int64_t offset,
+                     void *user_data) {
+  (void)user_data;
+  if (offset < 0 || (size_t)offset + nbytes > dest_size) {
+    return -1;
+  }
+  memcpy(dest + offset, data, nbytes);
+  return 0;
+}
+
+
+/* Streams, 64-bit headers and decoders */
+static char *test_others() {
+  struct blosc_stream *stream;
+  struct blosc_decoder *decoder;
+  const void *block;
+  size_t typesize, i;
+  int flags, bsize, pos = 0;
+  int64_t cbytes;
+
+  stream = blosc_stream_new("lz4", 5, 1, 4, 0, 3, size, write_out, NULL);
+  mu_assert("ERROR: cannot create stream", stream != NULL);
+  mu_assert("ERROR: cannot write", blosc_stream_write(stream, src, size / 2) == 0);
+  cbytes = blosc_stream_finish(stream);
+  blosc_stream_free(stream);
+  mu_assert("ERROR: cannot finish", cbytes > 0);
+  blosc_cbuffer_metainfo(dest, &typesize, &flags);
+  mu_assert("ERROR: no checksum flag in stream", flags & BLOSC_DOCHECKSUM);
+  mu_assert("ERROR: wrong stream size",
+            blosc_decompress_ctx(dest, dest2, size, 2) == (int)(size / 2));
+  mu_assert("ERROR: stream data differs", memcmp(src, dest2, size / 2) == 0);
+
+  /* Blocks that do not compress at all still fit */
+  for (i = 0; i < size; i++) {
+    dest3[i] = (uint8_t)rand();
+  }
+  stream = blosc_stream_new("blosclz", 5, 0, 1, 0, 2, size, write_out, NULL);
+  mu_assert("ERROR: cannot create stream", stream != NULL);
+  mu_assert("ERROR: cannot write noise", blosc_stream_write(stream, dest3, size) == 0);
+  cbytes = blosc_stream_finish(stream);
+  blosc_stream_free(stream);
+  mu_assert("ERROR: cannot finish noise", cbytes > 0);
+  mu_assert("ERROR: wrong noise size",
+            blosc_decompress_ctx(dest, dest2, size, 2) == (int)size);
+  mu_assert("ERROR: noise differs", memcmp(dest3, dest2, size) == 0);
+
+  stream = blosc_stream_new("lz4", 5, 1, 4, 0, 3, size, write_out, NULL);
+  mu_assert("ERROR: cannot create stream", stream != NULL);
+  mu_assert("ERROR: cannot write", blosc_stream_write(stream, src, size / 2) == 0);
+  mu_assert("ERROR: cannot finish", blosc_stream_finish(stream) > 0);
+  blosc_stream_free(stream);
+  decoder = blosc_decoder_new(dest, 2);
+  mu_assert("ERROR: cannot create decoder", decoder != NULL);
+  while ((bsize = blosc_decoder_next(decoder, &block)) > 0) {
+    mu_assert("ERROR: block data differs", memcmp(src + pos, block, bsize) == 0);
+    pos += bsize;
+  }
+  blosc_decoder_free(decoder);
+  mu_assert("ERROR: decoder failed", bsize == 0 && pos == (int)(size / 2));
+
+  cbytes = blosc_compress64(5, 1, 4, size, src, dest, dest_size);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+  blosc_cbuffer_metainfo(dest, &typesize, &flags);
+  mu_assert("ERROR: no checksum flag in 64-bit header", flags & BLOSC_DOCHECKSUM);
+  mu_assert("ERROR: wrong 64-bit size",
+            blosc_decompress64(dest, dest2, size) == (int64_t)size);
+  mu_assert("ERROR: 64-bit data differs", memcmp(src, dest2, size) == 0);
+  mu_assert("ERROR: getitem failed", blosc_getitem(dest, 1000, 100, dest2) == 400);
+  mu_assert("ERROR: getitem data differs", memcmp(src + 4000, dest2, 400) == 0);
+  dest[cbytes - 1] ^= 0x10;
+  mu_assert("ERROR: corrupted 64-bit buffer decompressed",
+            blosc_decompress64(dest, dest2, size) < 0);
+  return 0;
+}
+
+
+/* Checksums are off by default */
+static char *test_disabled() {
+  size_t typesize;
+  int flags;
+
+  blosc_set_checksums(0);
+  mu_assert("ERROR: compression failed",
+            blosc_compress_ctx(5, 1, 4, size, src, dest, dest_size,
+                               "blosclz", 0, 1) > 0);
+  blosc_cbuffer_metainfo(dest, &typesize, &flags);
+  mu_assert("ERROR: checksum flag set", !(flags & BLOSC_DOCHECKSUM));
+  blosc_set_checksums(1);
+  return 0;
+}
+
+
+static char *all_tests() {
+  mu_run_test(test_crc32c);
+  mu_run_test(test_roundtrip);
+  mu_run_test(test_deterministic);
+  mu_run_test(test_corrupted);
+  mu_run_test(test_memcpyed);
+  mu_run_test(test_others);
+  mu_run_test(test_disabled);
+  return 0;
+}
+
+#define BUFFER_ALIGN_SIZE   32
+
+int main(int argc, char **argv) {
+  char *result;
+  size_t i;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  blosc_init();
+  blosc_set_checksums(1);
+
+  /* Initialize buffers */
+  dest_size = size + BLOSC_MAX_OVERHEAD64 + 64*KB;
+  src = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, dest_size);
+  dest2 = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest3 = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, dest_size);
+  for (i = 0; i < size; i++) {
+    src[i] = (uint8_t)((i / 7) ^ (i % 13));
+  }
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  blosc_test_free(src);
+  blosc_test_free(dest);
+  blosc_test_free(dest2);
+  blosc_test_free(dest3);
+
+  blosc_destroy();
+
+  return result != 0;
+}
@@ -0,0 +1,188 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for the blosc_compress_ctx()/blosc_decompress_ctx() pair.
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+
+int tests_run = 0;
+
+/* Global vars */
+void *src, *dest, *dest2, *dest3;
+int clevel = 5;
+int doshuffle = 1;
+size_t typesize = 4;
+size_t size = 4*MB;
+
+
+/* Run a compression/decompression roundtrip with `nthreads` threads */
+static char *roundtrip(const char *compressor, int nthreads) {
+  int cbytes, nbytes;
+
+  memset(dest2, 0, size);
+  cbytes = blosc_compress_ctx(clevel, doshuffle, typesize, size, src, dest,
+                              size + BLOSC_MAX_OVERHEAD, compressor, 0, nthreads);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+  nbytes = blosc_decompress_ctx(dest, dest2, size, nthreads);
+  mu_assert("ERROR: nbytes incorrect", nbytes == (int)size);
+  mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2, size) == 0);
+  return 0;
+}
+
+
+/* Check that pools of threads can be borrowed again and again */
+static char *test_repeated_calls() {
+  int i;
+  char *msg;
+
+  for (i = 0; i < 20; i++) {
+    msg = roundtrip("blosclz", 4);
+    if (msg) return msg;
+  }
+  return 0;
+}
+
+
+/* Check that switching the number of threads between calls works */
+static char *test_changing_nthreads() {
+  int nthreads;
+  char *msg;
+
+  for (nthreads = 1; nthreads <= 8; nthreads++) {
+    msg = roundtrip("blosclz", nthreads);
+    if (msg) return msg;
+    msg = roundtrip("blosclz", 9 - nthreads);
+    if (msg) return msg;
+  }
+  return 0;
+}
+
+
+/* Check that cached pools are recreated after freeing resources */
+static char *test_free_resources() {
+  char *msg;
+
+  msg = roundtrip("blosclz", 3);
+  if (msg) return msg;
+  mu_assert("ERROR: cannot free resources", blosc_free_resources() == 0);
+  return roundtrip("blosclz", 3);
+}
+
+
+/* Check that the compressed buffer does not depend on the threads used */
+static char *test_deterministic_output() {
+  int nthreads, cbytes, cbytes1;
+
+  cbytes1 = blosc_compress_ctx(clevel, doshuffle, typesize, size, src, dest3,
+                               size + BLOSC_MAX_OVERHEAD, "blosclz", 0, 1);
+  mu_assert("ERROR: compression failed", cbytes1 > 0);
+  for (nthreads = 2; nthreads <= 8; nthreads++) {
+    cbytes = blosc_compress_ctx(clevel, doshuffle, typesize, size, src, dest,
+                                size + BLOSC_MAX_OVERHEAD, "blosclz", 0, nthreads);
+    mu_assert("ERROR: cbytes differs", cbytes == cbytes1);
+    mu_assert("ERROR: compressed data differs", memcmp(dest, dest3, cbytes) == 0);
+  }
+
+  /* Blocks written in completion order must still decompress fine */
+  blosc_set_deterministic(0);
+  for (nthreads = 2; nthreads <= 8; nthreads++) {
+    char *msg = roundtrip("blosclz", nthreads);
+    if (msg) return msg;
+  }
+  blosc_set_deterministic(1);
+  return 0;
+}
+
+
+/* Check that blocks compressed right into a destination with no room
+   to spare give the same results as with a single thread */
+static char *test_tight_dest() {
+  int nthreads, cbytes, cbytes1;
+
+  cbytes1 = blosc_compress_ctx(clevel, doshuffle, typesize, size, src, dest3,
+                               size + BLOSC_MAX_OVERHEAD, "lz4", 0, 1);
+  mu_assert("ERROR: compression failed", cbytes1 > 0);
+  for (nthreads = 2; nthreads <= 8; nthreads++) {
+    cbytes = blosc_compress_ctx(clevel, doshuffle, typesize, size, src, dest,
+                                cbytes1, "lz4", 0, nthreads);
+    mu_assert("ERROR: cbytes differs", cbytes == cbytes1);
+    mu_assert("ERROR: compressed data differs", memcmp(dest, dest3, cbytes) == 0);
+    cbytes = blosc_compress_ctx(clevel, doshuffle, typesize, size, src, dest,
+                                cbytes1 - 1, "lz4", 0, nthreads);
+    mu_assert("ERROR: output larger than destination accepted", cbytes == 0);
+  }
+  return 0;
+}
+
+
+/* Check that threads meet at barriers whatever the spin budget */
+static char *test_spin_budget() {
+  int budgets[] = {0, 1, 100000};
+  int i, j, old_budget;
+  char *msg;
+
+  for (i = 0; i < 3; i++) {
+    old_budget = blosc_set_spin_budget(budgets[i]);
+    for (j = 0; j < 5; j++) {
+      msg = roundtrip("blosclz", 4);
+      if (msg) return msg;
+    }
+    blosc_set_spin_budget(old_budget);
+  }
+  return 0;
+}
+
+
+static char *all_tests() {
+  mu_run_test(test_repeated_calls);
+  mu_run_test(test_changing_nthreads);
+  mu_run_test(test_free_resources);
+  mu_run_test(test_deterministic_output);
+  mu_run_test(test_tight_dest);
+  mu_run_test(test_spin_budget);
+  return 0;
+}
+
+#define BUFFER_ALIGN_SIZE   32
+
+int main(int argc, char **argv) {
+  int32_t *_src;
+  char *result;
+  size_t i;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  blosc_init();
+
+  /* Initialize buffers */
+  src = blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest = blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD);
+  dest2 = blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest3 = blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD);
+  _src = (int32_t *)src;
+  for (i=0; i < (size/4); i++) {
+    _src[i] = (int32_t)(i * 3);
+  }
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  blosc_test_free(src);
+  blosc_test_free(dest);
+  blosc_test_free(dest2);
+  blosc_test_free(dest3);
+
+  blosc_destroy();
+
+  return result != 0;
+}
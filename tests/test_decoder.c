@@ -0,0 +1,163 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for block-by-block decompression (blosc_decoder_new() and
+  friends).
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+
+int tests_run = 0;
+
+/* Global vars */
+uint8_t *src, *dest;
+size_t size = 1*MB + 1000;   /* the last block is a leftover one */
+
+
+/* Walk all the blocks of `dest` and check them against src */
+static char *check_decoder(int nthreads) {
+  struct blosc_decoder *decoder;
+  const void *block;
+  size_t nbytes, cbytes, blocksize, pos;
+  int bsize, pass;
+
+  blosc_cbuffer_sizes(dest, &nbytes, &cbytes, &blocksize);
+  decoder = blosc_decoder_new(dest, nthreads);
+  mu_assert("ERROR: cannot create decoder", decoder != NULL);
+  for (pass = 0; pass < 2; pass++) {
+    pos = 0;
+    while ((bsize = blosc_decoder_next(decoder, &block)) > 0) {
+      mu_assert("ERROR: block too large", (size_t)bsize <= blocksize);
+      mu_assert("ERROR: past the end", pos + bsize <= size);
+      mu_assert("ERROR: block data differs", memcmp(src + pos, block, bsize) == 0);
+      pos += bsize;
+    }
+    mu_assert("ERROR: decoder failed", bsize == 0);
+    mu_assert("ERROR: blocks missing", pos == size);
+    mu_assert("ERROR: not at the end", blosc_decoder_next(decoder, &block) == 0);
+    blosc_decoder_rewind(decoder);
+  }
+  blosc_decoder_free(decoder);
+  return 0;
+}
+
+
+static char *check_compressed(int clevel, int doshuffle, size_t blocksize) {
+  char *msg;
+  int cbytes, nthreads;
+
+  cbytes = blosc_compress_ctx(clevel, doshuffle, 4, size, src, dest,
+                              size + BLOSC_MAX_OVERHEAD, "blosclz", blocksize, 1);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+  for (nthreads = 1; nthreads <= 5; nthreads += 2) {
+    msg = check_decoder(nthreads);
+    if (msg) return msg;
+  }
+  return 0;
+}
+
+
+static char *test_shuffle() {
+  return check_compressed(5, 1, 0);
+}
+
+
+static char *test_noshuffle() {
+  return check_compressed(5, 0, 0);
+}
+
+
+/* Few blocks, so the read-ahead windows are split into tasks */
+static char *test_large_blocks() {
+  return check_compressed(5, 1, 256*KB);
+}
+
+
+static char *test_memcpyed() {
+  return check_compressed(0, 1, 0);
+}
+
+
+/* Small buffers, with fewer blocks than threads */
+static char *test_small() {
+  struct blosc_decoder *decoder;
+  const void *block;
+  int cbytes, bsize, pos = 0;
+
+  cbytes = blosc_compress_ctx(5, 1, 4, 1000, src, dest, 1000 + BLOSC_MAX_OVERHEAD,
+                              "lz4", 0, 1);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+  decoder = blosc_decoder_new(dest, 4);
+  mu_assert("ERROR: cannot create decoder", decoder != NULL);
+  while ((bsize = blosc_decoder_next(decoder, &block)) > 0) {
+    mu_assert("ERROR: block data differs", memcmp(src + pos, block, bsize) == 0);
+    pos += bsize;
+  }
+  mu_assert("ERROR: wrong size", bsize == 0 && pos == 1000);
+  blosc_decoder_free(decoder);
+  mu_assert("ERROR: wrong nthreads accepted", blosc_decoder_new(dest, 0) == NULL);
+  return 0;
+}
+
+
+/* Buffers with a wrong header are rejected */
+static char *test_bad_header() {
+  int cbytes;
+
+  cbytes = blosc_compress_ctx(5, 1, 4, size, src, dest, size + BLOSC_MAX_OVERHEAD,
+                              "lz4", 0, 1);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+  memset(dest + 8, 0, 4);                        /* blocksize */
+  mu_assert("ERROR: zero blocksize accepted", blosc_decoder_new(dest, 2) == NULL);
+  memset(dest + 8, 0xff, 4);
+  mu_assert("ERROR: negative blocksize accepted", blosc_decoder_new(dest, 2) == NULL);
+  return 0;
+}
+
+
+static char *all_tests() {
+  mu_run_test(test_shuffle);
+  mu_run_test(test_noshuffle);
+  mu_run_test(test_large_blocks);
+  mu_run_test(test_memcpyed);
+  mu_run_test(test_small);
+  mu_run_test(test_bad_header);
+  return 0;
+}
+
+#define BUFFER_ALIGN_SIZE   32
+
+int main(int argc, char **argv) {
+  char *result;
+  size_t i;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  blosc_init();
+
+  /* Initialize buffers */
+  src = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD);
+  for (i = 0; i < size; i++) {
+    src[i] = (uint8_t)((i / 7) ^ (i % 13));
+  }
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  blosc_test_free(src);
+  blosc_test_free(dest);
+
+  blosc_destroy();
+
+  return result != 0;
+}
@@ -0,0 +1,137 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for running the parallel work on an external executor.
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+
+int tests_run = 0;
+
+/* Global vars */
+void *src, *dest, *dest2, *ref;
+int clevel = 5;
+int doshuffle = 1;
+size_t typesize = 4;
+size_t size = 4*MB;
+int ncalls = 0;
+int ntasks_run = 0;
+
+
+/* A trivial executor running the tasks one by one, in reverse order */
+static void reverse_executor(blosc_task task, void *job, int ntasks,
+                             void *executor_data) {
+  int i;
+
+  *(int *)executor_data += 1;
+  for (i = ntasks - 1; i >= 0; i--) {
+    task(job, i);
+    ntasks_run++;
+  }
+}
+
+
+/* Check that jobs are run through the executor and give the same output */
+static char *test_roundtrip() {
+  int cbytes, cbytes1, nbytes, nthreads;
+
+  cbytes1 = blosc_compress_ctx(clevel, doshuffle, typesize, size, src, ref,
+                               size + BLOSC_MAX_OVERHEAD, "blosclz", 0, 1);
+  mu_assert("ERROR: compression failed", cbytes1 > 0);
+
+  blosc_set_executor(reverse_executor, &ncalls);
+  for (nthreads = 2; nthreads <= 8; nthreads *= 2) {
+    ncalls = 0;
+    ntasks_run = 0;
+    cbytes = blosc_compress_ctx(clevel, doshuffle, typesize, size, src, dest,
+                                size + BLOSC_MAX_OVERHEAD, "blosclz", 0, nthreads);
+    mu_assert("ERROR: executor not used", ncalls > 0);
+    mu_assert("ERROR: wrong number of tasks", ntasks_run == ncalls * nthreads);
+    mu_assert("ERROR: cbytes differs", cbytes == cbytes1);
+    mu_assert("ERROR: compressed data differs", memcmp(dest, ref, cbytes) == 0);
+
+    memset(dest2, 0, size);
+    nbytes = blosc_decompress_ctx(dest, dest2, size, nthreads);
+    mu_assert("ERROR: nbytes incorrect", nbytes == (int)size);
+    mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2, size) == 0);
+  }
+  blosc_set_executor(NULL, NULL);
+
+  /* Back to internal threads */
+  ncalls = 0;
+  cbytes = blosc_compress_ctx(clevel, doshuffle, typesize, size, src, dest,
+                              size + BLOSC_MAX_OVERHEAD, "blosclz", 0, 4);
+  mu_assert("ERROR: executor still used", ncalls == 0);
+  mu_assert("ERROR: cbytes differs", cbytes == cbytes1);
+  return 0;
+}
+
+
+/* Check that the global API also goes through the executor */
+static char *test_global_api() {
+  int cbytes, nbytes;
+
+  blosc_set_executor(reverse_executor, &ncalls);
+  blosc_set_nthreads(3);
+  ncalls = 0;
+  cbytes = blosc_compress(clevel, doshuffle, typesize, size, src, dest,
+                          size + BLOSC_MAX_OVERHEAD);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+  nbytes = blosc_decompress(dest, dest2, size);
+  mu_assert("ERROR: nbytes incorrect", nbytes == (int)size);
+  mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2, size) == 0);
+  mu_assert("ERROR: executor not used", ncalls > 0);
+  blosc_set_nthreads(1);
+  blosc_set_executor(NULL, NULL);
+  return 0;
+}
+
+
+static char *all_tests() {
+  mu_run_test(test_roundtrip);
+  mu_run_test(test_global_api);
+  return 0;
+}
+
+#define BUFFER_ALIGN_SIZE   32
+
+int main(int argc, char **argv) {
+  int32_t *_src;
+  char *result;
+  size_t i;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  blosc_init();
+
+  /* Initialize buffers */
+  src = blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest = blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD);
+  dest2 = blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  ref = blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD);
+  _src = (int32_t *)src;
+  for (i=0; i < (size/4); i++) {
+    _src[i] = (int32_t)(i * 3);
+  }
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  blosc_test_free(src);
+  blosc_test_free(dest);
+  blosc_test_free(dest2);
+  blosc_test_free(ref);
+
+  blosc_destroy();
+
+  return result != 0;
+}
@@ -0,0 +1,163 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for calling blosc_compress()/blosc_decompress() from
+  several application threads at the same time.
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+#if !defined(_WIN32)
+  #include <pthread.h>
+#endif
+#if defined(__linux__)
+  #include <dirent.h>
+#endif
+
+int tests_run = 0;
+
+#define NAPPTHREADS 4
+#define MANYAPPTHREADS 24     /* more than the pools that are cached */
+#define NITER 20
+
+/* Global vars */
+size_t size = 1*MB;
+int failures = 0;
+int max_threads = 0;      /* most threads seen in the process */
+
+
+/* Number of threads of the process (0 if unknown) */
+static int count_threads(void) {
+  int n = 0;
+#if defined(__linux__)
+  DIR *dir = opendir("/proc/self/task");
+  struct dirent *entry;
+
+  if (dir == NULL) {
+    return 0;
+  }
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] != '.') {
+      n++;
+    }
+  }
+  closedir(dir);
+#endif
+  return n;
+}
+
+
+/* Compress and decompress a buffer of its own again and again */
+static void *worker(void *arg) {
+  int id = (int)(size_t)arg;
+  int32_t *src, *dest2;
+  void *dest;
+  size_t i;
+  int iter, cbytes, nbytes, nthreads;
+
+  src = (int32_t *)blosc_test_malloc(32, size);
+  dest = blosc_test_malloc(32, size + BLOSC_MAX_OVERHEAD);
+  dest2 = (int32_t *)blosc_test_malloc(32, size);
+  for (i = 0; i < size / 4; i++) {
+    src[i] = (int32_t)(i * (id + 1));
+  }
+
+  for (iter = 0; iter < NITER; iter++) {
+    memset(dest2, 0, size);
+    cbytes = blosc_compress(5, 1, 4, size, src, dest, size + BLOSC_MAX_OVERHEAD);
+    nbytes = blosc_decompress(dest, dest2, size);
+    nthreads = count_threads();
+    if (nthreads > max_threads) {
+      max_threads = nthreads;     /* races only make it smaller */
+    }
+    if (cbytes <= 0 || nbytes != (int)size || memcmp(src, dest2, size) != 0) {
+      failures++;
+      break;
+    }
+  }
+
+  blosc_test_free(src);
+  blosc_test_free(dest);
+  blosc_test_free(dest2);
+  return NULL;
+}
+
+
+/* Run the workers in `napp` threads at once, with `nthreads` internal
+   threads each */
+static char *run_workers(int nthreads, int napp) {
+  int i;
+#if !defined(_WIN32)
+  pthread_t threads[MANYAPPTHREADS];
+#endif
+
+  blosc_set_nthreads(nthreads);
+  failures = 0;
+  max_threads = 0;
+#if !defined(_WIN32)
+  for (i = 0; i < napp; i++) {
+    mu_assert("ERROR: cannot create thread",
+              pthread_create(&threads[i], NULL, worker, (void *)(size_t)i) == 0);
+  }
+  for (i = 0; i < napp; i++) {
+    pthread_join(threads[i], NULL);
+  }
+#else
+  for (i = 0; i < napp; i++) {
+    worker((void *)(size_t)i);
+  }
+#endif
+  mu_assert("ERROR: roundtrip failed in some thread", failures == 0);
+  /* The main thread, the callers and a single pool */
+  mu_assert("ERROR: too many threads",
+            max_threads <= 1 + napp + (nthreads - 1));
+  return 0;
+}
+
+
+static char *test_serial_threads() {
+  return run_workers(1, NAPPTHREADS);
+}
+
+
+static char *test_parallel_threads() {
+  return run_workers(3, NAPPTHREADS);
+}
+
+
+/* Callers share the pool instead of taking one each */
+static char *test_many_threads() {
+  return run_workers(4, MANYAPPTHREADS);
+}
+
+
+static char *all_tests() {
+  mu_run_test(test_serial_threads);
+  mu_run_test(test_parallel_threads);
+  mu_run_test(test_many_threads);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  char *result;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  blosc_init();
+  blosc_set_compressor("blosclz");
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  blosc_destroy();
+
+  return result != 0;
+}
@@ -0,0 +1,246 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for buffers with 64-bit sizes (blosc_compress64() and
+  blosc_decompress64()).
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+
+int tests_run = 0;
+
+/* Global vars */
+uint8_t *src, *dest, *dest2;
+size_t size = 1*MB;
+
+
+/* Roundtrip through the 64-bit header with `nthreads` threads */
+static char *check_roundtrip(int clevel, int doshuffle, int nthreads) {
+  int64_t cbytes, nbytes;
+  size_t nbytes_, cbytes_, blocksize;
+
+  blosc_set_nthreads(nthreads);
+  cbytes = blosc_compress64(clevel, doshuffle, 4, size, src, dest,
+                            size + BLOSC_MAX_OVERHEAD64);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+  mu_assert("ERROR: wrong header version", dest[0] == BLOSC_VERSION_FORMAT64);
+  blosc_cbuffer_sizes(dest, &nbytes_, &cbytes_, &blocksize);
+  mu_assert("ERROR: nbytes incorrect in header", nbytes_ == size);
+  mu_assert("ERROR: cbytes incorrect in header", cbytes_ == (size_t)cbytes);
+
+  memset(dest2, 0, size);
+  nbytes = blosc_decompress64(dest, dest2, size);
+  mu_assert("ERROR: nbytes incorrect", nbytes == (int64_t)size);
+  mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2, size) == 0);
+
+  /* The functions for int sizes read it too */
+  memset(dest2, 0, size);
+  mu_assert("ERROR: blosc_decompress() failed",
+            blosc_decompress(dest, dest2, size) == (int)size);
+  mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2, size) == 0);
+  memset(dest2, 0, size);
+  mu_assert("ERROR: blosc_decompress_ctx() failed",
+            blosc_decompress_ctx(dest, dest2, size, nthreads) == (int)size);
+  mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2, size) == 0);
+  blosc_set_nthreads(1);
+  return 0;
+}
+
+
+static char *test_serial() {
+  char *msg;
+
+  msg = check_roundtrip(5, 1, 1);
+  if (msg) return msg;
+  return check_roundtrip(5, 0, 1);
+}
+
+
+static char *test_parallel() {
+  char *msg;
+
+  msg = check_roundtrip(5, 1, 4);
+  if (msg) return msg;
+  return check_roundtrip(9, 0, 3);
+}
+
+
+/* clevel 0 copies the buffer past the longer header */
+static char *test_memcpyed() {
+  char *msg;
+
+  msg = check_roundtrip(0, 1, 1);
+  if (msg) return msg;
+  return check_roundtrip(0, 1, 2);
+}
+
+
+static char *test_getitem() {
+  int start = 1000, nitems = 50000;
+
+  mu_assert("ERROR: compression failed",
+            blosc_compress64(5, 1, 4, size, src, dest,
+                             size + BLOSC_MAX_OVERHEAD64) > 0);
+  mu_assert("ERROR: getitem failed",
+            blosc_getitem(dest, start, nitems, dest2) == nitems * 4);
+  mu_assert("ERROR: getitem data differs",
+            memcmp(src + start * 4, dest2, nitems * 4) == 0);
+  return 0;
+}
+
+
+/* Buffers with the classic header go through blosc_decompress64() */
+static char *test_old_header() {
+  int cbytes;
+
+  cbytes = blosc_compress(5, 1, 4, size, src, dest, size + BLOSC_MAX_OVERHEAD);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+  mu_assert("ERROR: wrong header version", dest[0] == BLOSC_VERSION_FORMAT);
+  memset(dest2, 0, size);
+  mu_assert("ERROR: nbytes incorrect",
+            blosc_decompress64(dest, dest2, size) == (int64_t)size);
+  mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2, size) == 0);
+  return 0;
+}
+
+
+/* Output that does not fit in `destsize` gives 0 */
+static char *test_small_dest() {
+  mu_assert("ERROR: dest overrun not detected",
+            blosc_compress64(5, 1, 4, size, src, dest, 1000) == 0);
+  return 0;
+}
+
+
+/* Item `i` of a large buffer: a counter, or (when `poor`) a hash with
+   an empty top byte, which only compresses by about a quarter */
+static uint32_t large_item(size_t i, int poor) {
+  uint32_t x = (uint32_t)i;
+
+  if (!poor) {
+    return x;
+  }
+  x ^= x >> 16;
+  x *= 0x7feb352dU;
+  x ^= x >> 15;
+  x *= 0x846ca68bU;
+  x ^= x >> 16;
+  return x & 0xffffffU;
+}
+
+
+/* Roundtrip the large buffer `lsrc` (of `lsize` bytes) through `ldest` */
+static char *check_large_buffer(uint32_t *lsrc, uint8_t *ldest, size_t lsize,
+                                int poor) {
+  int64_t cbytes, nbytes;
+  size_t i;
+
+  for (i = 0; i < lsize / 4; i++) {
+    lsrc[i] = large_item(i, poor);
+  }
+
+  blosc_set_nthreads(4);
+  cbytes = blosc_compress64(5, 1, 4, lsize, lsrc, ldest,
+                            lsize + BLOSC_MAX_OVERHEAD64);
+  /* The classic functions refuse it */
+  nbytes = blosc_decompress(ldest, lsrc, lsize);
+  blosc_set_nthreads(1);
+  if (cbytes > 0 && nbytes < 0) {
+    memset(lsrc, 0, lsize);
+    nbytes = blosc_decompress64(ldest, lsrc, lsize);
+  }
+  for (i = 0; i < lsize / 4; i++) {
+    if (lsrc[i] != large_item(i, poor)) {
+      break;
+    }
+  }
+
+  mu_assert("ERROR: compression failed", cbytes > 0);
+  mu_assert("ERROR: buffer copied instead of compressed",
+            !(ldest[2] & BLOSC_MEMCPYED));
+  mu_assert("ERROR: nbytes incorrect", nbytes == (int64_t)lsize);
+  mu_assert("ERROR: roundtrip data differs", i == lsize / 4);
+  return 0;
+}
+
+
+/* A buffer larger than what the classic header can hold, both well and
+   poorly compressible (the latter keeps the threads staging gigabytes
+   of compressed blocks) */
+static char *test_large_buffer() {
+  size_t lsize = (size_t)2*1024*MB + 100*MB;
+  uint32_t *lsrc;
+  uint8_t *ldest;
+  char *msg;
+
+  if (sizeof(size_t) < 8) {
+    return 0;               /* no way in 32-bit platforms */
+  }
+  lsrc = (uint32_t *)malloc(lsize);
+  /* Left untouched past what the compressor writes */
+  ldest = (uint8_t *)malloc(lsize + BLOSC_MAX_OVERHEAD64);
+  if (lsrc == NULL || ldest == NULL) {
+    free(lsrc);
+    free(ldest);
+    return 0;               /* not enough memory */
+  }
+
+  msg = check_large_buffer(lsrc, ldest, lsize, 0);
+  if (msg == NULL) {
+    msg = check_large_buffer(lsrc, ldest, lsize, 1);
+  }
+  free(lsrc);
+  free(ldest);
+  return msg;
+}
+
+
+static char *all_tests() {
+  mu_run_test(test_serial);
+  mu_run_test(test_parallel);
+  mu_run_test(test_memcpyed);
+  mu_run_test(test_getitem);
+  mu_run_test(test_old_header);
+  mu_run_test(test_small_dest);
+  mu_run_test(test_large_buffer);
+  return 0;
+}
+
+#define BUFFER_ALIGN_SIZE   32
+
+int main(int argc, char **argv) {
+  char *result;
+  size_t i;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  blosc_init();
+
+  /* Initialize buffers */
+  src = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD64);
+  dest2 = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  for (i = 0; i < size; i++) {
+    src[i] = (uint8_t)((i / 7) ^ (i % 13));
+  }
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  blosc_test_free(src);
+  blosc_test_free(dest);
+  blosc_test_free(dest2);
+
+  blosc_destroy();
+
+  return result != 0;
+}
@@ -0,0 +1,127 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for scratch buffers in huge pages (blosc_set_hugepages()).
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+
+int tests_run = 0;
+
+/* Global vars */
+void *src, *dest, *dest2;
+size_t size = 4*MB;
+
+
+/* Roundtrips with a reusable context with large blocks */
+static char *check_ctx(const char *compressor, size_t blocksize, int nthreads) {
+  struct blosc_ctx *ctx;
+  int i, cbytes, nbytes;
+
+  ctx = blosc_create_ctx(compressor, 5, 1, 4, blocksize, nthreads);
+  mu_assert("ERROR: cannot create context", ctx != NULL);
+  for (i = 0; i < 3; i++) {
+    memset(dest2, 0, size);
+    cbytes = blosc_compress_with_ctx(ctx, size - i * 100, src, dest,
+                                     size + BLOSC_MAX_OVERHEAD);
+    mu_assert("ERROR: compression failed", cbytes > 0);
+    nbytes = blosc_decompress_with_ctx(ctx, dest, dest2, size);
+    mu_assert("ERROR: nbytes incorrect", nbytes == (int)(size - i * 100));
+    mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2, nbytes) == 0);
+  }
+  blosc_free_ctx(ctx);
+  return 0;
+}
+
+
+static char *test_serial() {
+  char *msg;
+
+  msg = check_ctx("blosclz", 256*KB, 1);
+  if (msg) return msg;
+  return check_ctx("lz4", 2*MB, 1);
+}
+
+
+static char *test_parallel() {
+  char *msg;
+
+  msg = check_ctx("blosclz", 512*KB, 4);
+  if (msg) return msg;
+  /* A single block, split among the threads */
+  return check_ctx("lz4", size, 3);
+}
+
+
+/* Buffers from before the switch are released fine afterwards */
+static char *test_switching() {
+  int cbytes, nbytes;
+
+  blosc_set_hugepages(0);
+  blosc_set_nthreads(2);
+  blosc_set_blocksize(1*MB);
+  cbytes = blosc_compress(5, 1, 4, size, src, dest, size + BLOSC_MAX_OVERHEAD);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+  blosc_set_hugepages(1);
+  blosc_set_blocksize(2*MB);
+  cbytes = blosc_compress(5, 1, 4, size, src, dest, size + BLOSC_MAX_OVERHEAD);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+  nbytes = blosc_decompress(dest, dest2, size);
+  mu_assert("ERROR: nbytes incorrect", nbytes == (int)size);
+  mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2, size) == 0);
+  blosc_set_blocksize(0);
+  blosc_set_nthreads(1);
+  mu_assert("ERROR: cannot free resources", blosc_free_resources() == 0);
+  return 0;
+}
+
+
+static char *all_tests() {
+  mu_run_test(test_serial);
+  mu_run_test(test_parallel);
+  mu_run_test(test_switching);
+  return 0;
+}
+
+#define BUFFER_ALIGN_SIZE   32
+
+int main(int argc, char **argv) {
+  int32_t *_src;
+  char *result;
+  size_t i;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  blosc_init();
+  blosc_set_hugepages(1);
+
+  /* Initialize buffers */
+  src = blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest = blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD);
+  dest2 = blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  _src = (int32_t *)src;
+  for (i=0; i < (size/4); i++) {
+    _src[i] = (int32_t)(i * 3);
+  }
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  blosc_test_free(src);
+  blosc_test_free(dest);
+  blosc_test_free(dest2);
+
+  blosc_set_hugepages(0);
+  blosc_destroy();
+
+  return result != 0;
+}
@@ -0,0 +1,108 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for NUMA-aware scheduling.
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+
+int tests_run = 0;
+
+/* Global vars */
+void *src, *dest, *dest2, *dest3;
+size_t size = 4*MB;
+
+
+/* Run a roundtrip with `nthreads` threads and check that the compressed
+   buffer is the same as `dest3` (from a single thread) */
+static char *roundtrip(int nthreads, int cbytes1) {
+  int cbytes, nbytes;
+
+  cbytes = blosc_compress_ctx(5, 1, 4, size, src, dest, size + BLOSC_MAX_OVERHEAD,
+                              "blosclz", 32*KB, nthreads);
+  mu_assert("ERROR: cbytes differs", cbytes == cbytes1);
+  mu_assert("ERROR: compressed data differs", memcmp(dest, dest3, cbytes) == 0);
+  memset(dest2, 0, size);
+  nbytes = blosc_decompress_ctx(dest, dest2, size, nthreads);
+  mu_assert("ERROR: nbytes incorrect", nbytes == (int)size);
+  mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2, size) == 0);
+  return 0;
+}
+
+
+/* Check that NUMA-aware pools give the same results as the other ones */
+static char *test_numa_roundtrip() {
+  int nthreads, cbytes1, nnodes;
+  char *msg;
+
+  cbytes1 = blosc_compress_ctx(5, 1, 4, size, src, dest3, size + BLOSC_MAX_OVERHEAD,
+                               "blosclz", 32*KB, 1);
+  mu_assert("ERROR: compression failed", cbytes1 > 0);
+
+  nnodes = blosc_set_numa(1);
+  mu_assert("ERROR: negative number of nodes", nnodes >= 0);
+  blosc_free_resources();
+  for (nthreads = 2; nthreads <= 8; nthreads++) {
+    msg = roundtrip(nthreads, cbytes1);
+    if (msg) return msg;
+  }
+
+  /* Destination pages not touched yet */
+  blosc_test_free(dest2);
+  dest2 = blosc_test_malloc(32, size);
+  msg = roundtrip(4, cbytes1);
+  if (msg) return msg;
+
+  mu_assert("ERROR: number of nodes changed", blosc_set_numa(0) == nnodes);
+  blosc_free_resources();
+  return roundtrip(4, cbytes1);
+}
+
+
+static char *all_tests() {
+  mu_run_test(test_numa_roundtrip);
+  return 0;
+}
+
+#define BUFFER_ALIGN_SIZE   32
+
+int main(int argc, char **argv) {
+  int32_t *_src;
+  char *result;
+  size_t i;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  blosc_init();
+
+  /* Initialize buffers */
+  src = blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest = blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD);
+  dest2 = blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest3 = blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD);
+  _src = (int32_t *)src;
+  for (i=0; i < (size/4); i++) {
+    _src[i] = (int32_t)(i * 3);
+  }
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  blosc_test_free(src);
+  blosc_test_free(dest);
+  blosc_test_free(dest2);
+  blosc_test_free(dest3);
+
+  blosc_destroy();
+
+  return result != 0;
+}
@@ -0,0 +1,319 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for reading ranges of chunks in a region of memory
+  (blosc_reader_new() and friends).
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+#if !defined(_WIN32)
+  #include <sys/mman.h>
+#endif
+
+int tests_run = 0;
+
+#define NCHUNKS 4
+
+/* Global vars */
+uint8_t *src, *region;
+size_t size = 1*MB + 1000;   /* the last block is a leftover one */
+size_t region_size;
+int64_t offsets[NCHUNKS];
+
+
+/* Lay out a few chunks with different settings one after another */
+static char *fill_region(void) {
+  int64_t cbytes, pos = 0;
+  int i;
+
+  for (i = 0; i < NCHUNKS; i++) {
+    blosc_set_checksums(i == 1);
+    switch (i) {
+    case 0:
+      cbytes = blosc_compress_ctx(5, 1, 4, size, src, region + pos,
+                                  size + BLOSC_MAX_OVERHEAD, "lz4", 16*KB, 1);
+      break;
+    case 1:
+      cbytes = blosc_compress_ctx(5, 1, 8, size, src, region + pos,
+                                  size + BLOSC_MAX_OVERHEAD, "lz4", 0, 1);
+      break;
+    case 2:
+      cbytes = blosc_compress_ctx(0, 0, 1, size, src, region + pos,
+                                  size + BLOSC_MAX_OVERHEAD, "blosclz", 0, 1);
+      break;
+    default:
+      cbytes = blosc_compress64(5, 1, 4, size, src, region + pos,
+                                size + BLOSC_MAX_OVERHEAD64);
+      break;
+    }
+    mu_assert("ERROR: compression failed", cbytes > 0);
+    mu_assert("ERROR: chunk not compressed", i == 2 || cbytes < (int64_t)size);
+    offsets[i] = pos;
+    pos += cbytes;
+  }
+  blosc_set_checksums(0);
+  region_size = (size_t)pos;
+  return 0;
+}
+
+
+/* Read [start, start + nbytes) of every chunk and check it */
+static char *check_range(struct blosc_reader *reader, int64_t start,
+                         int64_t nbytes) {
+  uint8_t *dest = malloc((size_t)nbytes + 1);
+  int64_t i, rc;
+
+  for (i = 0; i < NCHUNKS; i++) {
+    dest[nbytes] = 0xa5;
+    rc = blosc_reader_read(reader, i, start, nbytes, dest);
+    if (rc != nbytes || memcmp(dest, src + start, (size_t)nbytes) != 0) {
+      free(dest);
+      return "ERROR: range data differs";
+    }
+    if (dest[nbytes] != 0xa5) {
+      free(dest);
+      return "ERROR: written past the range";
+    }
+  }
+  free(dest);
+  return 0;
+}
+
+
+static char *check_reader(int nthreads) {
+  struct blosc_reader *reader;
+  char *msg = 0;
+  int64_t i;
+  /* Pairs of start and number of bytes */
+  int64_t ranges[] = {0, 1, 0, 16*KB, 100, 200, 16*KB - 10, 20,
+                      5000, 300*KB, 16*KB, 64*KB, 0, (int64_t)size,
+                      (int64_t)size - 1000, 1000, (int64_t)size - 1, 1,
+                      (int64_t)size - 20*KB, 20*KB, 10, 0};
+
+  reader = blosc_reader_new(region, region_size, offsets, NCHUNKS, nthreads);
+  mu_assert("ERROR: cannot create reader", reader != NULL);
+  for (i = 0; i < NCHUNKS; i++) {
+    mu_assert("ERROR: wrong nbytes", blosc_reader_nbytes(reader, i) == (int64_t)size);
+  }
+  for (i = 0; i < (int64_t)(sizeof(ranges) / sizeof(ranges[0])) && !msg; i += 2) {
+    msg = check_range(reader, ranges[i], ranges[i + 1]);
+  }
+  blosc_reader_free(reader);
+  return msg;
+}
+
+
+static char *test_serial() {
+  return check_reader(1);
+}
+
+
+static char *test_parallel() {
+  return check_reader(4);
+}
+
+
+static char *test_errors() {
+  struct blosc_reader *reader;
+  uint8_t dest[16];
+  int64_t bad_offsets[2] = {0, -1};
+
+  mu_assert("ERROR: wrong nthreads accepted",
+            blosc_reader_new(region, region_size, offsets, NCHUNKS, 0) == NULL);
+  reader = blosc_reader_new(region, region_size, offsets, NCHUNKS, 2);
+  mu_assert("ERROR: cannot create reader", reader != NULL);
+  mu_assert("ERROR: chunk out of the reader accepted",
+            blosc_reader_read(reader, NCHUNKS, 0, 1, dest) < 0 &&
+            blosc_reader_nbytes(reader, -1) < 0);
+  mu_assert("ERROR: range out of the chunk accepted",
+            blosc_reader_read(reader, 0, (int64_t)size - 8, 16, dest) < 0 &&
+            blosc_reader_read(reader, 0, -1, 1, dest) < 0 &&
+            blosc_reader_read(reader, 0, 0, -1, dest) < 0);
+  blosc_reader_free(reader);
+
+  /* A region that stops short of the last chunk */
+  reader = blosc_reader_new(region, region_size - 1, offsets, NCHUNKS, 2);
+  mu_assert("ERROR: cannot create reader", reader != NULL);
+  mu_assert("ERROR: truncated chunk accepted",
+            blosc_reader_read(reader, NCHUNKS - 1, 0, 1, dest) < 0);
+  mu_assert("ERROR: previous chunk rejected",
+            blosc_reader_read(reader, NCHUNKS - 2, 0, 16, dest) == 16);
+  blosc_reader_free(reader);
+
+  reader = blosc_reader_new(region, region_size, bad_offsets, 2, 1);
+  mu_assert("ERROR: cannot create reader", reader != NULL);
+  mu_assert("ERROR: negative offset accepted",
+            blosc_reader_nbytes(reader, 1) < 0);
+  blosc_reader_free(reader);
+  return 0;
+}
+
+
+/* Read [start, start + nbytes) of chunk `nchunk` of a copy of the
+   region where the int32 at `pos` of the chunk is set to `value` */
+static int64_t read_corrupted(int nchunk, int64_t pos, int32_t value,
+                              int64_t start, int64_t nbytes) {
+  struct blosc_reader *reader;
+  uint8_t *copy = malloc(region_size);
+  uint8_t *dest = malloc((size_t)nbytes);
+  int64_t rc = -1;
+
+  memcpy(copy, region, region_size);
+  memcpy(copy + offsets[nchunk] + pos, &value, sizeof(value));
+  reader = blosc_reader_new(copy, region_size, offsets, NCHUNKS, 2);
+  if (reader != NULL) {
+    rc = blosc_reader_read(reader, nchunk, start, nbytes, dest);
+    blosc_reader_free(reader);
+  }
+  free(copy);
+  free(dest);
+  return rc;
+}
+
+
+/* Chunks whose header, block starts or splits point out of them */
+static char *test_corrupted() {
+  int32_t hlen = BLOSC_MIN_HEADER_LENGTH;
+  int32_t bstart, nblocks;
+  size_t nbytes, cbytes, blocksize;
+
+  mu_assert("ERROR: zero blocksize accepted",
+            read_corrupted(0, 8, 0, 0, 100) < 0);
+  mu_assert("ERROR: block starts past the chunk accepted",
+            read_corrupted(0, 12, hlen + 8, 0, 100) < 0);
+  mu_assert("ERROR: block start in the header accepted",
+            read_corrupted(0, hlen + 4, 4, 16*KB, 100) < 0);
+  mu_assert("ERROR: block start past the chunk accepted",
+            read_corrupted(0, hlen + 4, INT32_MAX, 16*KB, 100) < 0);
+  mu_assert("ERROR: other blocks rejected",
+            read_corrupted(0, hlen + 4, INT32_MAX, 0, 100) == 100);
+  memcpy(&bstart, region + offsets[0] + hlen + 4, sizeof(bstart));
+  mu_assert("ERROR: split past the chunk accepted",
+            read_corrupted(0, bstart, INT32_MAX, 16*KB, 100) < 0);
+  mu_assert("ERROR: negative split accepted",
+            read_corrupted(0, bstart, -5, 16*KB, 100) < 0);
+  /* The compressed size does not cover the bytes of memcpy'ed chunks */
+  mu_assert("ERROR: short memcpy'ed chunk accepted",
+            read_corrupted(2, 12, (int32_t)size, 0, 100) < 0);
+  /* ... or the checksums of the blocks, past the block starts */
+  blosc_cbuffer_sizes(region + offsets[1], &nbytes, &cbytes, &blocksize);
+  nblocks = (int32_t)((nbytes + blocksize - 1) / blocksize);
+  mu_assert("ERROR: short checksummed chunk accepted",
+            read_corrupted(1, 12, hlen + 4 * nblocks, 0, 100) < 0);
+  return 0;
+}
+
+
+#if !defined(_WIN32)
+/* Allow reading the pages of [start, end) of a protected region */
+static int allow_pages(uint8_t *base, int64_t start, int64_t end) {
+  uintptr_t pagesize = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t first = (uintptr_t)(base + start) & ~(pagesize - 1);
+  uintptr_t last = ((uintptr_t)(base + end) + pagesize - 1) & ~(pagesize - 1);
+
+  return mprotect((void *)first, last - first, PROT_READ);
+}
+
+/* Only the header, the block starts and the blocks of a range are
+   read: everything else of the chunk is made unreadable */
+static char *test_touched() {
+  struct blosc_reader *reader;
+  uint8_t *map, *chunk, *dest;
+  int32_t blocksize = 16*KB, hlen = BLOSC_MIN_HEADER_LENGTH;
+  int32_t nblocks, first, last, bend;
+  int64_t start = 300*KB + 100, nbytes = 40*KB;
+  int cbytes, nthreads;
+
+  map = mmap(NULL, region_size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  mu_assert("ERROR: cannot map region", map != MAP_FAILED);
+  dest = malloc((size_t)nbytes);
+  /* The first chunk has its blocks in order, as it was compressed
+     serially */
+  memcpy(map, region, region_size);
+  chunk = map + offsets[0];
+  memcpy(&cbytes, chunk + 12, sizeof(cbytes));
+  nblocks = (int32_t)((size + blocksize - 1) / blocksize);
+  first = (int32_t)(start / blocksize);
+  last = (int32_t)((start + nbytes - 1) / blocksize);
+  memcpy(&bend, chunk + hlen + (last + 1) * 4, sizeof(bend));
+  mu_assert("ERROR: range reaches the end", last + 1 < nblocks);
+
+  mu_assert("ERROR: cannot protect region",
+            mprotect(map, region_size, PROT_NONE) == 0 &&
+            allow_pages(chunk, 0, hlen) == 0 &&
+            allow_pages(chunk, hlen + first * 4, hlen + (last + 1) * 4) == 0);
+  {
+    int32_t bstart;
+    memcpy(&bstart, chunk + hlen + first * 4, sizeof(bstart));
+    mu_assert("ERROR: cannot protect region",
+              allow_pages(chunk, bstart, bend) == 0);
+  }
+
+  for (nthreads = 1; nthreads <= 4; nthreads += 3) {
+    reader = blosc_reader_new(map, region_size, offsets, NCHUNKS, nthreads);
+    mu_assert("ERROR: cannot create reader", reader != NULL);
+    mu_assert("ERROR: range not read",
+              blosc_reader_read(reader, 0, start, nbytes, dest) == nbytes);
+    mu_assert("ERROR: range data differs",
+              memcmp(dest, src + start, (size_t)nbytes) == 0);
+    blosc_reader_free(reader);
+  }
+
+  free(dest);
+  munmap(map, region_size);
+  return 0;
+}
+#endif
+
+
+static char *all_tests() {
+  char *msg = fill_region();
+  if (msg) return msg;
+  mu_run_test(test_serial);
+  mu_run_test(test_parallel);
+  mu_run_test(test_errors);
+  mu_run_test(test_corrupted);
+#if !defined(_WIN32)
+  mu_run_test(test_touched);
+#endif
+  return 0;
+}
+
+#define BUFFER_ALIGN_SIZE   32
+
+int main(int argc, char **argv) {
+  char *result;
+  size_t i;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  blosc_init();
+
+  /* Initialize buffers */
+  src = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  region = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE,
+                                        NCHUNKS * (size + BLOSC_MAX_OVERHEAD64));
+  for (i = 0; i < size / sizeof(int32_t); i++) {
+    ((int32_t *)src)[i] = (int32_t)(i * 3);
+  }
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  blosc_test_free(src);
+  blosc_test_free(region);
+
+  blosc_destroy();
+
+  return result != 0;
+}
@@ -0,0 +1,125 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for reusable contexts (blosc_create_ctx() and friends).
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+
+int tests_run = 0;
+
+/* Global vars */
+void *src, *dest, *dest2, *dest3;
+size_t size = 1*MB;
+
+
+/* Compress chunks of several sizes with the same context and check
+   that the results match the ones of the _ctx functions */
+static char *check_ctx(const char *compressor, int nthreads) {
+  struct blosc_ctx *ctx;
+  size_t sizes[] = {size, size / 2, 1000, size - 12, size};
+  size_t nbytes;
+  int i, cbytes, cbytes1, dbytes;
+
+  ctx = blosc_create_ctx(compressor, 5, 1, 4, 0, nthreads);
+  mu_assert("ERROR: cannot create context", ctx != NULL);
+  for (i = 0; i < 5; i++) {
+    nbytes = sizes[i];
+    cbytes1 = blosc_compress_ctx(5, 1, 4, nbytes, src, dest3,
+                                 nbytes + BLOSC_MAX_OVERHEAD, compressor, 0, nthreads);
+    cbytes = blosc_compress_with_ctx(ctx, nbytes, src, dest, nbytes + BLOSC_MAX_OVERHEAD);
+    mu_assert("ERROR: cbytes differs", cbytes == cbytes1 && cbytes > 0);
+    mu_assert("ERROR: compressed data differs", memcmp(dest, dest3, cbytes) == 0);
+
+    memset(dest2, 0, nbytes);
+    dbytes = blosc_decompress_with_ctx(ctx, dest, dest2, nbytes);
+    mu_assert("ERROR: nbytes incorrect", dbytes == (int)nbytes);
+    mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2, nbytes) == 0);
+  }
+  blosc_free_ctx(ctx);
+  return 0;
+}
+
+
+static char *test_serial_ctx() {
+  char *msg;
+
+  msg = check_ctx("blosclz", 1);
+  if (msg) return msg;
+  return check_ctx("lz4", 1);
+}
+
+
+static char *test_parallel_ctx() {
+  char *msg;
+
+  msg = check_ctx("blosclz", 4);
+  if (msg) return msg;
+  return check_ctx("lz4", 3);
+}
+
+
+/* Contexts must not be created with wrong parameters */
+static char *test_wrong_params() {
+  mu_assert("ERROR: wrong compressor accepted",
+            blosc_create_ctx("foo", 5, 1, 4, 0, 1) == NULL);
+  mu_assert("ERROR: wrong clevel accepted",
+            blosc_create_ctx("blosclz", 10, 1, 4, 0, 1) == NULL);
+  mu_assert("ERROR: wrong shuffle accepted",
+            blosc_create_ctx("blosclz", 5, 2, 4, 0, 1) == NULL);
+  mu_assert("ERROR: wrong nthreads accepted",
+            blosc_create_ctx("blosclz", 5, 1, 4, 0, 0) == NULL);
+  blosc_free_ctx(NULL);
+  return 0;
+}
+
+
+static char *all_tests() {
+  mu_run_test(test_serial_ctx);
+  mu_run_test(test_parallel_ctx);
+  mu_run_test(test_wrong_params);
+  return 0;
+}
+
+#define BUFFER_ALIGN_SIZE   32
+
+int main(int argc, char **argv) {
+  int32_t *_src;
+  char *result;
+  size_t i;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  blosc_init();
+
+  /* Initialize buffers */
+  src = blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest = blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD);
+  dest2 = blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest3 = blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD);
+  _src = (int32_t *)src;
+  for (i=0; i < (size/4); i++) {
+    _src[i] = (int32_t)(i * 3);
+  }
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  blosc_test_free(src);
+  blosc_test_free(dest);
+  blosc_test_free(dest2);
+  blosc_test_free(dest3);
+
+  blosc_destroy();
+
+  return result != 0;
+}
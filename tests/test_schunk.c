@@ -0,0 +1,353 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for super-chunks (blosc_schunk_new() and friends).
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+
+int tests_run = 0;
+
+/* Global vars */
+int32_t *src, *dest;
+size_t size = 64*KB;     /* bytes per chunk */
+int nchunks = 200;
+
+
+/* Fill `buffer` with the data of chunk `nchunk` */
+static void fill_chunk(int32_t* buffer, int nchunk) {
+  size_t i;
+
+  for (i = 0; i < size / 4; i++) {
+    buffer[i] = (int32_t)(nchunk * 1000 + i);
+  }
+}
+
+/* Check every chunk of `schunk` */
+static char *check_chunks(struct blosc_schunk* schunk) {
+  const void *chunk;
+  size_t cbytes, nbytes_, cbytes_, blocksize;
+  int64_t nbytes, total_cbytes, sum = 0;
+  int i;
+
+  mu_assert("ERROR: wrong number of chunks", blosc_schunk_nchunks(schunk) == nchunks);
+  blosc_schunk_sizes(schunk, &nbytes, &total_cbytes);
+  mu_assert("ERROR: wrong nbytes", nbytes == (int64_t)size * nchunks);
+  for (i = 0; i < nchunks; i++) {
+    mu_assert("ERROR: cannot get chunk",
+              blosc_schunk_get_chunk(schunk, i, &chunk, &cbytes) == 0);
+    blosc_cbuffer_sizes(chunk, &nbytes_, &cbytes_, &blocksize);
+    mu_assert("ERROR: chunk size differs", cbytes_ == cbytes && nbytes_ == size);
+    sum += cbytes;
+
+    fill_chunk(src, i);
+    memset(dest, 0, size);
+    mu_assert("ERROR: decompression failed",
+              blosc_schunk_decompress_chunk(schunk, i, dest, size) == (int)size);
+    mu_assert("ERROR: chunk data differs", memcmp(src, dest, size) == 0);
+  }
+  mu_assert("ERROR: wrong cbytes", sum == total_cbytes);
+  return 0;
+}
+
+/* Make a super-chunk with all the chunks */
+static struct blosc_schunk* new_schunk(int nthreads) {
+  struct blosc_schunk* schunk;
+  int i;
+
+  schunk = blosc_schunk_new("blosclz", 5, 1, 4, 0, nthreads);
+  if (schunk == NULL) {
+    return NULL;
+  }
+  for (i = 0; i < nchunks; i++) {
+    fill_chunk(src, i);
+    if (blosc_schunk_append(schunk, src, size) != i) {
+      blosc_schunk_free(schunk);
+      return NULL;
+    }
+  }
+  return schunk;
+}
+
+
+static char *test_append() {
+  struct blosc_schunk* schunk;
+  const void *chunk;
+  size_t cbytes;
+  char *msg;
+
+  schunk = new_schunk(1);
+  mu_assert("ERROR: cannot build super-chunk", schunk != NULL);
+  msg = check_chunks(schunk);
+  mu_assert("ERROR: chunk out of bounds accepted",
+            blosc_schunk_get_chunk(schunk, nchunks, &chunk, &cbytes) < 0);
+  mu_assert("ERROR: chunk out of bounds accepted",
+            blosc_schunk_get_chunk(schunk, -1, &chunk, &cbytes) < 0);
+  blosc_schunk_free(schunk);
+  return msg;
+}
+
+
+static char *test_parallel() {
+  struct blosc_schunk* schunk;
+  char *msg;
+
+  schunk = new_schunk(4);
+  mu_assert("ERROR: cannot build super-chunk", schunk != NULL);
+  msg = check_chunks(schunk);
+  blosc_schunk_free(schunk);
+  return msg;
+}
+
+
+/* A serialized super-chunk comes back the same, and can grow */
+static char *test_serialize() {
+  struct blosc_schunk *schunk, *schunk2;
+  uint8_t *buffer, *buffer2;
+  int64_t maxsize, bsize, bsize2;
+  char *msg;
+
+  schunk = new_schunk(2);
+  mu_assert("ERROR: cannot build super-chunk", schunk != NULL);
+  maxsize = blosc_schunk_serialize(schunk, NULL, 0);
+  buffer = (uint8_t *)malloc(maxsize);
+  buffer2 = (uint8_t *)malloc(maxsize);
+  bsize = blosc_schunk_serialize(schunk, buffer, maxsize);
+  mu_assert("ERROR: cannot serialize", bsize > 0 && bsize <= maxsize);
+  mu_assert("ERROR: too small buffer accepted",
+            blosc_schunk_serialize(schunk, buffer2, bsize - 1) == 0);
+
+  schunk2 = blosc_schunk_from_buffer(buffer, bsize, 1);
+  mu_assert("ERROR: cannot rebuild super-chunk", schunk2 != NULL);
+  msg = check_chunks(schunk2);
+  if (msg) return msg;
+  bsize2 = blosc_schunk_serialize(schunk2, buffer2, maxsize);
+  mu_assert("ERROR: serialized super-chunk differs",
+            bsize2 == bsize && memcmp(buffer, buffer2, bsize) == 0);
+
+  fill_chunk(src, nchunks);
+  mu_assert("ERROR: cannot append to rebuilt super-chunk",
+            blosc_schunk_append(schunk2, src, size) == nchunks);
+  nchunks++;
+  msg = check_chunks(schunk2);
+  nchunks--;
+  if (msg) return msg;
+
+  /* Damaged buffers are refused */
+  mu_assert("ERROR: truncated buffer accepted",
+            blosc_schunk_from_buffer(buffer, bsize - 1, 1) == NULL);
+  buffer[0] = 'x';
+  mu_assert("ERROR: wrong magic accepted",
+            blosc_schunk_from_buffer(buffer, bsize, 1) == NULL);
+
+  free(buffer);
+  free(buffer2);
+  blosc_schunk_free(schunk);
+  blosc_schunk_free(schunk2);
+  return 0;
+}
+
+
+/* Store `value` as a little-endian int32 at `dest` */
+static void put_int32(uint8_t* dest, int32_t value) {
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    dest[i] = (uint8_t)((uint32_t)value >> (8 * i));
+  }
+}
+
+
+/* A damaged header of the offset index is refused before decompressing */
+static char *test_damaged_index() {
+  struct blosc_schunk *schunk, *schunk2;
+  uint8_t *buffer, *damaged, *index;
+  int64_t maxsize, bsize;
+  int32_t index_size;
+
+  schunk = new_schunk(1);
+  mu_assert("ERROR: cannot build super-chunk", schunk != NULL);
+  maxsize = blosc_schunk_serialize(schunk, NULL, 0);
+  buffer = (uint8_t *)malloc(maxsize);
+  damaged = (uint8_t *)malloc(maxsize);
+  bsize = blosc_schunk_serialize(schunk, buffer, maxsize);
+  mu_assert("ERROR: cannot serialize", bsize > 0);
+  index_size = buffer[20] | buffer[21] << 8 | buffer[22] << 16 | buffer[23] << 24;
+  index = damaged + bsize - index_size;
+
+  /* Compressed size past the end of the buffer */
+  memcpy(damaged, buffer, bsize);
+  put_int32(index + 12, index_size + 1);
+  mu_assert("ERROR: long index accepted",
+            blosc_schunk_from_buffer(damaged, bsize, 1) == NULL);
+  memcpy(damaged, buffer, bsize);
+  put_int32(index + 12, 0x7fffffff);
+  mu_assert("ERROR: huge index accepted",
+            blosc_schunk_from_buffer(damaged, bsize, 1) == NULL);
+
+  /* Uncompressed size other than the room for the offsets */
+  memcpy(damaged, buffer, bsize);
+  put_int32(index + 4, nchunks * 8 + 8);
+  mu_assert("ERROR: index with too many offsets accepted",
+            blosc_schunk_from_buffer(damaged, bsize, 1) == NULL);
+  memcpy(damaged, buffer, bsize);
+  put_int32(index + 4, nchunks * 8 - 8);
+  mu_assert("ERROR: index with too few offsets accepted",
+            blosc_schunk_from_buffer(damaged, bsize, 1) == NULL);
+
+  /* The untouched copy is still fine */
+  memcpy(damaged, buffer, bsize);
+  schunk2 = blosc_schunk_from_buffer(damaged, bsize, 1);
+  mu_assert("ERROR: cannot rebuild super-chunk", schunk2 != NULL);
+  blosc_schunk_free(schunk2);
+
+  free(buffer);
+  free(damaged);
+  blosc_schunk_free(schunk);
+  return 0;
+}
+
+
+/* A chunk whose header claims more bytes than it has is refused */
+static char *test_damaged_chunk() {
+  struct blosc_schunk *schunk, *schunk2;
+  uint8_t *buffer, *damaged, *first, *last;
+  const void *chunk;
+  size_t cbytes0, cbytes;
+  int64_t maxsize, bsize;
+  int32_t index_size;
+
+  schunk = new_schunk(1);
+  mu_assert("ERROR: cannot build super-chunk", schunk != NULL);
+  maxsize = blosc_schunk_serialize(schunk, NULL, 0);
+  buffer = (uint8_t *)malloc(maxsize);
+  damaged = (uint8_t *)malloc(maxsize);
+  bsize = blosc_schunk_serialize(schunk, buffer, maxsize);
+  mu_assert("ERROR: cannot serialize", bsize > 0);
+  index_size = buffer[20] | buffer[21] << 8 | buffer[22] << 16 | buffer[23] << 24;
+  mu_assert("ERROR: cannot get chunk",
+            blosc_schunk_get_chunk(schunk, 0, &chunk, &cbytes0) == 0);
+  mu_assert("ERROR: cannot get chunk",
+            blosc_schunk_get_chunk(schunk, nchunks - 1, &chunk, &cbytes) == 0);
+  /* Chunks come right after the 64-byte header, and the index last */
+  first = damaged + 64;
+  last = damaged + bsize - index_size - cbytes;
+
+  /* Into the next chunk */
+  memcpy(damaged, buffer, bsize);
+  put_int32(first + 12, (int32_t)cbytes0 + 1);
+  mu_assert("ERROR: overlapping chunk accepted",
+            blosc_schunk_from_buffer(damaged, bsize, 1) == NULL);
+
+  /* Past the chunks, into the index */
+  memcpy(damaged, buffer, bsize);
+  put_int32(last + 12, (int32_t)cbytes + 1);
+  mu_assert("ERROR: long last chunk accepted",
+            blosc_schunk_from_buffer(damaged, bsize, 1) == NULL);
+  memcpy(damaged, buffer, bsize);
+  put_int32(last + 12, 0x7fffffff);
+  mu_assert("ERROR: huge last chunk accepted",
+            blosc_schunk_from_buffer(damaged, bsize, 1) == NULL);
+
+  /* Shorter than its header */
+  memcpy(damaged, buffer, bsize);
+  put_int32(first + 12, 8);
+  mu_assert("ERROR: short chunk accepted",
+            blosc_schunk_from_buffer(damaged, bsize, 1) == NULL);
+
+  /* The untouched copy is still fine */
+  memcpy(damaged, buffer, bsize);
+  schunk2 = blosc_schunk_from_buffer(damaged, bsize, 1);
+  mu_assert("ERROR: cannot rebuild super-chunk", schunk2 != NULL);
+  blosc_schunk_free(schunk2);
+
+  free(buffer);
+  free(damaged);
+  blosc_schunk_free(schunk);
+  return 0;
+}
+
+
+static char *test_file() {
+  struct blosc_schunk *schunk, *schunk2;
+  const char *filename = "test_schunk.b2";
+  char *msg;
+
+  schunk = new_schunk(1);
+  mu_assert("ERROR: cannot build super-chunk", schunk != NULL);
+  mu_assert("ERROR: cannot save", blosc_schunk_save(schunk, filename) == 0);
+  schunk2 = blosc_schunk_load(filename, 2);
+  remove(filename);
+  mu_assert("ERROR: cannot load", schunk2 != NULL);
+  msg = check_chunks(schunk2);
+  blosc_schunk_free(schunk);
+  blosc_schunk_free(schunk2);
+  return msg;
+}
+
+
+/* Empty super-chunks serialize too */
+static char *test_empty() {
+  struct blosc_schunk *schunk, *schunk2;
+  uint8_t buffer[256];
+  int64_t bsize;
+
+  schunk = blosc_schunk_new("lz4", 5, 0, 8, 0, 1);
+  mu_assert("ERROR: cannot create super-chunk", schunk != NULL);
+  mu_assert("ERROR: not empty", blosc_schunk_nchunks(schunk) == 0);
+  bsize = blosc_schunk_serialize(schunk, buffer, sizeof(buffer));
+  mu_assert("ERROR: cannot serialize", bsize > 0);
+  schunk2 = blosc_schunk_from_buffer(buffer, bsize, 1);
+  mu_assert("ERROR: cannot rebuild super-chunk", schunk2 != NULL);
+  mu_assert("ERROR: not empty", blosc_schunk_nchunks(schunk2) == 0);
+  blosc_schunk_free(schunk);
+  blosc_schunk_free(schunk2);
+  mu_assert("ERROR: wrong params accepted",
+            blosc_schunk_new("foo", 5, 1, 4, 0, 1) == NULL);
+  return 0;
+}
+
+
+static char *all_tests() {
+  mu_run_test(test_append);
+  mu_run_test(test_parallel);
+  mu_run_test(test_serialize);
+  mu_run_test(test_damaged_index);
+  mu_run_test(test_damaged_chunk);
+  mu_run_test(test_file);
+  mu_run_test(test_empty);
+  return 0;
+}
+
+#define BUFFER_ALIGN_SIZE   32
+
+int main(int argc, char **argv) {
+  char *result;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  blosc_init();
+
+  /* Initialize buffers */
+  src = (int32_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest = (int32_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  blosc_test_free(src);
+  blosc_test_free(dest);
+
+  blosc_destroy();
+
+  return result != 0;
+}
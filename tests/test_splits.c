@@ -0,0 +1,121 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for buffers having fewer blocks than threads, where the
+  splits of the blocks are (de-)compressed in parallel.
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+
+int tests_run = 0;
+
+/* Global vars */
+void *src, *dest, *dest2, *dest3;
+size_t size = 256*KB;
+
+
+/* Compress `nbytes` of src with 1 and `nthreads` threads, check that both
+   outputs are the same and that they decompress fine with `nthreads` */
+static char *check_splits(const char *compressor, int doshuffle,
+                          size_t typesize, size_t nbytes, size_t blocksize,
+                          int nthreads) {
+  int cbytes, cbytes1, nbytes_;
+
+  cbytes1 = blosc_compress_ctx(5, doshuffle, typesize, nbytes, src, dest3,
+                               nbytes + BLOSC_MAX_OVERHEAD, compressor,
+                               blocksize, 1);
+  mu_assert("ERROR: compression failed", cbytes1 > 0);
+  cbytes = blosc_compress_ctx(5, doshuffle, typesize, nbytes, src, dest,
+                              nbytes + BLOSC_MAX_OVERHEAD, compressor,
+                              blocksize, nthreads);
+  mu_assert("ERROR: cbytes differs", cbytes == cbytes1);
+  mu_assert("ERROR: compressed data differs", memcmp(dest, dest3, cbytes) == 0);
+
+  memset(dest2, 0, nbytes);
+  nbytes_ = blosc_decompress_ctx(dest, dest2, nbytes, nthreads);
+  mu_assert("ERROR: nbytes incorrect", nbytes_ == (int)nbytes);
+  mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2, nbytes) == 0);
+  return 0;
+}
+
+
+/* A single block split across the threads */
+static char *test_single_block() {
+  char *msg;
+
+  msg = check_splits("blosclz", 1, 4, size, size, 4);
+  if (msg) return msg;
+  return check_splits("lz4", 1, 8, size, size, 8);
+}
+
+
+/* A block plus a leftover block (which is never split) */
+static char *test_leftover() {
+  char *msg;
+
+  msg = check_splits("blosclz", 1, 8, size - 24, size / 2, 4);
+  if (msg) return msg;
+  return check_splits("lz4hc", 1, 4, size - 100, size / 2, 3);
+}
+
+
+/* Unshuffled blocks are split in contiguous chunks, and not at all when
+   typesize is 1 */
+static char *test_noshuffle() {
+  char *msg;
+
+  msg = check_splits("lz4", 0, 4, size, size, 4);
+  if (msg) return msg;
+  return check_splits("blosclz", 1, 1, size, size, 4);
+}
+
+
+static char *all_tests() {
+  mu_run_test(test_single_block);
+  mu_run_test(test_leftover);
+  mu_run_test(test_noshuffle);
+  return 0;
+}
+
+#define BUFFER_ALIGN_SIZE   32
+
+int main(int argc, char **argv) {
+  int32_t *_src;
+  char *result;
+  size_t i;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  blosc_init();
+
+  /* Initialize buffers */
+  src = blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest = blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD);
+  dest2 = blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest3 = blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD);
+  _src = (int32_t *)src;
+  for (i=0; i < (size/4); i++) {
+    _src[i] = (int32_t)(i / 8);
+  }
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  blosc_test_free(src);
+  blosc_test_free(dest);
+  blosc_test_free(dest2);
+  blosc_test_free(dest3);
+
+  blosc_destroy();
+
+  return result != 0;
+}
@@ -0,0 +1,218 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for compression streams (blosc_stream_new() and friends).
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+
+int tests_run = 0;
+
+/* Global vars */
+uint8_t *src, *dest, *dest2;
+size_t size = 1*MB;
+size_t written;          /* bytes received by write_out() */
+int write_calls;
+
+/* Where write_out() puts the compressed output */
+struct output {
+  uint8_t *buffer;
+  size_t size;
+};
+
+
+/* Put the compressed output in its place */
+static int write_out(const void *data, size_t nbytes, int64_t offset,
+                     void *user_data) {
+  struct output *out = (struct output *)user_data;
+
+  if (offset < 0 || (size_t)offset + nbytes > out->size) {
+    return -1;
+  }
+  memcpy(out->buffer + offset, data, nbytes);
+  written += nbytes;
+  write_calls++;
+  return 0;
+}
+
+
+/* Push `nbytes` of src in pieces of `piece` bytes, and decompress */
+static char *check_stream(const char *compressor, int clevel, int doshuffle,
+                          int nthreads, size_t nbytes, size_t piece) {
+  struct blosc_stream *stream;
+  struct output out;
+  size_t pos, n, nbytes_, cbytes_, blocksize;
+  int64_t cbytes;
+
+  out.buffer = dest;
+  out.size = size + BLOSC_MAX_OVERHEAD + 64*KB;
+  written = 0;
+  write_calls = 0;
+  memset(dest, 0xff, out.size);
+  stream = blosc_stream_new(compressor, clevel, doshuffle, 4, 0, nthreads,
+                            size, write_out, &out);
+  mu_assert("ERROR: cannot create stream", stream != NULL);
+  for (pos = 0; pos < nbytes; pos += n) {
+    n = (nbytes - pos < piece) ? nbytes - pos : piece;
+    mu_assert("ERROR: cannot write", blosc_stream_write(stream, src + pos, n) == 0);
+  }
+  cbytes = blosc_stream_finish(stream);
+  blosc_stream_free(stream);
+  mu_assert("ERROR: cannot finish", cbytes > 0);
+  mu_assert("ERROR: output has holes", written == (size_t)cbytes);
+  if (clevel > 0 && nbytes > 256*KB) {
+    mu_assert("ERROR: output not incremental", write_calls > 2);
+  }
+
+  blosc_cbuffer_sizes(dest, &nbytes_, &cbytes_, &blocksize);
+  mu_assert("ERROR: wrong nbytes", nbytes_ == nbytes);
+  mu_assert("ERROR: wrong cbytes", cbytes_ == (size_t)cbytes);
+  memset(dest2, 0, size);
+  mu_assert("ERROR: wrong decompressed size",
+            blosc_decompress_ctx(dest, dest2, size, nthreads) == (int)nbytes);
+  mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2, nbytes) == 0);
+  if (nbytes > 400) {
+    mu_assert("ERROR: getitem failed", blosc_getitem(dest, 10, 100, dest2) == 400);
+    mu_assert("ERROR: getitem data differs", memcmp(src + 40, dest2, 400) == 0);
+  }
+  return 0;
+}
+
+
+static char *test_pieces() {
+  size_t pieces[] = {1000, 4096, 100*KB, 1*MB};
+  char *msg;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    msg = check_stream("blosclz", 5, 1, 1, size, pieces[i]);
+    if (msg) return msg;
+    msg = check_stream("lz4", 5, 1, 4, size, pieces[i]);
+    if (msg) return msg;
+  }
+  return 0;
+}
+
+
+/* Streams that end before filling a block, or in the middle of one */
+static char *test_sizes() {
+  size_t sizes[] = {0, 3, 100, 5000, 300*KB + 12, size - 1};
+  char *msg;
+  int i;
+
+  for (i = 0; i < 6; i++) {
+    msg = check_stream("blosclz", 5, 1, 3, sizes[i], 7777);
+    if (msg) return msg;
+  }
+  return 0;
+}
+
+
+static char *test_memcpyed() {
+  char *msg;
+
+  msg = check_stream("blosclz", 0, 1, 2, size, 10000);
+  if (msg) return msg;
+  return check_stream("blosclz", 0, 1, 1, 1000, 10000);
+}
+
+
+/* Streams that may go past 2 GB get the 64-bit header */
+static char *test_header64() {
+  struct blosc_stream *stream;
+  struct output out;
+  int64_t cbytes;
+
+  if (sizeof(size_t) < 8) {
+    return 0;
+  }
+  out.size = 4*MB;
+  out.buffer = (uint8_t *)malloc(out.size);
+  written = 0;
+  stream = blosc_stream_new("blosclz", 5, 1, 4, 0, 2, (size_t)3*1024*MB,
+                            write_out, &out);
+  mu_assert("ERROR: cannot create stream", stream != NULL);
+  mu_assert("ERROR: cannot write", blosc_stream_write(stream, src, size) == 0);
+  cbytes = blosc_stream_finish(stream);
+  blosc_stream_free(stream);
+  mu_assert("ERROR: cannot finish", cbytes > 0 && written == (size_t)cbytes);
+  mu_assert("ERROR: wrong header version", out.buffer[0] == BLOSC_VERSION_FORMAT64);
+  memset(dest2, 0, size);
+  mu_assert("ERROR: wrong decompressed size",
+            blosc_decompress64(out.buffer, dest2, size) == (int64_t)size);
+  mu_assert("ERROR: roundtrip data differs", memcmp(src, dest2, size) == 0);
+  free(out.buffer);
+  return 0;
+}
+
+
+/* Pushing past `maxbytes` fails */
+static char *test_maxbytes() {
+  struct blosc_stream *stream;
+  struct output out;
+
+  out.buffer = dest;
+  out.size = size + BLOSC_MAX_OVERHEAD + 64*KB;
+  stream = blosc_stream_new("blosclz", 5, 1, 4, 0, 1, 1000, write_out, &out);
+  mu_assert("ERROR: cannot create stream", stream != NULL);
+  mu_assert("ERROR: cannot write", blosc_stream_write(stream, src, 1000) == 0);
+  mu_assert("ERROR: maxbytes not enforced", blosc_stream_write(stream, src, 1) < 0);
+  mu_assert("ERROR: finished after error", blosc_stream_finish(stream) < 0);
+  blosc_stream_free(stream);
+  mu_assert("ERROR: missing write function accepted",
+            blosc_stream_new("blosclz", 5, 1, 4, 0, 1, 1000, NULL, NULL) == NULL);
+  mu_assert("ERROR: too large blocksize accepted",
+            blosc_stream_new("blosclz", 5, 1, 4, (size_t)BLOSC_MAX_BUFFERSIZE + 1, 8,
+                             (size_t)3*1024*MB, write_out, &out) == NULL);
+  return 0;
+}
+
+
+static char *all_tests() {
+  mu_run_test(test_pieces);
+  mu_run_test(test_sizes);
+  mu_run_test(test_memcpyed);
+  mu_run_test(test_header64);
+  mu_run_test(test_maxbytes);
+  return 0;
+}
+
+#define BUFFER_ALIGN_SIZE   32
+
+int main(int argc, char **argv) {
+  char *result;
+  size_t i;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  blosc_init();
+
+  /* Initialize buffers */
+  src = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE,
+                                      size + BLOSC_MAX_OVERHEAD + 64*KB);
+  dest2 = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  for (i = 0; i < size; i++) {
+    src[i] = (uint8_t)((i / 7) ^ (i % 13));
+  }
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  blosc_test_free(src);
+  blosc_test_free(dest);
+  blosc_test_free(dest2);
+
+  blosc_destroy();
+
+  return result != 0;
+}
@@ -0,0 +1,126 @@
+/*********************************************************************
+  Blosc - Blocked Shuffling and Compression Library
+
+  Unit tests for decompressing into buffers that are not aligned.
+
+  See LICENSES/BLOSC.txt for details about copyright and rights to use.
+**********************************************************************/
+
+#include "test_common.h"
+
+int tests_run = 0;
+
+/* Global vars */
+uint8_t *src, *dest, *dest2;
+size_t size = 256*KB;
+size_t offsets[] = {1, 3, 8, 17};
+int typesizes[] = {2, 4, 8, 16, 24};
+
+
+/* Decompress into dest2 + offset and check against src */
+static char *check_offsets(int typesize, int nthreads) {
+  int i, cbytes, nbytes;
+  uint8_t *out;
+
+  cbytes = blosc_compress_ctx(5, 1, typesize, size, src, dest,
+                              size + BLOSC_MAX_OVERHEAD, "blosclz", 0, nthreads);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+  for (i = 0; i < 4; i++) {
+    out = dest2 + offsets[i];
+    memset(dest2, 0, size + 32);
+    nbytes = blosc_decompress_ctx(dest, out, size, nthreads);
+    mu_assert("ERROR: nbytes incorrect", nbytes == (int)size);
+    mu_assert("ERROR: roundtrip data differs", memcmp(src, out, size) == 0);
+    mu_assert("ERROR: wrote before dest", dest2[offsets[i] - 1] == 0);
+    mu_assert("ERROR: wrote past dest", out[size] == 0);
+  }
+  return 0;
+}
+
+
+static char *test_serial() {
+  char *msg;
+  int i;
+
+  for (i = 0; i < 5; i++) {
+    msg = check_offsets(typesizes[i], 1);
+    if (msg) return msg;
+  }
+  return 0;
+}
+
+
+static char *test_parallel() {
+  char *msg;
+  int i;
+
+  for (i = 0; i < 5; i++) {
+    msg = check_offsets(typesizes[i], 3);
+    if (msg) return msg;
+  }
+  return 0;
+}
+
+
+/* blosc_getitem() into an unaligned buffer */
+static char *test_getitem() {
+  int i, cbytes, nbytes;
+  int start = 1000, nitems = 20000;
+
+  cbytes = blosc_compress_ctx(5, 1, 4, size, src, dest, size + BLOSC_MAX_OVERHEAD,
+                              "lz4", 0, 1);
+  mu_assert("ERROR: compression failed", cbytes > 0);
+  for (i = 0; i < 4; i++) {
+    nbytes = blosc_getitem(dest, start, nitems, dest2 + offsets[i]);
+    mu_assert("ERROR: nbytes incorrect", nbytes == nitems * 4);
+    mu_assert("ERROR: getitem data differs",
+              memcmp(src + start * 4, dest2 + offsets[i], nbytes) == 0);
+  }
+  return 0;
+}
+
+
+static char *all_tests() {
+  mu_run_test(test_serial);
+  mu_run_test(test_parallel);
+  mu_run_test(test_getitem);
+  return 0;
+}
+
+#define BUFFER_ALIGN_SIZE   32
+
+int main(int argc, char **argv) {
+  char *result;
+  size_t i;
+
+  printf("STARTING TESTS for %s", argv[0]);
+
+  blosc_init();
+
+  /* Initialize buffers */
+  src = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, size);
+  dest = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, size + BLOSC_MAX_OVERHEAD);
+  /* Room for the largest offset and a guard byte */
+  dest2 = (uint8_t *)blosc_test_malloc(BUFFER_ALIGN_SIZE, size + 32);
+  for (i = 0; i < size; i++) {
+    src[i] = (uint8_t)((i / 7) ^ (i % 13));
+  }
+
+  /* Run all the suite */
+  result = all_tests();
+  if (result != 0) {
+    printf(" (%s)\n", result);
+  }
+  else {
+    printf(" ALL TESTS PASSED");
+  }
+  printf("\tTests run: %d\n", tests_run);
+
+  blosc_test_free(src);
+  blosc_test_free(dest);
+  blosc_test_free(dest2);
+
+  blosc_destroy();
+
+  return result != 0;
+}